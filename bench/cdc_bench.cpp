@@ -0,0 +1,145 @@
+// content defined chunks against fixed blocks and the rolling scan, on an edited copy of a file:
+// random bytes with a few bytes inserted, deleted or overwritten every MB (so most of the file is
+// shifted against the basis). Reports for each mode the GB/s of the signature of the basis and
+// of the delta generation of the edited file, and how much of it goes as literal bytes.
+// The signature cache is kept out of the way, every signature is hashed.
+// FILESYNC_THREADS sets the pool size.
+//   cdc_bench [MB]
+#include "../common/thread_pool.hpp"
+#include "../common/transfer_options.hpp"
+#include "../destination/destination_manager.hpp"
+#include "../source/source_manager.hpp"
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+std::vector<char> randomBytes(size_t size, uint64_t seed) {
+    std::mt19937_64 random(seed);
+    std::vector<char> data(size);
+    for (size_t i = 0; i + 8 <= size; i += 8) {
+        uint64_t word = random();
+        std::memcpy(&data[i], &word, 8);
+    }
+    return data;
+}
+
+// an insert, a delete or an overwrite of 1 to 64 bytes at a random place of every MB
+std::vector<char> edit(const std::vector<char>& basis, size_t& edits) {
+    const size_t STRIDE = 1 << 20;
+    std::mt19937_64 random(7);
+    std::vector<char> edited;
+    edited.reserve(basis.size() + basis.size() / STRIDE * 64);
+    edits = 0;
+    for (size_t start = 0; start < basis.size(); start += STRIDE) {
+        size_t end = std::min(start + STRIDE, basis.size());
+        size_t at = start + random() % (end - start);
+        size_t len = 1 + random() % 64;
+        edited.insert(edited.end(), basis.begin() + start, basis.begin() + at);
+        switch (random() % 3) {
+            case 0:   // insert
+                for (size_t i = 0; i < len; ++i) edited.push_back(static_cast<char>(random()));
+                edited.insert(edited.end(), basis.begin() + at, basis.begin() + end);
+                break;
+            case 1:   // delete
+                edited.insert(edited.end(), basis.begin() + std::min(at + len, end), basis.begin() + end);
+                break;
+            default:  // overwrite
+                for (size_t i = 0; i < len && at + i < end; ++i) edited.push_back(static_cast<char>(random()));
+                edited.insert(edited.end(), basis.begin() + std::min(at + len, end), basis.begin() + end);
+                break;
+        }
+        edits++;
+    }
+    return edited;
+}
+
+std::string writeTemp(const std::vector<char>& data) {
+    char path[] = "/tmp/cdc_bench.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0 || write(fd, data.data(), data.size()) != static_cast<ssize_t>(data.size())) {
+        perror("temporary file");
+        std::exit(1);
+    }
+    close(fd);
+    return path;
+}
+
+template <class Step>
+double bestSeconds(int runs, Step step) {
+    double best = 1e30;
+    for (int r = 0; r < runs; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        step();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+void bench(const char* name, const TransferOptions& options, const std::string& basisPath, const std::string& editedPath,
+           size_t basisSize, size_t editedSize) {
+    Signature signature;
+    double signSeconds = bestSeconds(3, [&]() {
+        DestinationManager destination(basisPath, options);
+        auto hashes = destination.getFileBlockHashes();
+        if (!hashes.success) {
+            std::fprintf(stderr, "signature failed: %s\n", hashes.message.c_str());
+            std::exit(1);
+        }
+        signature = std::move(hashes.data);
+    });
+
+    SourceManager source(editedPath, signature);
+    size_t literal = 0, instructions = 0;
+    double deltaSeconds = bestSeconds(3, [&]() {
+        auto delta = source.getDelta();
+        if (!delta.success) {
+            std::fprintf(stderr, "delta failed: %s\n", delta.message.c_str());
+            std::exit(1);
+        }
+        literal = 0;
+        instructions = delta.data.size();
+        for (const auto& instruction : delta.data) {
+            if (instruction.type == DeltaType::INSERT) literal += instruction.data.size();
+        }
+    });
+    std::printf("%-14s %9zu %10.2f %10.2f %12zu %8.3f%% %10zu\n", name, signature.blocks.size(), basisSize / signSeconds / 1e9,
+                editedSize / deltaSeconds / 1e9, literal, 100.0 * literal / editedSize, instructions);
+}
+}
+
+int main(int argc, char** argv) {
+    const size_t size = (argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 256) << 20;
+    // no cache directory can be made under a file, so nothing is loaded or stored
+    setenv("FILESYNC_CACHE_DIR", "/dev/null/filesync", 1);
+
+    std::vector<char> basis = randomBytes(size, 1);
+    size_t edits;
+    std::vector<char> edited = edit(basis, edits);
+    std::string basisPath = writeTemp(basis);
+    std::string editedPath = writeTemp(edited);
+
+    std::printf("%zu MB, %zu edits, %zu threads\n", size >> 20, edits, ThreadPool::shared().size());
+    std::printf("%-14s %9s %10s %10s %12s %9s %10s\n", "", "blocks", "sign GB/s", "delta GB/s", "literal", "", "instrs");
+    TransferOptions options;
+    options.chunking = ChunkingMode::CDC;
+    bench("cdc", options, basisPath, editedPath, basis.size(), edited.size());
+    options.chunking = ChunkingMode::FIXED;
+    options.blockSize = 0;
+    bench("fixed (auto)", options, basisPath, editedPath, basis.size(), edited.size());
+    for (uint32_t blockSize : { 2048u, 8192u }) {
+        options.blockSize = blockSize;
+        char name[32];
+        std::snprintf(name, sizeof(name), "fixed %u", blockSize);
+        bench(name, options, basisPath, editedPath, basis.size(), edited.size());
+    }
+
+    unlink(basisPath.c_str());
+    unlink(editedPath.c_str());
+    return 0;
+}
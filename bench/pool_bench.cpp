@@ -0,0 +1,175 @@
+// task overhead of the shared work stealing pool against the pool it replaced: one queue behind
+// one mutex, tasks wrapped in a shared_ptr and a std::function, and a fresh 4 thread pool made
+// for every hashing or matching call. Reports ns per task for
+//   empty tasks submitted from outside and waited for,
+//   tasks that each submit and wait for subtasks (a worker's own tasks stay on its deque),
+//   small slices of real work (SHA-1 of 4 KB blocks), and
+//   a call the size of a small file: pool made, a few tasks run, pool gone (the old per call cost)
+//   pool_bench [tasks]
+#include "../common/thread_pool.hpp"
+#include "../common/hash_utils.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <queue>
+#include <vector>
+
+namespace {
+// the pool before the work stealing one, as it was
+class QueuePool {
+public:
+    explicit QueuePool(size_t threads) {
+        for (size_t i = 0; i < threads; ++i) {
+            workers_.emplace_back([this]() {
+                for (;;) {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex_);
+                        condition_.wait(lock, [this]() { return stop_ || !tasks_.empty(); });
+                        if (stop_ && tasks_.empty()) return;
+                        task = std::move(tasks_.front());
+                        tasks_.pop();
+                    }
+                    task();
+                }
+            });
+        }
+    }
+    ~QueuePool() {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        condition_.notify_all();
+        for (std::thread& worker : workers_) worker.join();
+    }
+
+    template <class F>
+    auto submit(F&& f) -> std::future<decltype(f())> {
+        using Return = decltype(f());
+        auto task = std::make_shared<std::packaged_task<Return()>>(std::forward<F>(f));
+        std::future<Return> result = task->get_future();
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            tasks_.emplace([task]() { (*task)(); });
+        }
+        condition_.notify_one();
+        return result;
+    }
+
+private:
+    std::vector<std::thread> workers_;
+    std::queue<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    bool stop_ = false;
+};
+
+template <class Step>
+double nanosecondsPer(size_t count, Step step) {
+    double best = 1e30;
+    for (int r = 0; r < 5; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        step();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best * 1e9 / count;
+}
+
+template <class Pool>
+double emptyTasks(Pool& pool, size_t count) {
+    return nanosecondsPer(count, [&]() {
+        std::vector<std::future<void>> futures;
+        futures.reserve(count);
+        for (size_t i = 0; i < count; ++i) futures.push_back(pool.submit([]() {}));
+        for (auto& future : futures) future.get();
+    });
+}
+
+// every outer task fans out into subtasks and waits for them. Neither pool runs other tasks while
+// one waits, so there are fewer outer tasks than workers, or they would wait forever
+template <class Pool>
+double nestedTasks(Pool& pool, size_t outer, size_t count) {
+    const size_t fan = count / outer;
+    return nanosecondsPer(outer * fan, [&]() {
+        std::vector<std::future<void>> futures;
+        for (size_t o = 0; o < outer; ++o) {
+            futures.push_back(pool.submit([&pool, fan]() {
+                std::vector<std::future<void>> inner;
+                inner.reserve(fan);
+                for (size_t i = 0; i < fan; ++i) inner.push_back(pool.submit([]() {}));
+                for (auto& future : inner) future.get();
+            }));
+        }
+        for (auto& future : futures) future.get();
+    });
+}
+
+template <class Pool>
+double hashSlices(Pool& pool, const std::vector<char>& data, size_t blocksPerSlice) {
+    const size_t BLOCK = 4096;
+    const size_t blocks = data.size() / BLOCK;
+    std::vector<StrongHash> out(blocks);
+    return nanosecondsPer(blocks / blocksPerSlice, [&]() {
+        std::vector<std::future<void>> futures;
+        for (size_t first = 0; first < blocks; first += blocksPerSlice) {
+            futures.push_back(pool.submit([&, first]() {
+                HashUtils::computeStrongHashes(StrongHashAlgorithm::SHA1, data.data() + first * BLOCK, BLOCK,
+                                               std::min(blocksPerSlice, blocks - first), &out[first]);
+            }));
+        }
+        for (auto& future : futures) future.get();
+    });
+}
+
+// the old code made a pool of 4 for every call, the shared pool is made once
+template <class MakePool>
+double callsWithTasks(size_t calls, size_t tasks, MakePool makePool) {
+    return nanosecondsPer(calls, [&]() {
+        for (size_t c = 0; c < calls; ++c) {
+            auto& pool = makePool();
+            std::vector<std::future<void>> futures;
+            for (size_t i = 0; i < tasks; ++i) futures.push_back(pool.submit([]() {}));
+            for (auto& future : futures) future.get();
+        }
+    });
+}
+}
+
+int main(int argc, char** argv) {
+    const size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200000;
+    ThreadPool& shared = ThreadPool::shared();
+    const size_t threads = shared.size();
+    QueuePool oldSized(threads);
+    QueuePool oldFour(4);
+    std::vector<char> data(64 << 20);
+    for (size_t i = 0; i < data.size(); ++i) data[i] = static_cast<char>(i * 2654435761u >> 13);
+
+    std::printf("%zu workers, ns per task (lower is better)\n", threads);
+    std::printf("%-34s %12s %12s %12s\n", "", "stealing", "queue", "queue of 4");
+    std::printf("%-34s %12.0f %12.0f %12.0f\n", "empty tasks", emptyTasks(shared, count), emptyTasks(oldSized, count),
+                emptyTasks(oldFour, count));
+    if (threads >= 2) {
+        const size_t outer = std::min<size_t>(threads, 4) - 1;
+        std::printf("%-34s %12.0f %12.0f %12.0f\n", "nested subtasks", nestedTasks(shared, outer, count),
+                    nestedTasks(oldSized, outer, count), nestedTasks(oldFour, outer, count));
+    } else {
+        std::printf("%-34s %12s\n", "nested subtasks", "needs 2 workers (FILESYNC_THREADS)");
+    }
+    for (size_t blocksPerSlice : { 1, 32 }) {
+        char name[64];
+        std::snprintf(name, sizeof(name), "sha-1 slices of %zu x 4 KB", blocksPerSlice);
+        std::printf("%-34s %12.0f %12.0f %12.0f\n", name, hashSlices(shared, data, blocksPerSlice),
+                    hashSlices(oldSized, data, blocksPerSlice), hashSlices(oldFour, data, blocksPerSlice));
+    }
+    std::unique_ptr<QueuePool> perCall;
+    double sharedCall = callsWithTasks(2000, 8, [&]() -> ThreadPool& { return shared; });
+    double oldCall = callsWithTasks(2000, 8, [&]() -> QueuePool& {
+        perCall.reset();
+        perCall = std::make_unique<QueuePool>(4);
+        return *perCall;
+    });
+    std::printf("%-34s %12.0f %12s %12.0f   (ns per call)\n", "call of 8 tasks, pool per call", sharedCall, "", oldCall);
+    return 0;
+}
@@ -0,0 +1,102 @@
+// scanning unmatched regions: the source file shares nothing with the basis, so every window
+// position is rolled and looked up. Reports GB/s of the rolling kernel alone and of a whole delta
+// generation (SourceManager::getDelta) of a random file against an unrelated signature.
+// FILESYNC_NO_AVX2=1 measures the scalar kernels, FILESYNC_THREADS the pool size of the scan.
+//   scan_bench [MB]
+#include "../common/rolling_hash.hpp"
+#include "../common/weak_hash.hpp"
+#include "../common/hash_utils.hpp"
+#include "../common/cpu_features.hpp"
+#include "../common/thread_pool.hpp"
+#include "../source/source_manager.hpp"
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace {
+std::vector<char> randomBytes(size_t size, uint64_t seed) {
+    std::mt19937_64 random(seed);
+    std::vector<char> data(size);
+    for (size_t i = 0; i + 8 <= size; i += 8) {
+        uint64_t word = random();
+        std::memcpy(&data[i], &word, 8);
+    }
+    return data;
+}
+
+template <class Step>
+double bestSeconds(int runs, Step step) {
+    double best = 1e30;
+    for (int r = 0; r < runs; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        step();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+// one thread, every window of the buffer
+void benchKernel(const std::vector<char>& data, size_t window) {
+    RollingHash roller(window);
+    size_t count = data.size() - window + 1;
+    std::vector<uint32_t> hashes(count);
+    double seconds = bestSeconds(5, [&]() { roller.hashWindows(data.data(), count, hashes.data()); });
+    std::printf("kernel,  window %6zu %9.2f GB/s\n", window, count / seconds / 1e9);
+}
+
+// signature of an unrelated file of the same size, then the delta of the source against it
+void benchDelta(const std::string& sourcePath, size_t size, size_t blockSize) {
+    std::vector<char> basis = randomBytes(size, 99);
+    Signature signature;
+    signature.header.blockSize = static_cast<uint32_t>(blockSize);
+    signature.header.fileSize = size;
+    signature.header.strongLength = HashUtils::strongHashLength(signature.header.strongHashAlgorithm, size, blockSize,
+                                                                WeakHash::matchBits(signature.header.weakHashAlgorithm));
+    size_t blockCount = size / blockSize;
+    std::vector<uint32_t> weak(blockCount);
+    WeakHash::computeBlocks(signature.header.weakHashAlgorithm, basis.data(), blockSize, blockCount, weak.data());
+    for (size_t i = 0; i < blockCount; ++i) {
+        StrongHash strong = HashUtils::computeStrongHash(signature.header.strongHashAlgorithm, &basis[i * blockSize], blockSize);
+        strong.truncate(signature.header.strongLength);
+        signature.blocks.emplace_back(i * blockSize, blockSize, weak[i], strong);
+    }
+
+    SourceManager source(sourcePath, signature);
+    size_t literal = 0;
+    double seconds = bestSeconds(3, [&]() {
+        auto delta = source.getDelta();
+        if (!delta.success) {
+            std::fprintf(stderr, "delta failed: %s\n", delta.message.c_str());
+            std::exit(1);
+        }
+        literal = 0;
+        for (const auto& instruction : delta.data) {
+            if (instruction.type == DeltaType::INSERT) literal += instruction.data.size();
+        }
+    });
+    std::printf("delta,   block  %6zu %9.2f GB/s  (%zu of %zu bytes literal, %zu threads)\n", blockSize,
+                size / seconds / 1e9, literal, size, ThreadPool::shared().size());
+}
+}
+
+int main(int argc, char** argv) {
+    const size_t size = (argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 256) << 20;
+    std::printf("%zu MB, %s kernels\n", size >> 20, CpuFeatures::avx2() ? "avx2" : "scalar");
+    std::vector<char> data = randomBytes(size, 1);
+    for (size_t window : { 512, 4096, 65536 }) benchKernel(data, window);
+
+    char path[] = "/tmp/scan_bench.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0 || write(fd, data.data(), data.size()) != static_cast<ssize_t>(data.size())) {
+        perror("source file");
+        return 1;
+    }
+    close(fd);
+    for (size_t blockSize : { 512, 4096, 65536 }) benchDelta(path, size, blockSize);
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,103 @@
+// the weak hash policies side by side: throughput of hashWindows, one thread, and the rate of
+// false candidates, windows of an unrelated file whose hash is the hash of some block of the
+// basis. Each is measured on random bytes, on text, and on blocks that all end in the same bytes
+// (where a hash that only sees the end of the window cannot tell blocks apart).
+//   weak_hash_bench [MB]
+#include "../common/weak_hash.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+const size_t BLOCK_SIZE = 1024;
+
+// random bytes, text, or random blocks whose second half is zeros
+enum class Data { RANDOM, TEXT, SAME_ENDS };
+
+std::vector<char> makeData(Data kind, size_t size, uint64_t seed) {
+    static const char* WORDS[] = {"the ", "block ", "of ", "a ", "file ", "sync ", "delta ", "hash ", "and ", "to ",
+                                  "is ", "window ", "copy\n", "in ", "data ", "source "};
+    std::mt19937_64 random(seed);
+    std::vector<char> data;
+    data.reserve(size + 16);
+    while (data.size() < size) {
+        if (kind == Data::TEXT) {
+            const char* word = WORDS[random() % 16];
+            data.insert(data.end(), word, word + std::char_traits<char>::length(word));
+        } else if (kind == Data::SAME_ENDS && data.size() % BLOCK_SIZE >= BLOCK_SIZE / 2) {
+            data.push_back(0);
+        } else {
+            data.push_back(static_cast<char>(random()));
+        }
+    }
+    data.resize(size);
+    return data;
+}
+
+const char* dataName(Data kind) {
+    return kind == Data::RANDOM ? "random" : kind == Data::TEXT ? "text" : "same ends";
+}
+
+template <class Policy>
+double gigabytesPerSecond(const std::vector<char>& data, size_t window) {
+    Policy policy(window);
+    size_t count = data.size() - window + 1;
+    std::vector<uint32_t> hashes(count);
+    double best = 1e30;
+    for (int r = 0; r < 3; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        policy.hashWindows(data.data(), count, hashes.data());
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return count / best / 1e9;
+}
+
+// windows of source whose hash is the hash of a block of basis, per window
+template <class Policy>
+double falseCandidateRate(const std::vector<char>& basis, const std::vector<char>& source) {
+    Policy policy(BLOCK_SIZE);
+    std::unordered_set<uint32_t> blocks;
+    for (size_t offset = 0; offset + BLOCK_SIZE <= basis.size(); offset += BLOCK_SIZE) {
+        blocks.insert(policy.hash(reinterpret_cast<const uint8_t*>(&basis[offset])));
+    }
+    size_t count = source.size() - BLOCK_SIZE + 1;
+    std::vector<uint32_t> hashes(count);
+    policy.hashWindows(source.data(), count, hashes.data());
+    size_t hits = 0;
+    for (uint32_t hash : hashes) hits += blocks.count(hash);
+    return static_cast<double>(hits) / count;
+}
+
+template <class Policy>
+void bench(const char* name, size_t size) {
+    std::vector<char> random = makeData(Data::RANDOM, size, 1);
+    std::printf("%-11s %7.2f %7.2f", name, gigabytesPerSecond<Policy>(random, 512), gigabytesPerSecond<Policy>(random, 4096));
+    // both files of the same kind but unrelated, any candidate is false
+    for (Data kind : { Data::RANDOM, Data::TEXT, Data::SAME_ENDS }) {
+        std::vector<char> basis = makeData(kind, size / 4, 2);
+        std::vector<char> source = makeData(kind, size / 4, 3);
+        std::printf(" %12.3g", falseCandidateRate<Policy>(basis, source));
+    }
+    std::printf("\n");
+}
+}
+
+int main(int argc, char** argv) {
+    const size_t size = (argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 64) << 20;
+    const double blocks = static_cast<double>(size / 4 / BLOCK_SIZE);
+    std::printf("%zu MB, false candidates per window of %zu byte blocks, a uniform 32 bit hash gets %.3g\n",
+                size >> 20, BLOCK_SIZE, blocks / 4294967296.0);
+    std::printf("%-11s %7s %7s", "", "GB/s", "GB/s");
+    for (Data kind : { Data::RANDOM, Data::TEXT, Data::SAME_ENDS }) std::printf(" %12s", dataName(kind));
+    std::printf("\n%-11s %7s %7s\n", "", "w512", "w4096");
+    bench<PolynomialHash>("polynomial", size);
+    bench<AdlerHash>("adler", size);
+    bench<BuzHash>("buzhash", size);
+    bench<GearHash>("gear", size);
+    return 0;
+}
@@ -0,0 +1,195 @@
+// wire i/o of a transfer over a loopback tcp connection: a signature of small records and a
+// stream of delta frames, with and without compressed literals. For each, the socket calls both
+// sides made (counted through the linker's --wrap), calls per MB on the wire and throughput.
+//   wire_bench [blocks]
+#include "../common/data_transfer.hpp"
+#include "../common/hash_utils.hpp"
+#include "../common/weak_hash.hpp"
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+std::atomic<uint64_t> socketCalls{0};
+std::atomic<uint64_t> wireBytes{0};
+}
+
+extern "C" {
+ssize_t __real_send(int fd, const void* buf, size_t len, int flags);
+ssize_t __real_sendmsg(int fd, const msghdr* msg, int flags);
+ssize_t __real_sendfile(int out, int in, off_t* offset, size_t count);
+ssize_t __real_recv(int fd, void* buf, size_t len, int flags);
+
+ssize_t __wrap_send(int fd, const void* buf, size_t len, int flags) {
+    socketCalls++;
+    ssize_t sent = __real_send(fd, buf, len, flags);
+    if (sent > 0) wireBytes += sent;
+    return sent;
+}
+ssize_t __wrap_sendmsg(int fd, const msghdr* msg, int flags) {
+    socketCalls++;
+    ssize_t sent = __real_sendmsg(fd, msg, flags);
+    if (sent > 0) wireBytes += sent;
+    return sent;
+}
+ssize_t __wrap_sendfile(int out, int in, off_t* offset, size_t count) {
+    socketCalls++;
+    ssize_t sent = __real_sendfile(out, in, offset, count);
+    if (sent > 0) wireBytes += sent;
+    return sent;
+}
+ssize_t __wrap_recv(int fd, void* buf, size_t len, int flags) {
+    socketCalls++;
+    return __real_recv(fd, buf, len, flags);
+}
+}
+
+namespace {
+// both ends of a tcp connection over 127.0.0.1
+bool connectLoopback(int& sender, int& receiver) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrLen = sizeof(addr);
+    if (listener < 0 || bind(listener, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listener, 1) < 0 ||
+        getsockname(listener, (sockaddr*)&addr, &addrLen) < 0) {
+        perror("listen");
+        return false;
+    }
+    sender = socket(AF_INET, SOCK_STREAM, 0);
+    if (sender < 0 || connect(sender, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        return false;
+    }
+    receiver = accept(listener, nullptr, nullptr);
+    close(listener);
+    return receiver >= 0;
+}
+
+struct Scenario {
+    const char* name;
+    bool compressed;
+    std::function<bool(DataTransfer&, int)> send;
+    std::function<bool(DataTransfer&, int)> receive;
+};
+
+// best of runs, the counters are the same every run
+void run(const Scenario& scenario, int runs) {
+    double best = 1e30;
+    uint64_t calls = 0, bytes = 0;
+    for (int r = 0; r < runs; ++r) {
+        int sender, receiver;
+        if (!connectLoopback(sender, receiver)) std::exit(1);
+        TransferOptions options;
+        options.features = scenario.compressed ? uint32_t(COMPRESSED_LITERALS) : uint32_t(0);
+        DataTransfer out, in;
+        out.useTransferOptions(options);
+        in.useTransferOptions(options);
+
+        socketCalls = 0;
+        wireBytes = 0;
+        bool received = false;
+        auto start = std::chrono::steady_clock::now();
+        std::thread receiving([&]() { received = scenario.receive(in, receiver); });
+        bool sent = scenario.send(out, sender);
+        receiving.join();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        close(sender);
+        close(receiver);
+        if (!sent || !received) {
+            std::fprintf(stderr, "%s: transfer failed\n", scenario.name);
+            std::exit(1);
+        }
+        best = std::min(best, seconds);
+        calls = socketCalls;
+        bytes = wireBytes;
+    }
+    double mb = bytes / 1e6;
+    std::printf("%-22s %9.2f MB %9llu calls %9.1f calls/MB %9.1f MB/s %8.2f ms\n", scenario.name, mb,
+                static_cast<unsigned long long>(calls), calls / mb, mb / best, best * 1e3);
+}
+}
+
+int main(int argc, char** argv) {
+    const size_t BLOCK_SIZE = 512;
+    const size_t blockCount = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 81920;
+    std::mt19937_64 random(42);
+
+    Signature signature;
+    signature.header.blockSize = BLOCK_SIZE;
+    signature.header.fileSize = blockCount * BLOCK_SIZE;
+    signature.header.strongLength = HashUtils::strongHashLength(signature.header.strongHashAlgorithm,
+                                                                signature.header.fileSize, BLOCK_SIZE,
+                                                                WeakHash::matchBits(signature.header.weakHashAlgorithm));
+    signature.blocks.resize(blockCount);
+    for (size_t i = 0; i < blockCount; ++i) {
+        BlockInfo& block = signature.blocks[i];
+        block.offset = i * BLOCK_SIZE;
+        block.length = BLOCK_SIZE;
+        block.weakHash = static_cast<uint32_t>(random());
+        block.strongHash.length = HashUtils::digestLength(signature.header.strongHashAlgorithm);
+        for (size_t b = 0; b < block.strongHash.length; ++b) block.strongHash.bytes[b] = static_cast<uint8_t>(random());
+    }
+
+    // a copy of a few blocks and a literal in turn, 256 instructions a frame; literals are
+    // text-like so that compression has something to do
+    static const char* WORDS[] = {"block ", "delta ", "hash ", "file ", "sync ", "frame ", "copy ", "insert "};
+    const size_t FRAME = 256;
+    std::vector<std::vector<DeltaInstruction>> frames(1);
+    uint64_t offset = 0;
+    for (size_t i = 0; i < blockCount / 16; ++i) {
+        if (frames.back().size() == FRAME) frames.emplace_back();
+        if (i % 2 == 0) {
+            size_t length = BLOCK_SIZE * (1 + random() % 16);
+            frames.back().push_back(DeltaInstruction::makeCopyRange(offset, length));
+            offset += length + BLOCK_SIZE;
+        } else {
+            std::string text;
+            size_t length = 64 + random() % 4000;
+            while (text.size() < length) text += WORDS[random() % 8];
+            frames.back().push_back(DeltaInstruction::makeInsert(text.data(), text.size()));
+        }
+    }
+    size_t instructions = 0;
+    for (const auto& frame : frames) instructions += frame.size();
+
+    auto sendSignature = [&](DataTransfer& pipe, int fd) { return pipe.serializeAndSendBlockHashes(fd, signature); };
+    auto receiveSignature = [&](DataTransfer& pipe, int fd) {
+        Signature received;
+        return pipe.receiveBlockHashes(fd, received) && received.blocks.size() == blockCount;
+    };
+    auto sendDelta = [&](DataTransfer& pipe, int fd) {
+        for (const auto& frame : frames) {
+            if (!pipe.sendDeltaFrame(fd, frame)) return false;
+        }
+        return pipe.endDeltaStream(fd);
+    };
+    auto receiveDelta = [&](DataTransfer& pipe, int fd) {
+        size_t got = 0;
+        bool ok = pipe.receiveDelta(fd, [&](std::vector<DeltaInstruction>&& frame) {
+            got += frame.size();
+            return true;
+        });
+        return ok && got == instructions;
+    };
+
+    std::printf("%zu signature records of %u bytes, %zu delta instructions in %zu frames\n", blockCount,
+                4 + signature.header.strongLength, instructions, frames.size());
+    const int RUNS = 5;
+    run({ "signature", false, sendSignature, receiveSignature }, RUNS);
+    run({ "delta, uncompressed", false, sendDelta, receiveDelta }, RUNS);
+    run({ "delta, compressed", true, sendDelta, receiveDelta }, RUNS);
+    return 0;
+}
@@ -0,0 +1,309 @@
+#include "blake3.hpp"
+#include "cpu_features.hpp"
+#include <array>
+#include <algorithm>
+#include <cstring>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "BLAKE3 words are read little endian");
+
+namespace {
+constexpr uint32_t IV[8] = {0x6A09E667u, 0xBB67AE85u, 0x3C6EF372u, 0xA54FF53Au,
+                            0x510E527Fu, 0x9B05688Cu, 0x1F83D9ABu, 0x5BE0CD19u};
+constexpr size_t BLOCK_LENGTH = 64;
+constexpr size_t CHUNK_LENGTH = 1024;
+constexpr size_t ROUNDS = 7;
+constexpr size_t MAX_DEPTH = 54;   // 2^54 chunks, more than any size_t input
+
+enum Flags : uint32_t {
+    CHUNK_START = 1u << 0,
+    CHUNK_END = 1u << 1,
+    PARENT = 1u << 2,
+    ROOT = 1u << 3,
+};
+
+// message word order of every round, the permutation applied once more per round
+constexpr std::array<std::array<uint8_t, 16>, ROUNDS> makeSchedule() {
+    constexpr uint8_t PERMUTATION[16] = {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8};
+    std::array<std::array<uint8_t, 16>, ROUNDS> schedule{};
+    for (uint8_t i = 0; i < 16; ++i) schedule[0][i] = i;
+    for (size_t r = 1; r < ROUNDS; ++r) {
+        for (size_t i = 0; i < 16; ++i) schedule[r][i] = schedule[r - 1][PERMUTATION[i]];
+    }
+    return schedule;
+}
+constexpr std::array<std::array<uint8_t, 16>, ROUNDS> SCHEDULE = makeSchedule();
+
+size_t chunkCount(size_t len) {
+    return len == 0 ? 1 : (len + CHUNK_LENGTH - 1) / CHUNK_LENGTH;
+}
+
+// ---- one input at a time
+
+uint32_t rotr(uint32_t v, unsigned r) {
+    return (v >> r) | (v << (32 - r));
+}
+
+__attribute__((always_inline)) inline void mix(uint32_t* v, int a, int b, int c, int d, uint32_t x, uint32_t y) {
+    v[a] = v[a] + v[b] + x;
+    v[d] = rotr(v[d] ^ v[a], 16);
+    v[c] = v[c] + v[d];
+    v[b] = rotr(v[b] ^ v[c], 12);
+    v[a] = v[a] + v[b] + y;
+    v[d] = rotr(v[d] ^ v[a], 8);
+    v[c] = v[c] + v[d];
+    v[b] = rotr(v[b] ^ v[c], 7);
+}
+
+// cv = first half of the compression output
+void compress(uint32_t* cv, const uint8_t* block, uint64_t counter, uint32_t blockLength, uint32_t flags) {
+    uint32_t m[16];
+    std::memcpy(m, block, sizeof(m));
+    uint32_t v[16] = {cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+                      IV[0], IV[1], IV[2], IV[3], static_cast<uint32_t>(counter), static_cast<uint32_t>(counter >> 32),
+                      blockLength, flags};
+#pragma GCC unroll 7
+    for (size_t r = 0; r < ROUNDS; ++r) {
+        const std::array<uint8_t, 16>& s = SCHEDULE[r];
+        mix(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+        mix(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+        mix(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+        mix(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+        mix(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+        mix(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+        mix(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+        mix(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+    }
+    for (int i = 0; i < 8; ++i) cv[i] = v[i] ^ v[i + 8];
+}
+
+void chunkCv(const uint8_t* data, size_t len, uint64_t counter, uint32_t extraFlags, uint32_t* cv) {
+    std::memcpy(cv, IV, sizeof(IV));
+    size_t blocks = std::max<size_t>(1, (len + BLOCK_LENGTH - 1) / BLOCK_LENGTH);
+    for (size_t k = 0; k < blocks; ++k) {
+        size_t blockLength = std::min(BLOCK_LENGTH, len - k * BLOCK_LENGTH);
+        uint32_t flags = (k == 0 ? static_cast<uint32_t>(CHUNK_START) : 0u) | (k + 1 == blocks ? CHUNK_END | extraFlags : 0u);
+        if (blockLength == BLOCK_LENGTH) {
+            compress(cv, data + k * BLOCK_LENGTH, counter, BLOCK_LENGTH, flags);
+        } else {
+            uint8_t padded[BLOCK_LENGTH] = {};
+            if (blockLength > 0) std::memcpy(padded, data + k * BLOCK_LENGTH, blockLength);
+            compress(cv, padded, counter, static_cast<uint32_t>(blockLength), flags);
+        }
+    }
+}
+
+void parentCv(const uint32_t* left, const uint32_t* right, uint32_t extraFlags, uint32_t* cv) {
+    uint8_t block[BLOCK_LENGTH];
+    std::memcpy(block, left, 32);
+    std::memcpy(block + 32, right, 32);
+    std::memcpy(cv, IV, sizeof(IV));
+    compress(cv, block, 0, BLOCK_LENGTH, PARENT | extraFlags);
+}
+
+#if defined(__x86_64__)
+// ---- eight equal sized inputs, word w of every input in one register
+
+__attribute__((target("avx2")))
+inline __m256i rotr16(__m256i v) {
+    const __m256i shuffle = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                             2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    return _mm256_shuffle_epi8(v, shuffle);
+}
+
+__attribute__((target("avx2")))
+inline __m256i rotr8(__m256i v) {
+    const __m256i shuffle = _mm256_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12,
+                                             1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
+    return _mm256_shuffle_epi8(v, shuffle);
+}
+
+template <int R>
+__attribute__((target("avx2")))
+inline __m256i rotr(__m256i v) {
+    return _mm256_or_si256(_mm256_srli_epi32(v, R), _mm256_slli_epi32(v, 32 - R));
+}
+
+__attribute__((target("avx2")))
+inline void mix8(__m256i* v, int a, int b, int c, int d, __m256i x, __m256i y) {
+    v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), x);
+    v[d] = rotr16(_mm256_xor_si256(v[d], v[a]));
+    v[c] = _mm256_add_epi32(v[c], v[d]);
+    v[b] = rotr<12>(_mm256_xor_si256(v[b], v[c]));
+    v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), y);
+    v[d] = rotr8(_mm256_xor_si256(v[d], v[a]));
+    v[c] = _mm256_add_epi32(v[c], v[d]);
+    v[b] = rotr<7>(_mm256_xor_si256(v[b], v[c]));
+}
+
+// all lanes share counter, block length and flags
+__attribute__((target("avx2")))
+inline void compress8(__m256i* cv, const __m256i* m, uint64_t counter, uint32_t blockLength, uint32_t flags) {
+    __m256i v[16];
+#pragma GCC unroll 8
+    for (int i = 0; i < 8; ++i) v[i] = cv[i];
+#pragma GCC unroll 4
+    for (int i = 0; i < 4; ++i) v[8 + i] = _mm256_set1_epi32(static_cast<int>(IV[i]));
+    v[12] = _mm256_set1_epi32(static_cast<int>(static_cast<uint32_t>(counter)));
+    v[13] = _mm256_set1_epi32(static_cast<int>(static_cast<uint32_t>(counter >> 32)));
+    v[14] = _mm256_set1_epi32(static_cast<int>(blockLength));
+    v[15] = _mm256_set1_epi32(static_cast<int>(flags));
+#pragma GCC unroll 7
+    for (size_t r = 0; r < ROUNDS; ++r) {
+        const std::array<uint8_t, 16>& s = SCHEDULE[r];
+        mix8(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+        mix8(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+        mix8(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+        mix8(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+        mix8(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+        mix8(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+        mix8(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+        mix8(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+    }
+#pragma GCC unroll 8
+    for (int i = 0; i < 8; ++i) cv[i] = _mm256_xor_si256(v[i], v[i + 8]);
+}
+
+// rows[l] holds eight words of lane l, afterwards rows[w] holds word w of every lane (and back)
+__attribute__((target("avx2")))
+inline void transpose8(__m256i* rows) {
+    __m256i t[8], u[8];
+#pragma GCC unroll 4
+    for (int i = 0; i < 4; ++i) {
+        t[2 * i] = _mm256_unpacklo_epi32(rows[2 * i], rows[2 * i + 1]);
+        t[2 * i + 1] = _mm256_unpackhi_epi32(rows[2 * i], rows[2 * i + 1]);
+    }
+#pragma GCC unroll 2
+    for (int i = 0; i < 2; ++i) {
+        u[4 * i] = _mm256_unpacklo_epi64(t[4 * i], t[4 * i + 2]);
+        u[4 * i + 1] = _mm256_unpackhi_epi64(t[4 * i], t[4 * i + 2]);
+        u[4 * i + 2] = _mm256_unpacklo_epi64(t[4 * i + 1], t[4 * i + 3]);
+        u[4 * i + 3] = _mm256_unpackhi_epi64(t[4 * i + 1], t[4 * i + 3]);
+    }
+#pragma GCC unroll 4
+    for (int i = 0; i < 4; ++i) {
+        rows[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+        rows[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+    }
+}
+
+// 64 byte block of every lane, a short last block is zero padded
+__attribute__((target("avx2")))
+inline void loadMessage(const uint8_t* const* lanes, size_t offset, size_t blockLength, __m256i* m) {
+    alignas(32) uint8_t padded[8][BLOCK_LENGTH];
+    const uint8_t* blocks[8];
+    for (int l = 0; l < 8; ++l) {
+        blocks[l] = lanes[l] + offset;
+        if (blockLength < BLOCK_LENGTH) {
+            std::memset(padded[l], 0, BLOCK_LENGTH);
+            std::memcpy(padded[l], blocks[l], blockLength);
+            blocks[l] = padded[l];
+        }
+    }
+#pragma GCC unroll 2
+    for (int half = 0; half < 2; ++half) {
+#pragma GCC unroll 8
+        for (int l = 0; l < 8; ++l) {
+            m[8 * half + l] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(blocks[l] + 32 * half));
+        }
+        transpose8(m + 8 * half);
+    }
+}
+
+__attribute__((target("avx2")))
+inline void parent8(const __m256i* left, const __m256i* right, uint32_t extraFlags, __m256i* cv) {
+    __m256i m[16];
+#pragma GCC unroll 8
+    for (int i = 0; i < 8; ++i) {
+        m[i] = left[i];
+        m[8 + i] = right[i];
+        cv[i] = _mm256_set1_epi32(static_cast<int>(IV[i]));
+    }
+    compress8(cv, m, 0, BLOCK_LENGTH, PARENT | extraFlags);
+}
+
+// eight inputs of len bytes each. Chunks run through all lanes at once and chaining values are
+// merged on a stack as they complete (the reference incremental tree), so the tree costs no
+// more memory than its depth
+__attribute__((target("avx2")))
+void hashEightAvx2(const uint8_t* const* lanes, size_t len, uint8_t (*out)[Blake3::DIGEST_LENGTH]) {
+    const size_t chunks = chunkCount(len);
+    __m256i stack[MAX_DEPTH][8];
+    size_t depth = 0;
+    __m256i cv[8], m[16];
+
+    for (size_t j = 0; j < chunks; ++j) {
+        const size_t chunkStart = j * CHUNK_LENGTH;
+        const size_t chunkLength = std::min(CHUNK_LENGTH, len - chunkStart);
+        const size_t blocks = std::max<size_t>(1, (chunkLength + BLOCK_LENGTH - 1) / BLOCK_LENGTH);
+        for (int i = 0; i < 8; ++i) cv[i] = _mm256_set1_epi32(static_cast<int>(IV[i]));
+        for (size_t k = 0; k < blocks; ++k) {
+            const size_t blockLength = std::min(BLOCK_LENGTH, chunkLength - k * BLOCK_LENGTH);
+            uint32_t flags = (k == 0 ? static_cast<uint32_t>(CHUNK_START) : 0u) | (k + 1 == blocks ? static_cast<uint32_t>(CHUNK_END) : 0u);
+            if (k + 1 == blocks && chunks == 1) flags |= ROOT;
+            loadMessage(lanes, chunkStart + k * BLOCK_LENGTH, blockLength, m);
+            compress8(cv, m, j, static_cast<uint32_t>(blockLength), flags);
+        }
+        if (j + 1 == chunks) break;
+        // a completed subtree is merged as soon as its sibling is complete
+        for (size_t total = j + 1; (total & 1) == 0; total >>= 1) {
+            --depth;
+            parent8(stack[depth], cv, 0, cv);
+        }
+        std::memcpy(stack[depth++], cv, sizeof(cv));
+    }
+    while (depth > 0) {
+        --depth;
+        parent8(stack[depth], cv, depth == 0 ? static_cast<uint32_t>(ROOT) : 0u, cv);
+    }
+
+    transpose8(cv);
+    for (int l = 0; l < 8; ++l) _mm256_storeu_si256(reinterpret_cast<__m256i*>(out[l]), cv[l]);
+}
+#else
+void hashEightAvx2(const uint8_t* const* lanes, size_t len, uint8_t (*out)[Blake3::DIGEST_LENGTH]) {
+    for (int l = 0; l < 8; ++l) Blake3::hash(lanes[l], len, out[l]);
+}
+#endif
+}
+
+namespace Blake3 {
+void hash(const void* data, size_t len, uint8_t out[DIGEST_LENGTH]) {
+    const uint8_t* input = static_cast<const uint8_t*>(data);
+    const size_t chunks = chunkCount(len);
+    uint32_t stack[MAX_DEPTH][8];
+    size_t depth = 0;
+    uint32_t cv[8];
+
+    for (size_t j = 0; j < chunks; ++j) {
+        const size_t chunkStart = j * CHUNK_LENGTH;
+        chunkCv(input + chunkStart, std::min(CHUNK_LENGTH, len - chunkStart), j, chunks == 1 ? static_cast<uint32_t>(ROOT) : 0u, cv);
+        if (j + 1 == chunks) break;
+        for (size_t total = j + 1; (total & 1) == 0; total >>= 1) {
+            --depth;
+            parentCv(stack[depth], cv, 0, cv);
+        }
+        std::memcpy(stack[depth++], cv, sizeof(cv));
+    }
+    while (depth > 0) {
+        --depth;
+        parentCv(stack[depth], cv, depth == 0 ? static_cast<uint32_t>(ROOT) : 0u, cv);
+    }
+    std::memcpy(out, cv, DIGEST_LENGTH);
+}
+
+void hashBlocks(const void* data, size_t blockSize, size_t count, uint8_t (*out)[DIGEST_LENGTH]) {
+    const uint8_t* input = static_cast<const uint8_t*>(data);
+    size_t i = 0;
+    if (CpuFeatures::avx2()) {
+        for (; i + 8 <= count; i += 8) {
+            const uint8_t* lanes[8];
+            for (int l = 0; l < 8; ++l) lanes[l] = input + (i + l) * blockSize;
+            hashEightAvx2(lanes, blockSize, out + i);
+        }
+    }
+    for (; i < count; ++i) hash(input + i * blockSize, blockSize, out[i]);
+}
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// BLAKE3 (default hash mode, 32 byte output), the fast cryptographic strong hash.
+// Inputs are cut in 1 KB chunks of sixteen 64 byte blocks and the chunk chaining values are
+// merged in a binary tree. Equal sized inputs share that shape, so hashBlocks runs eight of them
+// side by side in AVX2 registers (one input per 32 bit lane) when the cpu has it
+namespace Blake3 {
+constexpr size_t DIGEST_LENGTH = 32;
+
+void hash(const void* data, size_t len, uint8_t out[DIGEST_LENGTH]);
+
+// out[i] = hash of data[i*blockSize, (i+1)*blockSize) for i < count
+void hashBlocks(const void* data, size_t blockSize, size_t count, uint8_t (*out)[DIGEST_LENGTH]);
+}
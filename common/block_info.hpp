@@ -1,12 +1,47 @@
 #pragma once
 #include <string>
 #include <cstdint>
+#include <cstring>
+#include <functional>
+
+// raw strong hash digest, no hex encoding so it never needs a heap allocation
+struct StrongHash {
+    static constexpr size_t MAX_LENGTH = 32;   // longest digest (BLAKE3)
+    unsigned char bytes[MAX_LENGTH] = {};
+    uint8_t length = 0;
+
+    bool operator==(const StrongHash& other) const {
+        return length == other.length && std::memcmp(bytes, other.bytes, length) == 0;
+    }
+    bool operator!=(const StrongHash& other) const { return !(*this == other); }
+
+    // keeps the first len bytes, the rest is zeroed so hashing the prefix stays consistent
+    void truncate(uint8_t len) {
+        if (len >= length) return;
+        std::memset(bytes + len, 0, MAX_LENGTH - len);
+        length = len;
+    }
+};
+
+// digest bytes are already uniformly distributed, the first few are a good hash
+namespace std {
+template<>
+struct hash<StrongHash> {
+    size_t operator()(const StrongHash& h) const {
+        size_t value = 0;
+        std::memcpy(&value, h.bytes, sizeof(value));
+        return value;
+    }
+};
+}
 
 struct BlockInfo {
-    size_t offset;              // Offset in destination file
-    uint32_t weakHash;          // Rolling hash
-    std::string strongHash;     // SHA-1 or MD5
+    size_t offset = 0;          // Offset in destination file
+    size_t length = 0;          // bytes in the block, only varies with content defined chunking
+    uint32_t weakHash = 0;      // Rolling hash
+    StrongHash strongHash;      // digest of the transfer's strong hash
 
-    BlockInfo(size_t o, uint32_t w, const std::string& s)
-        : offset(o), weakHash(w), strongHash(s) {}
+    BlockInfo() = default;
+    BlockInfo(size_t o, size_t l, uint32_t w, const StrongHash& s)
+        : offset(o), length(l), weakHash(w), strongHash(s) {}
 };
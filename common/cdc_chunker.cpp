@@ -0,0 +1,105 @@
+#include "cdc_chunker.hpp"
+#include "thread_pool.hpp"
+#include "config.hpp"
+#include "weak_hash.hpp"
+#include <array>
+#include <algorithm>
+
+namespace {
+    // gear table, fixed so both peers cut identically
+    constexpr std::array<uint64_t, 256> GEAR = makeByteTable(0x2545F4914F6CDD1Dull);
+
+    // the top bits of the gear hash depend on the most bytes, so masks select from the top
+    uint64_t topBitsMask(unsigned bits) {
+        if (bits == 0) return 0;
+        if (bits >= 64) return ~0ull;
+        return ((1ull << bits) - 1) << (64 - bits);
+    }
+
+    unsigned log2Floor(uint32_t value) {
+        unsigned bits = 0;
+        while (value > 1) {
+            value >>= 1;
+            bits++;
+        }
+        return bits;
+    }
+}
+
+CdcChunker::CdcChunker(uint32_t minSize, uint32_t avgSize, uint32_t maxSize)
+    : minSize_(minSize), avgSize_(avgSize), maxSize_(maxSize) {
+    unsigned bits = log2Floor(avgSize_);
+    maskS_ = topBitsMask(bits + 1);
+    maskL_ = topBitsMask(bits > 1 ? bits - 1 : 1);
+}
+
+size_t CdcChunker::nextChunkLength(const char* data, size_t len) const {
+    if (len <= minSize_) return len;
+    size_t end = std::min<size_t>(len, maxSize_);
+    size_t normal = std::min<size_t>(end, avgSize_);
+
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+    uint64_t hash = 0;
+    size_t i = minSize_;
+    for (; i < normal; ++i) {
+        hash = (hash << 1) + GEAR[bytes[i]];
+        if (!(hash & maskS_)) return i + 1;
+    }
+    for (; i < end; ++i) {
+        hash = (hash << 1) + GEAR[bytes[i]];
+        if (!(hash & maskL_)) return i + 1;
+    }
+    return end;
+}
+
+// chunks starting at start until one ends at or past limit
+std::vector<uint64_t> CdcChunker::chunkSegment(const char* data, size_t size, size_t start, size_t limit) const {
+    std::vector<uint64_t> ends;
+    size_t pos = start;
+    while (pos < limit) {
+        pos += nextChunkLength(data + pos, size - pos);
+        ends.push_back(pos);
+    }
+    return ends;
+}
+
+std::vector<uint64_t> CdcChunker::chunkEnds(const char* data, size_t size, ThreadPool& pool) const {
+    const size_t segmentSize = std::max<size_t>(Config::CHUNK_SIZE, static_cast<size_t>(maxSize_) * 16);
+
+    std::vector<std::future<std::vector<uint64_t>>> futures;
+    WaitForAll<std::vector<std::future<std::vector<uint64_t>>>> waitFutures(futures);
+    for (size_t start = 0; start < size; start += segmentSize) {
+        size_t limit = std::min(start + segmentSize, size);
+        futures.emplace_back(pool.submit([=]() {
+            return this->chunkSegment(data, size, start, limit);
+        }));
+    }
+
+    // a segment was cut as if a chunk started at its first byte, which is usually not true
+    // so it is re-chunked from where the previous segment really stopped until the two
+    // agree on a cut, from then on they are identical
+    std::vector<uint64_t> ends;
+    size_t pos = 0;
+    for (size_t seg = 0; seg < futures.size(); ++seg) {
+        std::vector<uint64_t> segmentEnds = futures[seg].get();
+        size_t segmentStart = seg * segmentSize;
+        size_t j = 0;
+        bool converged = (pos == segmentStart);
+        while (!converged) {
+            while (j < segmentEnds.size() && segmentEnds[j] < pos) j++;
+            if (j == segmentEnds.size()) break;   // previous segment ran past this one
+            if (segmentEnds[j] == pos) {
+                j++;
+                converged = true;
+                break;
+            }
+            pos += nextChunkLength(data + pos, size - pos);
+            ends.push_back(pos);
+        }
+        if (converged) {
+            ends.insert(ends.end(), segmentEnds.begin() + j, segmentEnds.end());
+            if (!ends.empty()) pos = ends.back();
+        }
+    }
+    return ends;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+class ThreadPool;
+
+// FastCDC style content defined chunking with a gear rolling hash
+// a cut depends only on the bytes since the previous cut, so equal content is cut the same way
+// wherever it sits in the file. Normalized chunking keeps sizes close to the average:
+// a harder mask is used before the average size and an easier one after it.
+class CdcChunker {
+public:
+    CdcChunker(uint32_t minSize, uint32_t avgSize, uint32_t maxSize);
+
+    // length of the chunk starting at data, len is the number of bytes left in the file
+    size_t nextChunkLength(const char* data, size_t len) const;
+
+    // end offsets of all chunks of data, the last one is size
+    // segments are chunked in parallel and stitched so the result equals a single sequential pass
+    std::vector<uint64_t> chunkEnds(const char* data, size_t size, ThreadPool& pool) const;
+
+private:
+    std::vector<uint64_t> chunkSegment(const char* data, size_t size, size_t start, size_t limit) const;
+
+    uint32_t minSize_;
+    uint32_t avgSize_;
+    uint32_t maxSize_;
+    uint64_t maskS_;
+    uint64_t maskL_;
+};
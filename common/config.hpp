@@ -1,7 +1,19 @@
 // config.hpp
 #pragma once
+#include <cstddef>
 
 namespace Config {
-    inline constexpr int BLOCK_SIZE = 128;     // block size 128 kb
-    inline constexpr int CHUNK_SIZE=128*1024;  // processing 128 mb chunks for parallel processing
+    // block size is picked per transfer from the basis file size (about sqrt(size)), within these bounds
+    inline constexpr size_t MIN_BLOCK_SIZE = 512;         // 512 bytes
+    inline constexpr size_t MAX_BLOCK_SIZE = 128*1024;    // 128 kb
+    inline constexpr size_t BLOCK_SIZE_ALIGN = 8;         // chosen sizes are a multiple of this
+
+    inline constexpr int CHUNK_SIZE=128*1024;  // processing 128 kb chunks for parallel processing
+    inline constexpr size_t MIN_BLOCKS_PER_CHUNK=64;  // chunks grow with the block size so stitching stays rare
+    inline constexpr size_t MAX_PENDING_CHUNKS=16;  // chunk results waiting to be streamed out in order
+
+    // content defined chunking, average is a power of two
+    inline constexpr int CDC_MIN_CHUNK_SIZE=2*1024;
+    inline constexpr int CDC_AVG_CHUNK_SIZE=8*1024;
+    inline constexpr int CDC_MAX_CHUNK_SIZE=64*1024;
 }
@@ -0,0 +1,15 @@
+#pragma once
+#include <cstdlib>
+
+// instruction set extensions of the running cpu, kernels built for them are picked at runtime.
+// FILESYNC_NO_AVX2 set in the environment runs the portable kernels, the tests check both
+namespace CpuFeatures {
+    inline bool avx2() {
+#if defined(__x86_64__)
+        static const bool supported = __builtin_cpu_supports("avx2") && !std::getenv("FILESYNC_NO_AVX2");
+        return supported;
+#else
+        return false;
+#endif
+    }
+}
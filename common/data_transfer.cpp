@@ -3,147 +3,602 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include<iostream>
+#include<cstring>
+#include "config.hpp"
+#include "varint.hpp"
+#include "literal_codec.hpp"
+#include<chrono>
+#include<algorithm>
 
+DataTransfer::DataTransfer() = default;
+DataTransfer::~DataTransfer() = default;
 
+
+// everything goes through the connection's buffers: sends are collected and only leave at the
+// end of a message (or when the buffer is full), receives are served from slabs of recv()
 bool DataTransfer::sendAll(int socket, const void* buffer, size_t length) {
-    const char* data = static_cast<const char*>(buffer);
-    while (length > 0) {
-        ssize_t sent = send(socket, data, length, 0);
-        if (sent <= 0) return false;
-        data += sent;
-        length -= sent;
-    }
-    return true;
+    writer_.put(buffer, length);
+    return writer_.flushIfFull(socket);
+}
+
+// signature is [chunking][blockSize][minChunkSize][maxChunkSize][fileSize][weakAlgorithm][strongAlgorithm]
+// [strongLength][count]
+// followed by count fixed width records. Offsets are implicit, blocks follow each other:
+//   FIXED  [weakHash][strongHash]   every block is blockSize long, the last one ends at fileSize
+//   CDC    [length][strongHash]     chunks are looked up by strong hash alone
+// strong hashes are truncated to strongLength, which the destination picks from file and block size
+bool DataTransfer::serializeAndSendBlockHashes(const int socket,const Signature& signature){
+    return sendSignatureHeader(socket, signature.header, signature.blocks.size()) &&
+           sendSignatureBlocks(socket, signature.blocks.data(), signature.blocks.size());
 }
 
-bool DataTransfer::serializeAndSendBlockHashes(const int socket,const std::vector<BlockInfo>& blockHashes){
-    uint32_t count = htonl(blockHashes.size());
-    if (!sendAll(socket, &count, sizeof(count))) return false;
+SignatureSink DataTransfer::signatureSender(int socket) {
+    return {
+        [this, socket](const SignatureHeader& header, size_t blockCount) { return sendSignatureHeader(socket, header, blockCount); },
+        [this, socket](const BlockInfo* blocks, size_t count) { return sendSignatureBlocks(socket, blocks, count); }
+    };
+}
 
-    for (const BlockInfo& b : blockHashes) {
-        uint64_t offset_net = htobe64(b.offset);
-        uint32_t weakHash_net = htonl(b.weakHash);
-        uint32_t strongLen = htonl(static_cast<uint32_t>(b.strongHash.size()));
+bool DataTransfer::sendSignatureHeader(int socket, const SignatureHeader& header, size_t blockCount) {
+    if (blockCount > UINT32_MAX) {
+        std::cerr << "[serializeAndSendBlockHashes] Too many blocks\n";
+        return false;
+    }
+    writer_.putU8(static_cast<uint8_t>(header.chunking));
+    writer_.putU32(header.blockSize);
+    writer_.putU32(header.minChunkSize);
+    writer_.putU32(header.maxChunkSize);
+    writer_.putU64(header.fileSize);
+    writer_.putU8(static_cast<uint8_t>(header.weakHashAlgorithm));
+    writer_.putU8(static_cast<uint8_t>(header.strongHashAlgorithm));
+    writer_.putU8(header.strongLength);
+    writer_.putU32(blockCount);
+    sendingSignature_ = header;
+    signatureBlocksLeft_ = blockCount;
+    return writer_.flush(socket, blockCount > 0);
+}
 
-        if (!sendAll(socket, &offset_net, sizeof(offset_net)) ||
-            !sendAll(socket, &weakHash_net, sizeof(weakHash_net)) ||
-            !sendAll(socket, &strongLen, sizeof(strongLen)) ||
-            !sendAll(socket, b.strongHash.data(), b.strongHash.size())) {
+// records are encoded straight into the buffer, every batch leaves right away
+// (marked as more to come until the last one, so small batches still fill whole segments)
+bool DataTransfer::sendSignatureBlocks(int socket, const BlockInfo* blocks, size_t count) {
+    const SignatureHeader& header = sendingSignature_;
+    if (count > signatureBlocksLeft_) {
+        std::cerr << "[serializeAndSendBlockHashes] More blocks than the signature header says\n";
+        return false;
+    }
+    const bool cdc = header.chunking == ChunkingMode::CDC;
+    for (size_t i = 0; i < count; ++i) {
+        const BlockInfo& b = blocks[i];
+        if (b.strongHash.length < header.strongLength) {
+            std::cerr << "[serializeAndSendBlockHashes] Strong hash shorter than the signature header says\n";
             return false;
         }
+        uint8_t* record = writer_.reserve(sizeof(uint32_t) + header.strongLength);
+        Wire::storeU32(record, cdc ? static_cast<uint32_t>(b.length) : b.weakHash);
+        std::memcpy(record + sizeof(uint32_t), b.strongHash.bytes, header.strongLength);
+        if (!writer_.flushIfFull(socket)) return false;
     }
-    return true;
+    signatureBlocksLeft_ -= count;
+    return writer_.flush(socket, signatureBlocksLeft_ > 0);
 }
 
 bool DataTransfer::recvAll(int socketFD, void* buffer, size_t length) {
-    char* data = static_cast<char*>(buffer);
-    while (length > 0) {
-        ssize_t received = recv(socketFD, data, length, MSG_WAITALL);
-        if (received <= 0) return false;
-        data += received;
-        length -= received;
-    }
-    return true;
+    return reader_.read(socketFD, buffer, length);
 }
 
-bool  DataTransfer::receiveBlockHashes(int socketFD, std::vector<BlockInfo>& blocks) {
-    uint32_t blockCountNet;
-    if (!recvAll(socketFD, &blockCountNet, sizeof(blockCountNet))) return false;
-
-    uint32_t blockCount = ntohl(blockCountNet);
-    blocks.reserve(blockCount);
-
-    for (uint32_t i = 0; i < blockCount; ++i) {
-        uint64_t offsetNet;
-        uint32_t weakHashNet, strongLenNet;
+bool DataTransfer::receiveBlockHashes(int socketFD, Signature& signature) {
+    signature.blocks.clear();
+    return receiveBlockHashes(socketFD, SignatureSink{
+        [&signature](const SignatureHeader& header, size_t blockCount) {
+            signature.header = header;
+            signature.blocks.reserve(std::min<size_t>(blockCount, 1u << 20));   // the count is not trusted for memory
+            return true;
+        },
+        [&signature](const BlockInfo* blocks, size_t count) {
+            signature.blocks.insert(signature.blocks.end(), blocks, blocks + count);
+            return true;
+        }
+    });
+}
 
-        if (!recvAll(socketFD, &offsetNet, sizeof(offsetNet))) return false;
-        if (!recvAll(socketFD, &weakHashNet, sizeof(weakHashNet))) return false;
-        if (!recvAll(socketFD, &strongLenNet, sizeof(strongLenNet))) return false;
+bool DataTransfer::receiveBlockHashes(int socketFD, const SignatureSink& sink) {
+    if (!receiveSignatureHeader(socketFD, sink)) return false;
+    while (!signatureReceived()) {
+        if (!receiveSignatureBlocks(socketFD, sink)) return false;
+    }
+    return true;
+}
 
-        uint64_t offset = be64toh(offsetNet);
-        uint32_t weakHash = ntohl(weakHashNet);
-        uint32_t strongLen = ntohl(strongLenNet);
+bool DataTransfer::receiveSignatureHeader(int socketFD, const SignatureSink& sink) {
+    const size_t HEADER_SIZE = 28;
+    if (!reader_.fill(socketFD, HEADER_SIZE)) return false;
+    const uint8_t* raw = reader_.data();
+    uint8_t chunking = raw[0];
+    SignatureHeader header;
+    header.blockSize = Wire::loadU32(raw + 1);
+    header.minChunkSize = Wire::loadU32(raw + 5);
+    header.maxChunkSize = Wire::loadU32(raw + 9);
+    header.fileSize = Wire::loadU64(raw + 13);
+    uint8_t weakAlgorithm = raw[21];
+    uint8_t algorithm = raw[22];
+    header.strongLength = raw[23];
+    uint32_t blockCount = Wire::loadU32(raw + 24);
+    reader_.consume(HEADER_SIZE);
+
+    if (chunking > static_cast<uint8_t>(ChunkingMode::CDC)) {
+        std::cerr << "[receiveBlockHashes] Unknown chunking mode " << static_cast<int>(chunking) << "\n";
+        return false;
+    }
+    header.chunking = static_cast<ChunkingMode>(chunking);
+    if (header.blockSize == 0 || header.blockSize > Config::MAX_BLOCK_SIZE) {
+        std::cerr << "[receiveBlockHashes] Invalid block size\n";
+        return false;
+    }
+    if (weakAlgorithm >= WEAK_HASH_ALGORITHM_COUNT) {
+        std::cerr << "[receiveBlockHashes] Unknown weak hash algorithm " << static_cast<int>(weakAlgorithm) << "\n";
+        return false;
+    }
+    header.weakHashAlgorithm = static_cast<WeakHashAlgorithm>(weakAlgorithm);
+    if (!HashUtils::isStrongHashAlgorithm(algorithm)) {
+        std::cerr << "[receiveBlockHashes] Unknown strong hash algorithm " << static_cast<int>(algorithm) << "\n";
+        return false;
+    }
+    header.strongHashAlgorithm = static_cast<StrongHashAlgorithm>(algorithm);
+    if (header.strongLength == 0 || header.strongLength > HashUtils::digestLength(header.strongHashAlgorithm)) {
+        std::cerr << "[receiveBlockHashes] Invalid strong hash length\n";
+        return false;
+    }
+    const bool cdc = header.chunking == ChunkingMode::CDC;
+    if (!cdc && blockCount != (header.fileSize + header.blockSize - 1) / header.blockSize) {
+        std::cerr << "[receiveBlockHashes] Block count does not match the file size\n";
+        return false;
+    }
 
-        std::vector<char> hashBuf(strongLen);
-        if (!recvAll(socketFD, hashBuf.data(), strongLen)) return false;
+    receivingSignature_ = header;
+    receiveBlocksLeft_ = blockCount;
+    receiveOffset_ = 0;
+    if (!sink.header(header, blockCount)) return false;
+    return blockCount > 0 || checkSignatureCoverage();
+}
 
-        blocks.emplace_back(offset, weakHash, std::string(hashBuf.begin(), hashBuf.end()));
+// records are parsed where they lie in the receive buffer, whatever one recv brought
+// goes on as a batch
+bool DataTransfer::receiveSignatureBlocks(int socketFD, const SignatureSink& sink) {
+    const SignatureHeader& header = receivingSignature_;
+    const bool cdc = header.chunking == ChunkingMode::CDC;
+    const size_t recordSize = sizeof(uint32_t) + header.strongLength;
+    if (!reader_.fill(socketFD, recordSize)) return false;
+    size_t records = std::min<uint64_t>(reader_.available() / recordSize, receiveBlocksLeft_);
+    std::vector<BlockInfo> batch(records);
+    uint64_t offset = receiveOffset_;
+    for (BlockInfo& block : batch) {
+        const uint8_t* record = reader_.data();
+        block.offset = offset;
+        if (cdc) {
+            block.length = Wire::loadU32(record);
+            if (block.length == 0 || block.length > header.fileSize - offset) {
+                std::cerr << "[receiveBlockHashes] Chunk runs past the end of the file\n";
+                return false;
+            }
+        } else {
+            block.length = std::min<uint64_t>(header.blockSize, header.fileSize - offset);
+            block.weakHash = Wire::loadU32(record);
+        }
+        block.strongHash.length = header.strongLength;
+        std::memcpy(block.strongHash.bytes, record + sizeof(uint32_t), header.strongLength);
+        reader_.consume(recordSize);
+        offset += block.length;
     }
+    receiveOffset_ = offset;
+    receiveBlocksLeft_ -= records;
+    if (!sink.blocks(batch.data(), batch.size())) return false;
+    return receiveBlocksLeft_ > 0 || checkSignatureCoverage();
+}
 
+bool DataTransfer::checkSignatureCoverage() const {
+    if (receiveOffset_ != receivingSignature_.fileSize) {
+        std::cerr << "[receiveBlockHashes] Blocks do not cover the file\n";
+        return false;
+    }
     return true;
 }
 
+// delta goes on the wire as a sequence of frames
+// every frame is [count][count instructions], count=DELTA_STREAM_END closes the stream
+// and count=DELTA_STREAM_ABORT tells the receiver that the sender gave up midway
+// instructions are [type] followed by varints:
+//   COPY_RANGE  [zigzag(offset - end of the previous copy in the frame)][length]
+//   INSERT      [length][data]
+// copies mostly follow each other, so an unchanged run costs a few bytes whatever its size
+// with compressed literals an INSERT is only [length], and the frame ends with
+// [compressed length][deflated data of all its inserts]
 bool DataTransfer::serializeAndSendDeltaInstructions(int socket, const std::vector<DeltaInstruction>& delta) {
-    // Send total number of instructions
-    uint32_t count = htonl(delta.size());
-    if (!sendAll(socket, &count, sizeof(count))) return false;
+    return sendDeltaFrame(socket, delta) && endDeltaStream(socket);
+}
 
+bool DataTransfer::sendDeltaFrame(int socket, const std::vector<DeltaInstruction>& delta) {
+    // an empty frame would read as the end marker, nothing to send anyway
+    if (delta.empty()) return true;
+
+    // small literals are copied next to the instructions, big ones go out from where they are:
+    // by sendfile when they are a range of the source file, otherwise referenced in the gather write
+    const size_t COPY_LITERAL_LIMIT = 4096;
+
+    using Clock = std::chrono::steady_clock;
+    std::vector<uint8_t> literals;   // compressed
+    size_t literalBytes = 0;
+    Clock::duration compressTime{}, sendTime{};
+    auto flush = [&](bool more) {
+        Clock::time_point t0 = Clock::now();
+        bool sent = more ? writer_.flushIfFull(socket) : writer_.flush(socket);
+        sendTime += Clock::now() - t0;
+        return sent;
+    };
+
+    // Send number of instructions in this frame
+    writer_.putU32(delta.size());
+
+    uint64_t previousEnd = 0;
     for (const DeltaInstruction& inst : delta) {
-        // Send the type
-        uint8_t type = static_cast<uint8_t>(inst.type);
-        if (!sendAll(socket, &type, sizeof(type))) return false;
+        writer_.putU8(static_cast<uint8_t>(inst.type));
 
-        if (inst.type == DeltaType::COPY) {
-            // Send offset for COPY
-            uint64_t offset_net = htobe64(inst.offset);
-            if (!sendAll(socket, &offset_net, sizeof(offset_net))) return false;
+        if (inst.type == DeltaType::COPY_RANGE) {
+            writer_.putVarint(Varint::zigzagEncode(static_cast<int64_t>(inst.offset - previousEnd)));
+            writer_.putVarint(inst.length);
+            previousEnd = inst.offset + inst.length;
 
         } else if (inst.type == DeltaType::INSERT) {
-            // Send data length and then data for INSERT
-            uint32_t dataLen = htonl(inst.data.size());
-            if (!sendAll(socket, &dataLen, sizeof(dataLen))) return false;
-
-            if (!inst.data.empty() && !sendAll(socket, inst.data.data(), inst.data.size())) {
-                return false;
+            writer_.putVarint(inst.data.size());
+            if (compressor_) {
+                Clock::time_point t0 = Clock::now();
+                if (!compressor_->append(inst.data.data(), inst.data.size(), literals)) return false;
+                compressTime += Clock::now() - t0;
+                literalBytes += inst.data.size();
+            } else if (inst.data.size() <= COPY_LITERAL_LIMIT) {
+                writer_.put(inst.data.data(), inst.data.size());
+            } else if (inst.data.fileFd() >= 0) {
+                writer_.putFile(inst.data.fileFd(), inst.data.fileOffset(), inst.data.size());
+            } else {
+                writer_.putRef(inst.data.data(), inst.data.size());
             }
         } else {
             std::cerr << "[Error] Unknown DeltaType\n";
             return false;
         }
+
+        if (!flush(true)) return false;
+    }
+
+    if (literalBytes > 0) {
+        Clock::time_point t0 = Clock::now();
+        if (!compressor_->flush(literals)) return false;
+        compressTime += Clock::now() - t0;
+        writer_.putVarint(literals.size());
+        writer_.putRef(literals.data(), literals.size());
     }
+    // every frame leaves right away, the receiver applies while the rest is generated
+    if (!flush(false)) return false;
 
+    if (compressor_) {
+        using Seconds = std::chrono::duration<double>;
+        compressor_->adapt(literalBytes, Seconds(compressTime).count(), Seconds(sendTime).count());
+    }
     return true;
 }
 
-bool DataTransfer::receiveDelta(int socket, std::vector<DeltaInstruction>& delta) {
-    delta.clear();
+bool DataTransfer::endDeltaStream(int socket) {
+    writer_.putU32(DELTA_STREAM_END);
+    return writer_.flush(socket);
+}
+
+bool DataTransfer::abortDeltaStream(int socket) {
+    writer_.putU32(DELTA_STREAM_ABORT);
+    return writer_.flush(socket);
+}
+
+bool DataTransfer::recvVarint(int socketFD, uint64_t& value) {
+    if (reader_.readVarint(socketFD, value)) return true;
+    if (reader_.starved()) return false;
+    std::cerr << "[recvVarint] Malformed varint or connection closed\n";
+    return false;
+}
+
+bool DataTransfer::receiveDelta(int socket, const DeltaSink& sink) {
+    bool ended = false;
+    while (!ended) {
+        if (!receiveDeltaFrame(socket, sink, ended)) return false;
+    }
+    return true;
+}
 
-    // 1. Receive count of delta instructions
-    uint32_t countNet;
-    if (!recvAll(socket, &countNet, sizeof(countNet))) return false;
-    uint32_t count = ntohl(countNet);
+// literals land in slabs of an arena that the instructions of a frame share, not in a buffer
+// per insert. The slabs go with the frame once the sink is done with it
+bool DataTransfer::receiveDeltaFrame(int socket, const DeltaSink& sink, bool& ended) {
+    if (!frame_.started) {
+        // 1. Receive count of delta instructions in the frame
+        uint32_t count;
+        if (!reader_.readU32(socket, count)) return false;
+
+        ended = count == DELTA_STREAM_END;
+        if (ended) return true;
+        if (count == DELTA_STREAM_ABORT) {
+            std::cerr << "[receiveDelta] Sender aborted the delta stream\n";
+            return false;
+        }
+        uint32_t maxInstructions;
+        frameLimits(maxInstructions, frame_.maxInsert, frame_.literalsLeft);
+        if (count > maxInstructions) {
+            std::cerr << "[receiveDelta] Frame of " << count << " instructions is too long\n";
+            return false;
+        }
+        frame_.started = true;
+        frame_.count = count;
+        reader_.mark();
+    }
 
-    for (uint32_t i = 0; i < count; ++i) {
-        // 2. Receive type
-        uint8_t typeByte;
-        if (!recvAll(socket, &typeByte, sizeof(typeByte))) return false;
-        DeltaType type = static_cast<DeltaType>(typeByte);
+    if (!receiveFramePieces(socket)) {
+        // only a frame that ran out of bytes goes on at the next call
+        if (!reader_.starved()) frame_ = FrameReceive{};
+        return false;
+    }
+    std::vector<DeltaInstruction> delta = std::move(frame_.delta);
+    frame_ = FrameReceive{};
+    return sink(std::move(delta));
+}
 
-        if (type == DeltaType::COPY) {
-            // 3. Receive offset for COPY
-            uint64_t offsetNet;
-            if (!recvAll(socket, &offsetNet, sizeof(offsetNet))) return false;
-            size_t offset = be64toh(offsetNet);
+// the most a sender can put in one frame for the signature we sent (DeltaStream): the
+// instructions of one chunk of its file, chunkSize bytes and up to a block (CDC: a chunk)
+// further. Its last insert takes in the inserts of the chunks after it until it has chunkSize
+// bytes, so an insert stays below two chunks and the frame's literals below three. Copies cover
+// a block at least (CDC: the smallest chunk) and an insert lies between two of them at most.
+// Before any signature the limits of the largest block size apply
+void DataTransfer::frameLimits(uint32_t& maxInstructions, uint64_t& maxInsert, uint64_t& maxLiterals) const {
+    const SignatureHeader& header = sendingSignature_;
+    const bool cdc = header.chunking == ChunkingMode::CDC;
+    const uint64_t blockSize = header.blockSize > 0 ? header.blockSize : Config::MAX_BLOCK_SIZE;
+    const uint64_t chunkSize = std::max<uint64_t>(Config::CHUNK_SIZE, blockSize * Config::MIN_BLOCKS_PER_CHUNK);
+    const uint64_t span = chunkSize + (cdc ? header.maxChunkSize : blockSize);
+    const uint64_t smallestCopy = header.blockSize == 0 ? Config::MIN_BLOCK_SIZE
+                                  : std::max<uint64_t>(1, cdc ? header.minChunkSize : header.blockSize);
+    maxInsert = span + chunkSize;
+    maxLiterals = 2 * span + chunkSize;
+    maxInstructions = static_cast<uint32_t>(std::min<uint64_t>(2 * (span / smallestCopy) + 3, DELTA_STREAM_ABORT - 1));
+}
 
-            delta.push_back(DeltaInstruction::makeCopy(offset));
-        } else if (type == DeltaType::INSERT) {
-            // 4. Receive data length
-            uint32_t dataLenNet;
-            if (!recvAll(socket, &dataLenNet, sizeof(dataLenNet))) return false;
-            uint32_t dataLen = ntohl(dataLenNet);
+// the instructions one by one, each insert's bytes right after it, then the compressed literals.
+// Every piece that is complete is marked, a rewind only goes back to the start of the one cut short
+bool DataTransfer::receiveFramePieces(int socket) {
+    FrameReceive& frame = frame_;
+    while (true) {
+        if (frame.bytes && !reader_.readInto(socket, frame.bytes, frame.bytesLen, frame.bytesDone)) return false;
+        frame.bytes = nullptr;
+        if (frame.parsed == frame.count) break;
+        if (!receiveInstruction(socket)) return false;
+        frame.parsed++;
+        reader_.mark();
+    }
+    return frame.compressedInserts.empty() || receiveCompressedLiterals(socket);
+}
 
-            // 5. Receive data
-            std::vector<char> data(dataLen);
-            if (dataLen > 0 && !recvAll(socket, data.data(), dataLen)) return false;
+bool DataTransfer::receiveInstruction(int socket) {
+    FrameReceive& frame = frame_;
+    // 2. Receive type
+    uint8_t typeByte;
+    if (!reader_.readU8(socket, typeByte)) return false;
+    DeltaType type = static_cast<DeltaType>(typeByte);
+
+    if (type == DeltaType::COPY_RANGE) {
+        // 3. Receive offset relative to the previous copy, and length
+        uint64_t offsetDelta, length;
+        if (!recvVarint(socket, offsetDelta) || !recvVarint(socket, length)) return false;
+        uint64_t offset = frame.previousEnd + Varint::zigzagDecode(offsetDelta);
+        frame.previousEnd = offset + length;
+
+        frame.delta.push_back(DeltaInstruction::makeCopyRange(offset, length));
+        return true;
+    }
+    if (type != DeltaType::INSERT) {
+        std::cerr << "[Error] Unknown DeltaType received\n";
+        return false;
+    }
 
-            delta.push_back(DeltaInstruction::makeInsert(data));
-        } else {
-            std::cerr << "[Error] Unknown DeltaType received\n";
+    // 4. Receive data length
+    uint64_t dataLen;
+    if (!recvVarint(socket, dataLen)) return false;
+    if (dataLen > frame.maxInsert || dataLen > frame.literalsLeft) {
+        std::cerr << "[receiveDelta] Insert of " << dataLen << " bytes is more than a frame can hold\n";
+        return false;
+    }
+    frame.literalsLeft -= dataLen;
+
+    // 5. The data follows, or room is left for it when it comes compressed at the end of the frame
+    LiteralBytes data;
+    char* room = frame.arena.allocate(dataLen, data);
+    if (decompressor_) {
+        if (dataLen > 0) frame.compressedInserts.push_back({ room, dataLen });
+    } else if (dataLen > 0) {
+        frame.bytes = room;
+        frame.bytesLen = dataLen;
+        frame.bytesDone = 0;
+    }
+    frame.delta.push_back(DeltaInstruction::makeInsert(std::move(data)));
+    return true;
+}
+
+bool DataTransfer::receiveCompressedLiterals(int socketFD) {
+    FrameReceive& frame = frame_;
+    if (!frame.compressedSized) {
+        uint64_t literalBytes = 0;
+        for (const PendingLiteral& insert : frame.compressedInserts) literalBytes += insert.size;
+
+        // deflate never grows data by more than a few bytes per 16 kb
+        uint64_t compressedLen;
+        if (!recvVarint(socketFD, compressedLen)) return false;
+        if (compressedLen > literalBytes + literalBytes / 16 + 1024) {
+            std::cerr << "[receiveDelta] Compressed literals of " << compressedLen << " bytes are too long\n";
             return false;
         }
+        frame.compressed.resize(compressedLen);
+        frame.compressedSized = true;
+        frame.bytesDone = 0;
+        reader_.mark();
     }
+    if (!reader_.readInto(socketFD, frame.compressed.data(), frame.compressed.size(), frame.bytesDone)) return false;
 
+    decompressor_->setInput(frame.compressed);
+    for (const PendingLiteral& insert : frame.compressedInserts) {
+        if (!decompressor_->read(insert.data, insert.size)) return false;
+    }
+    if (!decompressor_->inputConsumed()) {
+        std::cerr << "[receiveDelta] Compressed literals longer than their inserts\n";
+        return false;
+    }
+    return true;
+}
+
+// options are length prefixed, fields only get appended so a shorter or longer message
+// from another version still parses: missing fields keep their defaults, unknown ones are skipped
+bool DataTransfer::sendTransferOptions(int socketFD, const TransferOptions& options) {
+    std::vector<uint8_t> payload;
+    payload.push_back(static_cast<uint8_t>(options.chunking));
+    for (uint32_t field : { options.blockSize, options.features }) {
+        uint32_t fieldNet = htonl(field);
+        const uint8_t* fieldBytes = reinterpret_cast<const uint8_t*>(&fieldNet);
+        payload.insert(payload.end(), fieldBytes, fieldBytes + sizeof(fieldNet));
+    }
+    payload.push_back(options.inPlace ? 1 : 0);
+    payload.push_back(static_cast<uint8_t>(options.weakHash));
+    payload.push_back(static_cast<uint8_t>(options.strongHash));
+    payload.push_back(options.fullStrongHash ? 1 : 0);
+
+    uint32_t payloadLen = htonl(payload.size());
+    if (!sendAll(socketFD, &payloadLen, sizeof(payloadLen)) ||
+        !sendAll(socketFD, payload.data(), payload.size()) || !writer_.flush(socketFD)) {
+        std::cerr << "[sendTransferOptions] Failed to send transfer options\n";
+        return false;
+    }
+    return true;
+}
+
+bool DataTransfer::receiveTransferOptions(int socketFD, TransferOptions& options) {
+    const uint32_t MAX_OPTIONS_LEN = 4096;
+    uint32_t payloadLenNet = 0;
+    if (!recvAll(socketFD, &payloadLenNet, sizeof(payloadLenNet))) {
+        if (!reader_.starved()) std::cerr << "[receiveTransferOptions] Failed to receive options length\n";
+        return false;
+    }
+    uint32_t payloadLen = ntohl(payloadLenNet);
+    if (payloadLen > MAX_OPTIONS_LEN) {
+        std::cerr << "[receiveTransferOptions] Options too long\n";
+        return false;
+    }
+    std::vector<uint8_t> payload(payloadLen);
+    if (payloadLen > 0 && !recvAll(socketFD, payload.data(), payloadLen)) {
+        if (!reader_.starved()) std::cerr << "[receiveTransferOptions] Failed to receive options\n";
+        return false;
+    }
+
+    options = TransferOptions{};
+    if (payload.size() >= 1) {
+        if (payload[0] > static_cast<uint8_t>(ChunkingMode::CDC)) {
+            std::cerr << "[receiveTransferOptions] Unknown chunking mode\n";
+            return false;
+        }
+        options.chunking = static_cast<ChunkingMode>(payload[0]);
+    }
+    if (payload.size() >= 5) {
+        uint32_t blockSizeNet;
+        std::memcpy(&blockSizeNet, &payload[1], sizeof(blockSizeNet));
+        options.blockSize = ntohl(blockSizeNet);
+    }
+    // a peer that sends no feature field knows none of them
+    options.features = 0;
+    if (payload.size() >= 9) {
+        uint32_t featuresNet;
+        std::memcpy(&featuresNet, &payload[5], sizeof(featuresNet));
+        options.features = ntohl(featuresNet);
+    }
+    if (payload.size() >= 10) {
+        options.inPlace = payload[9] != 0;
+    }
+    if (payload.size() >= 11) {
+        if (payload[10] >= WEAK_HASH_ALGORITHM_COUNT) {
+            std::cerr << "[receiveTransferOptions] Unknown weak hash algorithm\n";
+            return false;
+        }
+        options.weakHash = static_cast<WeakHashAlgorithm>(payload[10]);
+    }
+    if (payload.size() >= 12) {
+        if (!HashUtils::isStrongHashAlgorithm(payload[11])) {
+            std::cerr << "[receiveTransferOptions] Unknown strong hash algorithm\n";
+            return false;
+        }
+        options.strongHash = static_cast<StrongHashAlgorithm>(payload[11]);
+    }
+    if (payload.size() >= 13) {
+        options.fullStrongHash = payload[12] != 0;
+    }
+    return true;
+}
+
+bool DataTransfer::useTransferOptions(const TransferOptions& options) {
+    compressor_.reset();
+    decompressor_.reset();
+    if (options.features & COMPRESSED_LITERALS) {
+        // each side only ever uses one of them, but the transfer direction is not known here
+        compressor_ = std::make_unique<LiteralCompressor>();
+        decompressor_ = std::make_unique<LiteralDecompressor>();
+        if (!compressor_->init() || !decompressor_->init()) return false;
+    }
+    return true;
+}
+
+// [u8 length][digest]
+bool DataTransfer::sendFileDigest(int socketFD, const StrongHash& digest) {
+    uint8_t length = digest.length;
+    if (!sendAll(socketFD, &length, sizeof(length)) || !sendAll(socketFD, digest.bytes, length) || !writer_.flush(socketFD)) {
+        std::cerr << "[sendFileDigest] Failed to send the file digest\n";
+        return false;
+    }
+    return true;
+}
+
+bool DataTransfer::receiveFileDigest(int socketFD, StrongHash& digest) {
+    uint8_t length = 0;
+    if (!recvAll(socketFD, &length, sizeof(length))) {
+        if (!reader_.starved()) std::cerr << "[receiveFileDigest] Failed to receive the digest length\n";
+        return false;
+    }
+    if (length == 0 || length > StrongHash::MAX_LENGTH) {
+        std::cerr << "[receiveFileDigest] Invalid digest length\n";
+        return false;
+    }
+    digest = StrongHash{};
+    digest.length = length;
+    if (!recvAll(socketFD, digest.bytes, length)) {
+        if (!reader_.starved()) std::cerr << "[receiveFileDigest] Failed to receive the digest\n";
+        return false;
+    }
+    return true;
+}
+
+// one byte, 1 when the new file matched the digest or was never checked
+bool DataTransfer::sendDigestMatch(int socketFD, bool matched) {
+    uint8_t byte = matched ? 1 : 0;
+    if (!sendAll(socketFD, &byte, sizeof(byte)) || !writer_.flush(socketFD)) {
+        std::cerr << "[sendDigestMatch] Failed to send the digest check\n";
+        return false;
+    }
+    return true;
+}
+
+bool DataTransfer::receiveDigestMatch(int socketFD, bool& matched) {
+    uint8_t byte = 0;
+    if (!recvAll(socketFD, &byte, sizeof(byte))) {
+        std::cerr << "[receiveDigestMatch] Failed to receive the digest check\n";
+        return false;
+    }
+    matched = byte != 0;
     return true;
 }
 
@@ -155,7 +610,7 @@ bool DataTransfer::sendFilePath(int socketFD, const std::string& filePath) {
         return false;
     }
 
-    if (!sendAll(socketFD, filePath.c_str(), filePath.size())) {
+    if (!sendAll(socketFD, filePath.c_str(), filePath.size()) || !writer_.flush(socketFD)) {
         std::cerr << "[sendFilePath] Failed to send path string\n";
         return false;
     }
@@ -167,15 +622,21 @@ bool DataTransfer::receiveFilePath(int socketFD, std::string& filePath) {
     uint32_t pathLenNet = 0;
 
     if (!recvAll(socketFD, &pathLenNet, sizeof(pathLenNet))) {
-        std::cerr << "[receiveFilePath] Failed to receive path length\n";
+        if (!reader_.starved()) std::cerr << "[receiveFilePath] Failed to receive path length\n";
         return false;
     }
 
+    // the event driven server holds a whole message before it parses it, so its length is bounded
+    const uint32_t MAX_PATH_LEN = 4096;
     uint32_t pathLen = ntohl(pathLenNet);
+    if (pathLen > MAX_PATH_LEN) {
+        std::cerr << "[receiveFilePath] Path too long\n";
+        return false;
+    }
     filePath.resize(pathLen);
 
     if (!recvAll(socketFD, &filePath[0], pathLen)) {
-        std::cerr << "[receiveFilePath] Failed to receive path string\n";
+        if (!reader_.starved()) std::cerr << "[receiveFilePath] Failed to receive path string\n";
         return false;
     }
 
@@ -199,7 +660,7 @@ bool DataTransfer::sendStatus(int socketFD, const StatusMessage& statusMsg) {
     }
 
     // Send message string (msgLen bytes)
-    if (!sendAll(socketFD, statusMsg.msg.c_str(), statusMsg.msg.size())) {
+    if (!sendAll(socketFD, statusMsg.msg.c_str(), statusMsg.msg.size()) || !writer_.flush(socketFD)) {
         std::cerr << "[sendStatusMessage] Failed to send message string\n";
         return false;
     }
@@ -235,4 +696,17 @@ bool DataTransfer::recieveStatus(int socket,StatusMessage& statusMessage){
 
     statusMessage = StatusMessage(statusByte != 0, std::move(msg));
     return true;
-}
\ No newline at end of file
+}
+
+bool DataTransfer::receiveCommand(int socketFD, std::string& command) {
+    char line[5];
+    if (!recvAll(socketFD, line, sizeof(line))) return false;
+    if (line[4] != '\n') return false;
+    command.assign(line, 4);
+    return true;
+}
+
+void DataTransfer::useConnectionBuffers(WireReader::Source source, WireWriter::Queue queue) {
+    reader_.receiveFrom(std::move(source));
+    writer_.sendTo(std::move(queue));
+}
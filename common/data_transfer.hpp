@@ -1,7 +1,14 @@
 #pragma once
 #include "block_info.hpp"
+#include "signature.hpp"
+#include "transfer_options.hpp"
 #include "delta_instruction.hpp"
+#include "wire_buffer.hpp"
 #include<vector>
+#include<memory>
+
+class LiteralCompressor;
+class LiteralDecompressor;
 struct StatusMessage{
     bool status;
     std::string msg;
@@ -13,15 +20,108 @@ struct StatusMessage{
 
 class DataTransfer{
 public:
-    bool serializeAndSendBlockHashes(const int socket, const std::vector<BlockInfo>& blockHashes);
-    bool receiveBlockHashes(const int socketFD, std::vector<BlockInfo>& blocks);
+    DataTransfer();
+    ~DataTransfer();
+    bool serializeAndSendBlockHashes(const int socket, const Signature& signature);
+    bool receiveBlockHashes(const int socketFD, Signature& signature);
+    // streaming form of the signature: the sink returned here sends every batch as it is handed
+    // over, and a received one goes to sink batch by batch as it arrives
+    SignatureSink signatureSender(int socket);
+    bool receiveBlockHashes(int socketFD, const SignatureSink& sink);
+    // the same in steps: the header, then the blocks whatever number of them has arrived at a
+    // time, until signatureReceived()
+    bool receiveSignatureHeader(int socketFD, const SignatureSink& sink);
+    bool receiveSignatureBlocks(int socketFD, const SignatureSink& sink);
+    bool signatureReceived() const { return receiveBlocksLeft_ == 0; }
     bool serializeAndSendDeltaInstructions(int socket, const std::vector<DeltaInstruction>& delta);
-    bool receiveDelta(int socket, std::vector<DeltaInstruction>& delta);
+    // every frame goes to sink as soon as it is decoded, so the delta is never held whole
+    bool receiveDelta(int socket, const DeltaSink& sink);
+    // one frame of it, ended is set by the end marker instead. With connection buffers a frame
+    // that runs out of bytes is kept as far as it got and the next call goes on from there
+    bool receiveDeltaFrame(int socket, const DeltaSink& sink, bool& ended);
+    // streaming form of the delta: any number of frames followed by end (or abort)
+    bool sendDeltaFrame(int socket, const std::vector<DeltaInstruction>& delta);
+    bool endDeltaStream(int socket);
+    bool abortDeltaStream(int socket);
+    // FILE_DIGEST: the source's file digest after the delta stream, and the destination's answer
+    // whether the new file matched it (if not, the client syncs the file again)
+    bool sendFileDigest(int socketFD, const StrongHash& digest);
+    bool receiveFileDigest(int socketFD, StrongHash& digest);
+    bool sendDigestMatch(int socketFD, bool matched);
+    bool receiveDigestMatch(int socketFD, bool& matched);
+    bool sendTransferOptions(int socketFD, const TransferOptions& options);
+    bool receiveTransferOptions(int socketFD, TransferOptions& options);
+    // switches on what was negotiated for this transfer, both sides call it with the server's answer
+    bool useTransferOptions(const TransferOptions& options);
     bool sendFilePath(int socketFD, const std::string& filePath);
     bool receiveFilePath(int socketFD, std::string& filePath);
     bool sendStatus(int socket,const StatusMessage& statusMessage);
     bool recieveStatus(int socket,StatusMessage &status);
+    // the 5 byte request line, "PUSH\n" or "PULL\n", command is its first four bytes
+    bool receiveCommand(int socketFD, std::string& command);
+
+    // a connection of the event driven server: bytes come from source and go to queue, the
+    // socket arguments are not used. A receive that runs out of bytes fails with starved() set,
+    // one started after markReceive() can be retried after rewindReceive() once missingBytes()
+    // more have come in
+    void useConnectionBuffers(WireReader::Source source, WireWriter::Queue queue);
+    void markReceive() { reader_.mark(); }
+    void unmarkReceive() { reader_.unmark(); }
+    void rewindReceive() { reader_.rewind(); }
+    bool starved() const { return reader_.starved(); }
+    size_t missingBytes() const { return reader_.missing(); }
 private:
+    // frame header values that are not an instruction count
+    static constexpr uint32_t DELTA_STREAM_END = 0;
+    static constexpr uint32_t DELTA_STREAM_ABORT = 0xFFFFFFFF;
+
     bool sendAll(int socket, const void* buffer, size_t length);
     bool recvAll(int socketFD,void* buffer, size_t length);
+    bool recvVarint(int socketFD, uint64_t& value);
+    bool sendSignatureHeader(int socket, const SignatureHeader& header, size_t blockCount);
+    bool sendSignatureBlocks(int socket, const BlockInfo* blocks, size_t count);
+    bool checkSignatureCoverage() const;
+    // room in the arena for an insert whose bytes come compressed at the end of its frame
+    struct PendingLiteral {
+        char* data;
+        size_t size;
+    };
+    // a delta frame being received: the instructions parsed so far, the insert (or the
+    // compressed literals) whose bytes are coming in
+    struct FrameReceive {
+        bool started = false;
+        uint32_t count = 0;
+        uint32_t parsed = 0;
+        uint64_t maxInsert = 0;
+        uint64_t literalsLeft = 0;   // insert bytes the frame may still declare
+        uint64_t previousEnd = 0;
+        std::vector<DeltaInstruction> delta;
+        LiteralArena arena;
+        std::vector<PendingLiteral> compressedInserts;   // filled after the instructions
+        bool compressedSized = false;
+        std::vector<uint8_t> compressed;
+        void* bytes = nullptr;
+        size_t bytesLen = 0;
+        size_t bytesDone = 0;
+    };
+    void frameLimits(uint32_t& maxInstructions, uint64_t& maxInsert, uint64_t& maxLiterals) const;
+    bool receiveFramePieces(int socket);
+    bool receiveInstruction(int socket);
+    bool receiveCompressedLiterals(int socketFD);
+
+    // literal compression state lives as long as the transfer
+    std::unique_ptr<LiteralCompressor> compressor_;
+    std::unique_ptr<LiteralDecompressor> decompressor_;
+    // buffered i/o of the connection, all sends and receives of this transfer go through them
+    WireWriter writer_;
+    WireReader reader_;
+
+    // signature being sent
+    SignatureHeader sendingSignature_;
+    uint64_t signatureBlocksLeft_ = 0;
+    // signature being received
+    SignatureHeader receivingSignature_;
+    uint64_t receiveBlocksLeft_ = 0;
+    uint64_t receiveOffset_ = 0;
+    FrameReceive frame_;
 };
\ No newline at end of file
@@ -1,19 +1,44 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <cstdint>
+#include <functional>
+#include "literal_bytes.hpp"
 
-enum class DeltaType { COPY, INSERT };
+// values are what goes on the wire
+enum class DeltaType : uint8_t { INSERT = 1, COPY_RANGE = 2 };
 
 struct DeltaInstruction {
     DeltaType type;
-    size_t offset; // used for COPY
-    std::vector<char> data; // used for INSERT
+    size_t offset; // used for COPY_RANGE
+    LiteralBytes data; // used for INSERT, shares the storage it points into
+    size_t length = 0; // used for COPY_RANGE
 
-    static DeltaInstruction makeCopy(size_t offset) {
-        return { DeltaType::COPY, offset, {} };
+    // range of the destination file, a run of consecutive matched blocks or a content defined chunk
+    static DeltaInstruction makeCopyRange(size_t offset, size_t length) {
+        return { DeltaType::COPY_RANGE, offset, {}, length };
     }
 
-    static DeltaInstruction makeInsert(const std::vector<char>& data) {
-        return { DeltaType::INSERT, 0, data };
+    static DeltaInstruction makeInsert(LiteralBytes data) {
+        return { DeltaType::INSERT, 0, std::move(data) };
+    }
+
+    // copies the bytes, for data nothing else keeps alive
+    static DeltaInstruction makeInsert(const char* data, size_t len) {
+        return { DeltaType::INSERT, 0, LiteralBytes::copyOf(data, len) };
     }
 };
+
+// appends a copy, extending the previous one when it continues right where that one ended
+inline void appendCopyRange(std::vector<DeltaInstruction>& deltas, size_t offset, size_t length) {
+    if (!deltas.empty() && deltas.back().type == DeltaType::COPY_RANGE &&
+        deltas.back().offset + deltas.back().length == offset) {
+        deltas.back().length += length;
+        return;
+    }
+    deltas.push_back(DeltaInstruction::makeCopyRange(offset, length));
+}
+
+// receives a delta piece by piece in file order (the delta of a source chunk, a received frame)
+// returning false stops the producer
+using DeltaSink = std::function<bool(std::vector<DeltaInstruction>&&)>;
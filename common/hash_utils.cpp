@@ -0,0 +1,130 @@
+// the low level SHA1_* calls are deprecated in OpenSSL 3 but skip the per call algorithm fetch
+// that makes SHA1() about half as fast on small blocks
+#define OPENSSL_SUPPRESS_DEPRECATED
+#include "hash_utils.hpp"
+#include <openssl/sha.h>
+#include "blake3.hpp"
+#include "xxh3.hpp"
+#include "config.hpp"
+#include "thread_pool.hpp"
+#include "wire_buffer.hpp"
+#include <vector>
+
+namespace {
+struct NamedAlgorithm {
+    const char* name;
+    StrongHashAlgorithm algorithm;
+    uint8_t digestLength;
+};
+const NamedAlgorithm ALGORITHMS[] = {
+    { "sha1", StrongHashAlgorithm::SHA1, SHA_DIGEST_LENGTH },
+    { "blake3", StrongHashAlgorithm::BLAKE3, Blake3::DIGEST_LENGTH },
+    { "xxh3", StrongHashAlgorithm::XXH3_128, Xxh3::DIGEST_LENGTH },
+};
+static_assert(Blake3::DIGEST_LENGTH <= StrongHash::MAX_LENGTH);
+
+const NamedAlgorithm* find(StrongHashAlgorithm algorithm) {
+    for (const NamedAlgorithm& a : ALGORITHMS) {
+        if (a.algorithm == algorithm) return &a;
+    }
+    return nullptr;
+}
+
+void sha1(const char* data, size_t len, unsigned char* out) {
+    SHA_CTX context;
+    SHA1_Init(&context);
+    SHA1_Update(&context, data, len);
+    SHA1_Final(out, &context);
+}
+}
+
+StrongHash HashUtils::computeStrongHash(StrongHashAlgorithm algorithm, const char* data, size_t len) {
+    StrongHash hash;
+    switch (algorithm) {
+    case StrongHashAlgorithm::BLAKE3:
+        Blake3::hash(data, len, hash.bytes);
+        hash.length = Blake3::DIGEST_LENGTH;
+        break;
+    case StrongHashAlgorithm::XXH3_128:
+        Xxh3::hash128(data, len, hash.bytes);
+        hash.length = Xxh3::DIGEST_LENGTH;
+        break;
+    case StrongHashAlgorithm::SHA1:
+        sha1(data, len, hash.bytes);
+        hash.length = SHA_DIGEST_LENGTH;
+        break;
+    }
+    return hash;
+}
+
+// BLAKE3 takes the blocks eight at a time, the others one after the other
+void HashUtils::computeStrongHashes(StrongHashAlgorithm algorithm, const char* data, size_t blockSize, size_t count, StrongHash* out) {
+    if (algorithm != StrongHashAlgorithm::BLAKE3) {
+        for (size_t i = 0; i < count; ++i) out[i] = computeStrongHash(algorithm, data + i * blockSize, blockSize);
+        return;
+    }
+    const size_t BATCH = 64;
+    uint8_t digests[BATCH][Blake3::DIGEST_LENGTH];
+    for (size_t first = 0; first < count; first += BATCH) {
+        size_t n = std::min(BATCH, count - first);
+        Blake3::hashBlocks(data + first * blockSize, blockSize, n, digests);
+        for (size_t i = 0; i < n; ++i) {
+            out[first + i] = StrongHash{};
+            std::memcpy(out[first + i].bytes, digests[i], Blake3::DIGEST_LENGTH);
+            out[first + i].length = Blake3::DIGEST_LENGTH;
+        }
+    }
+}
+
+StrongHash HashUtils::fileDigest(StrongHashAlgorithm algorithm, uint64_t fileSize, const StrongHash* blocks, size_t count) {
+    std::vector<uint8_t> digests(sizeof(uint64_t));
+    Wire::storeU64(digests.data(), fileSize);
+    for (size_t i = 0; i < count; ++i) digests.insert(digests.end(), blocks[i].bytes, blocks[i].bytes + blocks[i].length);
+    return computeStrongHash(algorithm, reinterpret_cast<const char*>(digests.data()), digests.size());
+}
+
+StrongHash HashUtils::fileDigest(StrongHashAlgorithm algorithm, const char* data, uint64_t fileSize, size_t blockSize) {
+    const size_t blockCount = (fileSize + blockSize - 1) / blockSize;
+    const size_t fullBlocks = fileSize / blockSize;
+    std::vector<StrongHash> blocks(blockCount);
+    if (fullBlocks < blockCount) {
+        blocks.back() = computeStrongHash(algorithm, data + fullBlocks * blockSize, fileSize - fullBlocks * blockSize);
+    }
+
+    ThreadPool& pool = ThreadPool::shared();
+    const size_t blocksPerSlice = std::max<size_t>(1, Config::CHUNK_SIZE / blockSize);
+    std::vector<std::future<void>> futures;
+    WaitForAll<std::vector<std::future<void>>> waitFutures(futures);
+    for (size_t first = 0; first < fullBlocks; first += blocksPerSlice) {
+        size_t count = std::min(blocksPerSlice, fullBlocks - first);
+        futures.emplace_back(pool.submit([&, first, count]() {
+            computeStrongHashes(algorithm, data + first * blockSize, blockSize, count, &blocks[first]);
+        }));
+    }
+    for (auto& future : futures) future.get();
+    return fileDigest(algorithm, fileSize, blocks.data(), blocks.size());
+}
+
+bool HashUtils::isStrongHashAlgorithm(uint32_t value) {
+    return find(static_cast<StrongHashAlgorithm>(value)) != nullptr;
+}
+
+uint8_t HashUtils::digestLength(StrongHashAlgorithm algorithm) {
+    const NamedAlgorithm* a = find(algorithm);
+    return a ? a->digestLength : 0;
+}
+
+bool HashUtils::strongHashFromName(const std::string& name, StrongHashAlgorithm& algorithm) {
+    for (const NamedAlgorithm& a : ALGORITHMS) {
+        if (name == a.name) {
+            algorithm = a.algorithm;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* HashUtils::strongHashName(StrongHashAlgorithm algorithm) {
+    const NamedAlgorithm* a = find(algorithm);
+    return a ? a->name : "unknown";
+}
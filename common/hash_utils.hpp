@@ -1,32 +1,75 @@
 #pragma once
 #include <cstdint>
 #include <string>
-#include <openssl/sha.h>
+#include <algorithm>
+#include "block_info.hpp"
+// identifies the strong hash on the wire and in persisted signatures. The client picks it per transfer
+enum class StrongHashAlgorithm : uint32_t {
+    SHA1 = 1,       // 20 bytes, the default
+    BLAKE3 = 2,     // 32 bytes, cryptographic, hashes eight blocks at once
+    XXH3_128 = 3    // 16 bytes, not cryptographic: a crafted file can collide on purpose
+};
+
 class HashUtils {
 public:
+    static constexpr StrongHashAlgorithm STRONG_HASH_ALGORITHM = StrongHashAlgorithm::SHA1;
 
-    static uint32_t computeWeakHash(const char* data, size_t len) {
-        const uint64_t base = 257;
-        const uint64_t mod = 1000000007;
+    // polynomial rolling hash, RollingHash computes it for many windows at once
+    static constexpr uint64_t WEAK_HASH_BASE = 257;
+    static constexpr uint64_t WEAK_HASH_MOD = 1000000007;
 
+    static uint32_t computeWeakHash(const char* data, size_t len) {
         uint64_t hash = 0;
         for (size_t i = 0; i < len; ++i) {
-            hash = (hash * base + static_cast<unsigned char>(data[i])) % mod;
+            hash = (hash * WEAK_HASH_BASE + static_cast<unsigned char>(data[i])) % WEAK_HASH_MOD;
         }
         return static_cast<uint32_t>(hash);
     }
 
-    static std::string computeStrongHash(const char* data, size_t len) {
-        unsigned char hash[SHA_DIGEST_LENGTH];
-        SHA1(reinterpret_cast<const unsigned char*>(data), len, hash);
+    // full digest of one block
+    static StrongHash computeStrongHash(StrongHashAlgorithm algorithm, const char* data, size_t len);
 
-        static const char* hex = "0123456789abcdef";
-        std::string result;
-        for (int i = 0; i < SHA_DIGEST_LENGTH; ++i) {
-            result += hex[(hash[i] >> 4) & 0xF];
-            result += hex[hash[i] & 0xF];
-        }
-        return result;
+    static StrongHash computeStrongHash(StrongHashAlgorithm algorithm, const char* data, size_t len, uint8_t strongLength) {
+        StrongHash hash = computeStrongHash(algorithm, data, len);
+        hash.truncate(strongLength);
+        return hash;
+    }
+
+    // out[i] = full digest of data[i*blockSize, (i+1)*blockSize) for i < count
+    static void computeStrongHashes(StrongHashAlgorithm algorithm, const char* data, size_t blockSize, size_t count, StrongHash* out);
+
+    // digest of a whole file, checked after a delta is applied: the strong hash of the file size and
+    // the full digests of its blocks of blockSize in order. Being taken over block digests, a side
+    // that has most of them already (derived from the delta) does not read the file again
+    static StrongHash fileDigest(StrongHashAlgorithm algorithm, uint64_t fileSize, const StrongHash* blocks, size_t count);
+    // the same, the blocks of data are hashed on the shared pool
+    static StrongHash fileDigest(StrongHashAlgorithm algorithm, const char* data, uint64_t fileSize, size_t blockSize);
+
+    static bool isStrongHashAlgorithm(uint32_t value);
+    static uint8_t digestLength(StrongHashAlgorithm algorithm);
+    static bool strongHashFromName(const std::string& name, StrongHashAlgorithm& algorithm);
+    static const char* strongHashName(StrongHashAlgorithm algorithm);
+
+    // bytes of the strong hash a signature needs, rsync style: a false match anywhere in the file
+    // stays below 2^-STRONG_HASH_BIAS. Candidates grow with positions * blocks (~size^2 / block size),
+    // weakBits of that are already covered by a weak hash that has to match first (WeakHash::matchBits,
+    // 0 when there is none)
+    static uint8_t strongHashLength(StrongHashAlgorithm algorithm, uint64_t fileSize, uint64_t blockSize, int weakBits) {
+        const int MIN_STRONG_LENGTH = 4;
+
+        int bits = STRONG_HASH_BIAS + 2 * log2(fileSize) - log2(blockSize) - weakBits;
+        int bytes = (bits + 7) / 8;
+        return static_cast<uint8_t>(std::clamp<int>(bytes, MIN_STRONG_LENGTH, digestLength(algorithm)));
     }
 
+    // whether strongLength bytes alone keep a false match below 2^-STRONG_HASH_BIAS when a window
+    // is compared with one expected block at most candidates times, no weak hash needed first
+    static bool strongHashSuffices(uint8_t strongLength, uint64_t candidates) {
+        return 8 * strongLength >= STRONG_HASH_BIAS + log2(candidates) + 1;
+    }
+
+private:
+    static constexpr int STRONG_HASH_BIAS = 24;
+    static int log2(uint64_t v) { int bits = 0; while (v >>= 1) bits++; return bits; }
+
 };
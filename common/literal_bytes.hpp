@@ -0,0 +1,97 @@
+#pragma once
+#include <memory>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <cstdint>
+#include "mapped_file.hpp"
+
+// literal bytes of an INSERT: a view into storage it shares ownership of (a slab of received
+// literals, or the mapping of the source file), so instructions are copied, moved, merged and
+// returned without the bytes ever being copied. Bytes of a mapped file also remember where they
+// lie in it, the sender can then hand the range to the kernel instead of reading the mapping
+class LiteralBytes {
+public:
+    LiteralBytes() = default;
+    // len bytes at data, kept alive by owner
+    LiteralBytes(const std::shared_ptr<const void>& owner, const char* data, size_t len)
+        : bytes_(owner, data), size_(len) {}
+
+    // len bytes of a mapped file at offset, the mapping (and its fd) stays open while they live
+    static LiteralBytes fromFile(const std::shared_ptr<const MappedFile>& file, size_t offset, size_t len) {
+        LiteralBytes bytes(file, file->data() + offset, len);
+        bytes.fileFd_ = file->fd();
+        bytes.fileOffset_ = offset;
+        return bytes;
+    }
+
+    // bytes that have no owner yet get one allocation of their own
+    static LiteralBytes copyOf(const char* data, size_t len) {
+        std::shared_ptr<char[]> storage(new char[len]);
+        if (len > 0) std::memcpy(storage.get(), data, len);
+        const char* start = storage.get();
+        return LiteralBytes(std::move(storage), start, len);
+    }
+
+    const char* data() const { return bytes_.get(); }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const char* begin() const { return data(); }
+    const char* end() const { return data() + size_; }
+    // -1 unless the bytes are a range of a mapped file
+    int fileFd() const { return fileFd_; }
+    uint64_t fileOffset() const { return fileOffset_; }
+
+    // joins next onto these bytes, in place when it directly follows them in the same storage
+    // (literal runs of neighbouring source chunks), otherwise both are copied into a new buffer
+    void append(const LiteralBytes& next) {
+        if (next.empty()) return;
+        if (empty()) {
+            *this = next;
+            return;
+        }
+        if (end() == next.data() && !bytes_.owner_before(next.bytes_) && !next.bytes_.owner_before(bytes_)) {
+            size_ += next.size_;
+            return;
+        }
+        std::shared_ptr<char[]> storage(new char[size_ + next.size_]);
+        std::memcpy(storage.get(), data(), size_);
+        std::memcpy(storage.get() + size_, next.data(), next.size_);
+        const char* start = storage.get();
+        *this = LiteralBytes(std::move(storage), start, size_ + next.size_);
+    }
+
+private:
+    std::shared_ptr<const char> bytes_;   // aliases the owner, points at the first byte
+    size_t size_ = 0;
+    int fileFd_ = -1;
+    uint64_t fileOffset_ = 0;
+};
+
+// hands out room for received literals from big slabs, one allocation per SLAB_SIZE bytes
+// instead of one per insert. A literal longer than a slab gets an allocation of its own
+class LiteralArena {
+public:
+    static constexpr size_t SLAB_SIZE = 1024 * 1024;
+
+    // len writable bytes, literal is the view of them the instruction keeps
+    char* allocate(size_t len, LiteralBytes& literal) {
+        if (len > SLAB_SIZE) {
+            std::shared_ptr<char[]> own(new char[len]);
+            literal = LiteralBytes(own, own.get(), len);
+            return own.get();
+        }
+        if (!slab_ || len > SLAB_SIZE - used_) {
+            slab_.reset(new char[SLAB_SIZE]);
+            used_ = 0;
+        }
+        char* bytes = slab_.get() + used_;
+        used_ += len;
+        literal = LiteralBytes(slab_, bytes, len);
+        return bytes;
+    }
+
+private:
+    std::shared_ptr<char[]> slab_;
+    size_t used_ = 0;
+};
@@ -0,0 +1,103 @@
+#include "literal_codec.hpp"
+#include <algorithm>
+#include <iostream>
+
+LiteralCompressor::~LiteralCompressor() {
+    if (open_) deflateEnd(&stream_);
+}
+
+bool LiteralCompressor::init() {
+    if (deflateInit(&stream_, level_) != Z_OK) {
+        std::cerr << "[LiteralCompressor] deflateInit failed\n";
+        return false;
+    }
+    open_ = true;
+    return true;
+}
+
+bool LiteralCompressor::deflateInto(int flushMode, std::vector<uint8_t>& out) {
+    const size_t OUTPUT_STEP = 64 * 1024;
+    do {
+        size_t used = out.size();
+        out.resize(used + OUTPUT_STEP);
+        stream_.next_out = out.data() + used;
+        stream_.avail_out = OUTPUT_STEP;
+        int ret = deflate(&stream_, flushMode);
+        out.resize(out.size() - stream_.avail_out);
+        if (ret == Z_STREAM_ERROR) return false;
+        // Z_BUF_ERROR only means there was nothing left to do
+    } while (stream_.avail_out == 0 || stream_.avail_in > 0);
+    return true;
+}
+
+bool LiteralCompressor::append(const char* data, size_t len, std::vector<uint8_t>& out) {
+    // avail_in is 32 bit, feed big inserts in pieces
+    const size_t MAX_PIECE = 1u << 30;
+    while (len > 0) {
+        size_t piece = std::min(len, MAX_PIECE);
+        stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        stream_.avail_in = static_cast<uInt>(piece);
+        if (!deflateInto(Z_NO_FLUSH, out)) return false;
+        data += piece;
+        len -= piece;
+    }
+    return true;
+}
+
+bool LiteralCompressor::flush(std::vector<uint8_t>& out) {
+    stream_.next_in = nullptr;
+    stream_.avail_in = 0;
+    return deflateInto(Z_SYNC_FLUSH, out);
+}
+
+void LiteralCompressor::adapt(size_t inputBytes, double compressSeconds, double sendSeconds) {
+    if (inputBytes < MIN_ADAPT_BYTES) return;
+    int next = level_;
+    if (compressSeconds > sendSeconds) {
+        next = std::max(MIN_LEVEL, level_ - 1);       // compression holds the stream back
+    } else if (compressSeconds * 4 < sendSeconds) {
+        next = std::min(MAX_LEVEL, level_ + 1);       // plenty of time while waiting on the link
+    }
+    // right after a sync flush nothing is pending, so switching costs no extra output
+    if (next != level_ && deflateParams(&stream_, next, Z_DEFAULT_STRATEGY) == Z_OK) {
+        level_ = next;
+    }
+}
+
+LiteralDecompressor::~LiteralDecompressor() {
+    if (open_) inflateEnd(&stream_);
+}
+
+bool LiteralDecompressor::init() {
+    if (inflateInit(&stream_) != Z_OK) {
+        std::cerr << "[LiteralDecompressor] inflateInit failed\n";
+        return false;
+    }
+    open_ = true;
+    return true;
+}
+
+void LiteralDecompressor::setInput(const std::vector<uint8_t>& in) {
+    stream_.next_in = const_cast<Bytef*>(in.data());
+    stream_.avail_in = static_cast<uInt>(in.size());
+}
+
+bool LiteralDecompressor::read(char* out, size_t len) {
+    const size_t MAX_PIECE = 1u << 30;
+    while (len > 0) {
+        size_t piece = std::min(len, MAX_PIECE);
+        stream_.next_out = reinterpret_cast<Bytef*>(out);
+        stream_.avail_out = static_cast<uInt>(piece);
+        while (stream_.avail_out > 0) {
+            int ret = inflate(&stream_, Z_SYNC_FLUSH);
+            if (ret != Z_OK) {
+                // Z_BUF_ERROR here means the frame ended before its literals did
+                std::cerr << "[LiteralDecompressor] Corrupt literal stream\n";
+                return false;
+            }
+        }
+        out += piece;
+        len -= piece;
+    }
+    return true;
+}
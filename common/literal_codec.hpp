@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <zlib.h>
+
+// one deflate stream over all literal bytes of a transfer, so later inserts are compressed
+// against the earlier ones. Every frame ends with a sync flush and can be decoded as soon as it arrives
+class LiteralCompressor {
+public:
+    LiteralCompressor() = default;
+    ~LiteralCompressor();
+    LiteralCompressor(const LiteralCompressor&) = delete;
+    LiteralCompressor& operator=(const LiteralCompressor&) = delete;
+
+    bool init();
+    bool isOpen() const { return open_; }
+
+    // compressed bytes are appended to out
+    bool append(const char* data, size_t len, std::vector<uint8_t>& out);
+    bool flush(std::vector<uint8_t>& out);
+
+    // called once per frame with the time spent compressing it and sending it
+    // the level goes up while the link is the bottleneck and down once compression is
+    void adapt(size_t inputBytes, double compressSeconds, double sendSeconds);
+    int level() const { return level_; }
+
+private:
+    bool deflateInto(int flushMode, std::vector<uint8_t>& out);
+
+    static constexpr int MIN_LEVEL = 1;
+    static constexpr int MAX_LEVEL = 9;
+    static constexpr size_t MIN_ADAPT_BYTES = 64 * 1024;   // smaller frames are too noisy to judge
+
+    z_stream stream_{};
+    bool open_ = false;
+    int level_ = 6;
+};
+
+class LiteralDecompressor {
+public:
+    LiteralDecompressor() = default;
+    ~LiteralDecompressor();
+    LiteralDecompressor(const LiteralDecompressor&) = delete;
+    LiteralDecompressor& operator=(const LiteralDecompressor&) = delete;
+
+    bool init();
+    bool isOpen() const { return open_; }
+
+    // compressed literals of one frame, then read() them back insert by insert
+    void setInput(const std::vector<uint8_t>& in);
+    bool read(char* out, size_t len);
+    // true once the whole input of the frame was used up
+    bool inputConsumed() const { return stream_.avail_in == 0; }
+
+private:
+    z_stream stream_{};
+    bool open_ = false;
+};
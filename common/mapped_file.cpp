@@ -0,0 +1,67 @@
+#include "mapped_file.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <algorithm>
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : fd_(std::exchange(other.fd_, -1)), data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)) {}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        close();
+        fd_ = std::exchange(other.fd_, -1);
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+    }
+    return *this;
+}
+
+bool MappedFile::open(const std::string& path) {
+    close();
+    fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) return false;
+
+    struct stat st{};
+    if (fstat(fd_, &st) < 0) {
+        close();
+        return false;
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ == 0) return true;  // mmap does not accept zero length
+
+    void* ptr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (ptr == MAP_FAILED) {
+        close();
+        return false;
+    }
+    data_ = static_cast<char*>(ptr);
+    return true;
+}
+
+void MappedFile::close() {
+    if (data_) munmap(data_, size_);
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+    data_ = nullptr;
+    size_ = 0;
+}
+
+void MappedFile::adviseSequential() const {
+    if (data_) madvise(data_, size_, MADV_SEQUENTIAL);
+}
+
+void MappedFile::adviseWillNeed(size_t offset, size_t length) const {
+    if (!data_ || offset >= size_) return;
+    // madvise wants a page aligned start
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t alignedStart = offset - offset % pageSize;
+    size_t end = std::min(offset + length, size_);
+    madvise(data_ + alignedStart, end - alignedStart, MADV_WILLNEED);
+}
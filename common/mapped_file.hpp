@@ -0,0 +1,32 @@
+#pragma once
+#include <string>
+#include <cstddef>
+
+// read only mapping of a complete file
+// an empty file is valid and maps to nothing (data() is nullptr)
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    bool open(const std::string& path);
+    void close();
+
+    // madvise hints, offset and length need not be page aligned
+    void adviseSequential() const;
+    void adviseWillNeed(size_t offset, size_t length) const;
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    int fd() const { return fd_; }
+    bool isOpen() const { return fd_ >= 0; }
+
+private:
+    int fd_ = -1;
+    char* data_ = nullptr;
+    size_t size_ = 0;
+};
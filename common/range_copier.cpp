@@ -0,0 +1,88 @@
+#include "range_copier.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+RangeCopier::RangeCopier(int inFd, int outFd) : inFd_(inFd), outFd_(outFd) {
+    struct stat st;
+    if (fstat(inFd_, &st) == 0) inSize_ = st.st_size;
+    if (fstat(outFd_, &st) == 0 && st.st_blksize > 0) cloneAlign_ = st.st_blksize;
+}
+
+bool RangeCopier::copy(uint64_t inOffset, uint64_t outOffset, uint64_t length) {
+    // a clone needs both offsets block aligned, so only the middle of a range whose offsets are
+    // equally misaligned can be cloned, the unaligned head and tail are copied
+    if (canClone_ && inOffset % cloneAlign_ == outOffset % cloneAlign_) {
+        uint64_t head = std::min(length, (cloneAlign_ - outOffset % cloneAlign_) % cloneAlign_);
+        uint64_t middle = (length - head) / cloneAlign_ * cloneAlign_;
+        // the last block of the source may be partial, it still clones when the range runs to its end
+        if (inOffset + length == inSize_) middle = length - head;
+        if (middle > 0) {
+            if (head > 0 && !copyInKernel(inOffset, outOffset, head)) return false;
+            if (clone(inOffset + head, outOffset + head, middle)) {
+                uint64_t done = head + middle;
+                return done == length || copyInKernel(inOffset + done, outOffset + done, length - done);
+            }
+            inOffset += head;
+            outOffset += head;
+            length -= head;
+        }
+    }
+    return copyInKernel(inOffset, outOffset, length);
+}
+
+bool RangeCopier::clone(uint64_t inOffset, uint64_t outOffset, uint64_t length) {
+    file_clone_range range{};
+    range.src_fd = inFd_;
+    range.src_offset = inOffset;
+    range.src_length = length;
+    range.dest_offset = outOffset;
+    if (ioctl(outFd_, FICLONERANGE, &range) == 0) {
+        clonedBytes_ += length;
+        return true;
+    }
+    // EINVAL can be a one off alignment problem, anything else means this filesystem can not clone
+    if (errno != EINVAL) canClone_ = false;
+    return false;
+}
+
+bool RangeCopier::copyInKernel(uint64_t inOffset, uint64_t outOffset, uint64_t length) {
+    while (canCopyInKernel_ && length > 0) {
+        loff_t in = inOffset, out = outOffset;
+        ssize_t copied = copy_file_range(inFd_, &in, outFd_, &out, length, 0);
+        if (copied < 0 && errno == EINTR) continue;
+        if (copied <= 0) {
+            // not supported here (other filesystem, old kernel), or the source ended early
+            if (copied < 0) canCopyInKernel_ = false;
+            break;
+        }
+        inOffset += copied;
+        outOffset += copied;
+        length -= copied;
+    }
+    return length == 0 || copyThroughBuffer(inOffset, outOffset, length);
+}
+
+bool RangeCopier::copyThroughBuffer(uint64_t inOffset, uint64_t outOffset, uint64_t length) {
+    if (buffer_.empty()) buffer_.resize(BUFFER_SIZE);
+    while (length > 0) {
+        ssize_t got = pread(inFd_, buffer_.data(), std::min<uint64_t>(length, buffer_.size()), inOffset);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;   // the range runs past the end of the old file
+
+        for (ssize_t written = 0; written < got; ) {
+            ssize_t put = pwrite(outFd_, buffer_.data() + written, got - written, outOffset + written);
+            if (put < 0 && errno == EINTR) continue;
+            if (put <= 0) return false;
+            written += put;
+        }
+        inOffset += got;
+        outOffset += got;
+        length -= got;
+    }
+    return true;
+}
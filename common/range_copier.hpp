@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// copies byte ranges between two open files with the cheapest method the filesystem offers:
+// reflink (FICLONERANGE) shares the extents and moves no data (XFS, Btrfs), copy_file_range
+// copies inside the kernel, and plain pread/pwrite through one large buffer works everywhere.
+// A method the filesystem rejects once is not tried again
+class RangeCopier {
+public:
+    RangeCopier(int inFd, int outFd);
+
+    bool copy(uint64_t inOffset, uint64_t outOffset, uint64_t length);
+
+    uint64_t clonedBytes() const { return clonedBytes_; }
+
+private:
+    bool clone(uint64_t inOffset, uint64_t outOffset, uint64_t length);
+    bool copyInKernel(uint64_t inOffset, uint64_t outOffset, uint64_t length);
+    bool copyThroughBuffer(uint64_t inOffset, uint64_t outOffset, uint64_t length);
+
+    static constexpr size_t BUFFER_SIZE = 1024 * 1024;
+
+    int inFd_;
+    int outFd_;
+    uint64_t inSize_ = 0;
+    uint64_t cloneAlign_ = 4096;   // filesystem block size, clones must be aligned to it
+    bool canClone_ = true;
+    bool canCopyInKernel_ = true;
+    uint64_t clonedBytes_ = 0;
+    std::vector<char> buffer_;
+};
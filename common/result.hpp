@@ -1,6 +1,7 @@
 // Result.hpp
 #pragma once
 #include <string>
+#include <utility>
 
 template<typename T>
 struct Result {
@@ -12,6 +13,10 @@ struct Result {
         return {true, "", data};
     }
 
+    static Result<T> Ok(T&& data) {
+        return {true, "", std::move(data)};
+    }
+
     static Result<T> Error(const std::string& msg) {
         return {false, msg, T{}};
     }
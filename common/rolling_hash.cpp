@@ -0,0 +1,305 @@
+#include "rolling_hash.hpp"
+#include "hash_utils.hpp"
+#include "cpu_features.hpp"
+#include <cstring>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace {
+constexpr uint64_t BASE = HashUtils::WEAK_HASH_BASE;
+constexpr uint64_t MOD = HashUtils::WEAK_HASH_MOD;
+
+uint64_t loadU64(const uint8_t* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+}
+
+RollingHash::RollingHash(size_t window) : window_(window) {
+    uint64_t power = 1;
+    for (size_t i = 0; i < window; ++i) power = power * BASE % MOD;
+    leaving_ = static_cast<uint32_t>((MOD - power) % MOD);
+    uint64_t segmentPower = 1;
+    for (size_t i = 0; i < window / LANES; ++i) segmentPower = segmentPower * BASE % MOD;
+    segmentPower_ = static_cast<uint32_t>(segmentPower);
+    for (uint64_t byte = 0; byte < 256; ++byte) {
+        leavingTerm_[byte] = static_cast<uint32_t>(byte * leaving_ % MOD);
+    }
+}
+
+void RollingHash::hashWindows(const char* data, size_t count, uint32_t* out) const {
+    if (count == 0) return;
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+
+    // LANES equal stretches, the positions past them continue the last lane. A stretch is an odd
+    // number of cache lines long, lanes a power of two apart would all hit the same cache sets
+    size_t laneLength = count / LANES;
+    if (laneLength >= 128) laneLength = (laneLength & ~size_t(127)) - 64;
+    size_t done = 0;
+    uint64_t hash;
+    if (laneLength > 0) {
+        if (CpuFeatures::avx2()) {
+            hashLanesAvx2(bytes, laneLength, out);
+        } else {
+            hashLanesScalar(bytes, laneLength, out);
+        }
+        done = LANES * laneLength;
+        hash = out[done - 1];
+    } else {
+        hash = HashUtils::computeWeakHash(data, window_);
+        out[0] = static_cast<uint32_t>(hash);
+        done = 1;
+    }
+    for (size_t i = done; i < count; ++i) {
+        hash = (hash * BASE + bytes[i - 1 + window_] + leavingTerm_[bytes[i - 1]]) % MOD;
+        out[i] = static_cast<uint32_t>(hash);
+    }
+}
+
+void RollingHash::hashBlocks(const char* data, size_t count, uint32_t* out) const {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    const size_t groups = count / LANES;
+    if (CpuFeatures::avx2()) {
+        hashBlocksAvx2(bytes, groups, out);
+    } else {
+        for (size_t g = 0; g < groups; ++g) {
+            uint64_t hash[LANES];
+            firstWindowsScalar(bytes + g * LANES * window_, window_, window_, hash);
+            for (size_t k = 0; k < LANES; ++k) out[g * LANES + k] = static_cast<uint32_t>(hash[k]);
+        }
+    }
+    for (size_t b = groups * LANES; b < count; ++b) out[b] = HashUtils::computeWeakHash(data + b * window_, window_);
+}
+
+// the window is LANES segments and a tail shorter than one, hash = hash*base^segment + segment hash
+uint32_t RollingHash::hash(const char* data) const {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    const size_t segment = window_ / LANES;
+    if (segment == 0) return HashUtils::computeWeakHash(data, window_);
+
+    uint32_t segments[LANES];
+    if (CpuFeatures::avx2()) {
+        hashSegmentsAvx2(bytes, segment, segments);
+    } else {
+        uint64_t lanes[LANES];
+        firstWindowsScalar(bytes, segment, segment, lanes);
+        for (size_t k = 0; k < LANES; ++k) segments[k] = static_cast<uint32_t>(lanes[k]);
+    }
+    uint64_t hash = 0;
+    for (size_t k = 0; k < LANES; ++k) hash = (hash * segmentPower_ + segments[k]) % MOD;
+    for (size_t i = LANES * segment; i < window_; ++i) hash = (hash * BASE + bytes[i]) % MOD;
+    return static_cast<uint32_t>(hash);
+}
+
+// hash of the window at the start of every lane, bytes only enter
+void RollingHash::firstWindowsScalar(const uint8_t* data, size_t laneLength, size_t window, uint64_t* hash) const {
+    for (size_t k = 0; k < LANES; ++k) hash[k] = 0;
+    for (size_t j = 0; j < window; ++j) {
+        for (size_t k = 0; k < LANES; ++k) {
+            hash[k] = (hash[k] * BASE + data[k * laneLength + j]) % MOD;
+        }
+    }
+}
+
+// lane k covers positions [k*laneLength, (k+1)*laneLength)
+void RollingHash::hashLanesScalar(const uint8_t* data, size_t laneLength, uint32_t* out) const {
+    uint64_t hash[LANES];
+    firstWindowsScalar(data, laneLength, window_, hash);
+    for (size_t k = 0; k < LANES; ++k) out[k * laneLength] = static_cast<uint32_t>(hash[k]);
+
+    for (size_t t = 1; t < laneLength; ++t) {
+        for (size_t k = 0; k < LANES; ++k) {
+            const uint8_t* gone = data + k * laneLength + t - 1;
+            hash[k] = (hash[k] * BASE + gone[window_] + leavingTerm_[*gone]) % MOD;
+            out[k * laneLength + t] = static_cast<uint32_t>(hash[k]);
+        }
+    }
+}
+
+#if defined(__x86_64__)
+namespace {
+constexpr size_t REGISTERS = RollingHash::LANES / 4;
+// floor(2^61 / MOD), fits in 32 bits so the quotient estimate is a single 32x32 multiply
+constexpr uint64_t BARRETT = (uint64_t(1) << 61) / MOD;
+
+// hash = hash*257 + in + gone*leaving mod p on four 64 bit lanes, only partly reduced: hash stays
+// below 3p, x below 2^40, and q = ((x >> 29) * BARRETT) >> 32 undershoots x/p by less than 2.
+// the two conditional subtractions that finish the reduction are left to reduce()
+__attribute__((target("avx2")))
+inline __m256i rollStep(__m256i hash, __m256i in, __m256i gone, __m256i leaving) {
+    const __m256i mod = _mm256_set1_epi64x(MOD);
+    const __m256i barrett = _mm256_set1_epi64x(BARRETT);
+
+    __m256i x = _mm256_add_epi64(_mm256_slli_epi64(hash, 8), hash);
+    x = _mm256_add_epi64(x, _mm256_add_epi64(in, _mm256_mul_epu32(gone, leaving)));
+    __m256i q = _mm256_srli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(x, 29), barrett), 32);
+    return _mm256_sub_epi64(x, _mm256_mul_epu32(q, mod));
+}
+
+__attribute__((target("avx2")))
+inline __m256i reduce(__m256i x) {
+    const __m256i mod = _mm256_set1_epi64x(MOD);
+    const __m256i modMinusOne = _mm256_set1_epi64x(MOD - 1);
+    x = _mm256_sub_epi64(x, _mm256_and_si256(_mm256_cmpgt_epi64(x, modMinusOne), mod));
+    return _mm256_sub_epi64(x, _mm256_and_si256(_mm256_cmpgt_epi64(x, modMinusOne), mod));
+}
+
+// bytes at offset of lanes first..first+3, eight consecutive ones per 64 bit lane
+__attribute__((target("avx2")))
+inline __m256i gatherBytes(const uint8_t* data, size_t laneLength, size_t first, size_t offset) {
+    return _mm256_set_epi64x(loadU64(data + (first + 3) * laneLength + offset),
+                             loadU64(data + (first + 2) * laneLength + offset),
+                             loadU64(data + (first + 1) * laneLength + offset),
+                             loadU64(data + first * laneLength + offset));
+}
+
+__attribute__((target("avx2")))
+inline __m256i gatherByte(const uint8_t* data, size_t laneLength, size_t first, size_t offset) {
+    return _mm256_set_epi64x(data[(first + 3) * laneLength + offset], data[(first + 2) * laneLength + offset],
+                             data[(first + 1) * laneLength + offset], data[first * laneLength + offset]);
+}
+
+// eight steps of four lanes, steps[b] holds the partly reduced hashes of step b in its 64 bit lanes.
+// Packed two steps per 64 bits and transposed, each lane gets its eight hashes in one 32 byte store
+__attribute__((target("avx2")))
+inline void storeSteps(const __m256i* steps, uint32_t* out, size_t laneLength, size_t first, size_t t) {
+    __m256i pairs[4];
+#pragma GCC unroll 4
+    for (int i = 0; i < 4; ++i) {
+        pairs[i] = _mm256_or_si256(steps[2 * i], _mm256_slli_epi64(steps[2 * i + 1], 32));
+    }
+    __m256i evenLow = _mm256_unpacklo_epi64(pairs[0], pairs[1]), oddLow = _mm256_unpackhi_epi64(pairs[0], pairs[1]);
+    __m256i evenHigh = _mm256_unpacklo_epi64(pairs[2], pairs[3]), oddHigh = _mm256_unpackhi_epi64(pairs[2], pairs[3]);
+    __m256i lanes[4] = {
+        _mm256_permute2x128_si256(evenLow, evenHigh, 0x20), _mm256_permute2x128_si256(oddLow, oddHigh, 0x20),
+        _mm256_permute2x128_si256(evenLow, evenHigh, 0x31), _mm256_permute2x128_si256(oddLow, oddHigh, 0x31),
+    };
+    // below 3p fits 32 bits, min(x, x-p) is x-p exactly when x >= p
+    const __m256i mod = _mm256_set1_epi32(MOD);
+#pragma GCC unroll 4
+    for (int k = 0; k < 4; ++k) {
+        __m256i x = _mm256_min_epu32(lanes[k], _mm256_sub_epi32(lanes[k], mod));
+        x = _mm256_min_epu32(x, _mm256_sub_epi32(x, mod));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + (first + k) * laneLength + t), x);
+    }
+}
+
+// hashes of position t of all lanes
+__attribute__((target("avx2")))
+inline void storeLanes(const __m256i* hash, uint32_t* out, size_t laneLength, size_t t) {
+    alignas(32) uint64_t lanes[RollingHash::LANES];
+    for (size_t r = 0; r < REGISTERS; ++r) {
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes + 4 * r), reduce(hash[r]));
+    }
+    for (size_t k = 0; k < RollingHash::LANES; ++k) out[k * laneLength + t] = static_cast<uint32_t>(lanes[k]);
+}
+
+// hash of the window at the start of every lane, bytes only enter
+__attribute__((target("avx2")))
+inline void firstWindows(const uint8_t* data, size_t laneLength, size_t window, __m256i* hash) {
+    const __m256i byteMask = _mm256_set1_epi64x(0xFF);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i in[REGISTERS];
+    #pragma GCC unroll 8
+    for (size_t r = 0; r < REGISTERS; ++r) hash[r] = zero;
+
+    size_t j = 0;
+    for (; j + 8 <= window; j += 8) {
+        #pragma GCC unroll 8
+        for (size_t r = 0; r < REGISTERS; ++r) in[r] = gatherBytes(data, laneLength, 4 * r, j);
+        #pragma GCC unroll 8
+        for (int b = 0; b < 8; ++b) {
+            #pragma GCC unroll 8
+            for (size_t r = 0; r < REGISTERS; ++r) {
+                hash[r] = rollStep(hash[r], _mm256_and_si256(in[r], byteMask), zero, zero);
+                in[r] = _mm256_srli_epi64(in[r], 8);
+            }
+        }
+    }
+    for (; j < window; ++j) {
+        #pragma GCC unroll 8
+        for (size_t r = 0; r < REGISTERS; ++r) {
+            hash[r] = rollStep(hash[r], gatherByte(data, laneLength, 4 * r, j), zero, zero);
+        }
+    }
+}
+}
+
+// lanes are LANES consecutive blocks
+__attribute__((target("avx2")))
+void RollingHash::hashBlocksAvx2(const uint8_t* data, size_t groups, uint32_t* out) const {
+    __m256i hash[REGISTERS];
+    for (size_t g = 0; g < groups; ++g) {
+        firstWindows(data + g * LANES * window_, window_, window_, hash);
+        storeLanes(hash, out + g * LANES, 1, 0);
+    }
+}
+
+__attribute__((target("avx2")))
+void RollingHash::hashSegmentsAvx2(const uint8_t* data, size_t segment, uint32_t* out) const {
+    __m256i hash[REGISTERS];
+    firstWindows(data, segment, segment, hash);
+    storeLanes(hash, out, 1, 0);
+}
+
+// four lanes per register. Bytes are loaded eight steps at a time per lane and shifted out one per step
+__attribute__((target("avx2")))
+void RollingHash::hashLanesAvx2(const uint8_t* data, size_t laneLength, uint32_t* out) const {
+    const __m256i byteMask = _mm256_set1_epi64x(0xFF);
+    const __m256i leaving = _mm256_set1_epi64x(leaving_);
+    __m256i hash[REGISTERS], in[REGISTERS], gone[REGISTERS], steps[REGISTERS][8];
+
+    firstWindows(data, laneLength, window_, hash);
+    storeLanes(hash, out, laneLength, 0);
+
+    // step t enters byte t-1+window and drops byte t-1 of the lane
+    size_t t = 1;
+    for (; t + 8 <= laneLength; t += 8) {
+        #pragma GCC unroll 8
+        for (size_t r = 0; r < REGISTERS; ++r) {
+            in[r] = gatherBytes(data, laneLength, 4 * r, t - 1 + window_);
+            gone[r] = gatherBytes(data, laneLength, 4 * r, t - 1);
+        }
+        #pragma GCC unroll 8
+        for (int b = 0; b < 8; ++b) {
+            #pragma GCC unroll 8
+            for (size_t r = 0; r < REGISTERS; ++r) {
+                hash[r] = rollStep(hash[r], _mm256_and_si256(in[r], byteMask), _mm256_and_si256(gone[r], byteMask), leaving);
+                steps[r][b] = hash[r];
+                in[r] = _mm256_srli_epi64(in[r], 8);
+                gone[r] = _mm256_srli_epi64(gone[r], 8);
+            }
+        }
+        #pragma GCC unroll 8
+        for (size_t r = 0; r < REGISTERS; ++r) storeSteps(steps[r], out, laneLength, 4 * r, t);
+    }
+    for (; t < laneLength; ++t) {
+        #pragma GCC unroll 8
+        for (size_t r = 0; r < REGISTERS; ++r) {
+            hash[r] = rollStep(hash[r], gatherByte(data, laneLength, 4 * r, t - 1 + window_),
+                               gatherByte(data, laneLength, 4 * r, t - 1), leaving);
+        }
+        storeLanes(hash, out, laneLength, t);
+    }
+}
+#else
+void RollingHash::hashLanesAvx2(const uint8_t* data, size_t laneLength, uint32_t* out) const {
+    hashLanesScalar(data, laneLength, out);
+}
+
+void RollingHash::hashBlocksAvx2(const uint8_t* data, size_t groups, uint32_t* out) const {
+    for (size_t g = 0; g < groups; ++g) {
+        uint64_t hash[LANES];
+        firstWindowsScalar(data + g * LANES * window_, window_, window_, hash);
+        for (size_t k = 0; k < LANES; ++k) out[g * LANES + k] = static_cast<uint32_t>(hash[k]);
+    }
+}
+
+void RollingHash::hashSegmentsAvx2(const uint8_t* data, size_t segment, uint32_t* out) const {
+    uint64_t hash[LANES];
+    firstWindowsScalar(data, segment, segment, hash);
+    for (size_t k = 0; k < LANES; ++k) out[k] = static_cast<uint32_t>(hash[k]);
+}
+#endif
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// weak hashes of every window position of a buffer in one pass, the same values
+// HashUtils::computeWeakHash gives each window on its own.
+// the buffer is cut into LANES stretches that are rolled side by side, so the modular reductions
+// of different stretches overlap instead of forming one long dependency chain per byte.
+// the AVX2 kernel keeps the lanes in vector registers and is picked at runtime when the cpu has it,
+// otherwise a scalar kernel interleaves them
+class RollingHash {
+public:
+    static constexpr size_t LANES = 8;
+
+    explicit RollingHash(size_t window);
+
+    // out[i] = weak hash of data[i, i+window) for i < count, data holds count-1+window bytes
+    void hashWindows(const char* data, size_t count, uint32_t* out) const;
+    // out[b] = weak hash of block data[b*window, (b+1)*window) for b < count, LANES blocks at a time
+    void hashBlocks(const char* data, size_t count, uint32_t* out) const;
+    // weak hash of the one window at data, its LANES segments are hashed side by side
+    uint32_t hash(const char* data) const;
+    size_t window() const { return window_; }
+
+private:
+    void hashLanesScalar(const uint8_t* data, size_t laneLength, uint32_t* out) const;
+    void hashLanesAvx2(const uint8_t* data, size_t laneLength, uint32_t* out) const;
+    void firstWindowsScalar(const uint8_t* data, size_t laneLength, size_t window, uint64_t* hash) const;
+    void hashBlocksAvx2(const uint8_t* data, size_t groups, uint32_t* out) const;
+    void hashSegmentsAvx2(const uint8_t* data, size_t segment, uint32_t* out) const;
+
+    size_t window_;
+    uint32_t leaving_;       // -(base^window) mod p, a byte leaving the window takes byte*leaving_ along
+    uint32_t segmentPower_;  // base^(window/LANES) mod p, joins the segment hashes of hash()
+    uint32_t leavingTerm_[256];
+};
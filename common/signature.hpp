@@ -0,0 +1,32 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include "block_info.hpp"
+#include "transfer_options.hpp"
+#include "hash_utils.hpp"
+#include "weak_hash.hpp"
+
+// describes how the blocks of a signature were cut, the source has to cut its file the same way
+struct SignatureHeader {
+    ChunkingMode chunking = ChunkingMode::FIXED;
+    uint32_t blockSize = 0;      // FIXED: block size, CDC: target average chunk size
+    uint32_t minChunkSize = 0;   // CDC only
+    uint32_t maxChunkSize = 0;   // CDC only
+    uint64_t fileSize = 0;       // fixed blocks follow from it, the last one may be short
+    WeakHashAlgorithm weakHashAlgorithm = WeakHashAlgorithm::POLYNOMIAL;   // FIXED only
+    StrongHashAlgorithm strongHashAlgorithm = HashUtils::STRONG_HASH_ALGORITHM;
+    uint8_t strongLength = StrongHash::MAX_LENGTH;   // bytes of every block's strong hash
+};
+
+struct Signature {
+    SignatureHeader header;
+    std::vector<BlockInfo> blocks;
+};
+
+// takes a signature while it is produced or received: the header with the block count first,
+// then the blocks in file order, a batch at a time. Returning false stops the producer
+struct SignatureSink {
+    std::function<bool(const SignatureHeader& header, size_t blockCount)> header;
+    std::function<bool(const BlockInfo* blocks, size_t count)> blocks;
+};
@@ -0,0 +1,196 @@
+#include "signature_cache.hpp"
+#include "hash_utils.hpp"
+#include "mapped_file.hpp"
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <filesystem>
+#include <thread>
+#include <functional>
+#include <algorithm>
+
+namespace {
+    // on disk layout, native byte order since the cache never leaves the machine
+    //   header, then blockCount records of [weakHash][strongLength digest bytes]
+    // offsets are implicit (i * blockSize), records are fixed width so the file can be mapped
+    constexpr char ENTRY_MAGIC[4] = {'F', 'S', 'S', 'C'};
+    constexpr uint32_t ENTRY_VERSION = 1;
+
+    struct EntryHeader {
+        char magic[4];
+        uint32_t version;
+        uint64_t device;
+        uint64_t inode;
+        uint64_t size;
+        uint64_t mtimeNs;
+        uint32_t blockSize;
+        uint32_t hashAlgorithm;
+        uint32_t strongLength;
+        uint32_t weakHashAlgorithm;   // was reserved (0), which is the polynomial hash older entries use
+        uint64_t blockCount;
+    };
+}
+
+static uint64_t nanoseconds(const struct timespec& time) {
+    return static_cast<uint64_t>(time.tv_sec) * 1000000000ull + time.tv_nsec;
+}
+
+static void fillIdentity(const struct stat& st, FileIdentity& identity) {
+    identity.device = st.st_dev;
+    identity.inode = st.st_ino;
+    identity.size = st.st_size;
+    identity.mtimeNs = nanoseconds(st.st_mtim);
+}
+
+// git's racily clean rule: an entry only speaks for the file when the file's mtime is strictly
+// older than the entry, a rewrite of the same size within the same timestamp tick would keep the
+// identity. An mtime without a fraction of a second comes from a filesystem that keeps whole
+// seconds (or two, FAT), its tick is that long
+static bool olderThan(uint64_t mtimeNs, uint64_t entryNs) {
+    const uint64_t tick = mtimeNs % 1000000000ull == 0 ? 2000000000ull : 1;
+    return mtimeNs + tick <= entryNs;
+}
+
+bool SignatureCache::enabled() {
+    return !cacheDirectory().empty();
+}
+
+bool SignatureCache::identify(int fd, FileIdentity& identity) {
+    struct stat st{};
+    if (fstat(fd, &st) < 0) return false;
+    fillIdentity(st, identity);
+    return true;
+}
+
+bool SignatureCache::identify(const std::string& path, FileIdentity& identity) {
+    struct stat st{};
+    if (stat(path.c_str(), &st) < 0) return false;
+    fillIdentity(st, identity);
+    return true;
+}
+
+std::string SignatureCache::cacheDirectory() {
+    if (const char* dir = std::getenv("FILESYNC_CACHE_DIR")) return dir;
+    if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg) return std::string(xdg) + "/filesync";
+    if (const char* home = std::getenv("HOME"); home && *home) return std::string(home) + "/.cache/filesync";
+    return "";
+}
+
+std::string SignatureCache::entryPath(const FileIdentity& identity) {
+    std::string dir = cacheDirectory();
+    if (dir.empty()) return "";
+    char name[64];
+    std::snprintf(name, sizeof(name), "/%llx-%llx.sig",
+                  static_cast<unsigned long long>(identity.device), static_cast<unsigned long long>(identity.inode));
+    return dir + name;
+}
+
+bool SignatureCache::load(const FileIdentity& identity, size_t blockSize, WeakHashAlgorithm weakHash,
+                          StrongHashAlgorithm strongHash, std::vector<BlockInfo>& blocks) {
+    std::string path = entryPath(identity);
+    if (path.empty()) return false;
+
+    MappedFile entry;
+    if (!entry.open(path) || entry.size() < sizeof(EntryHeader)) return false;
+    struct stat written{};
+    if (fstat(entry.fd(), &written) < 0 || !olderThan(identity.mtimeNs, nanoseconds(written.st_mtim))) return false;
+
+    EntryHeader header;
+    std::memcpy(&header, entry.data(), sizeof(header));
+    if (std::memcmp(header.magic, ENTRY_MAGIC, sizeof(ENTRY_MAGIC)) != 0 || header.version != ENTRY_VERSION) return false;
+    if (header.device != identity.device || header.inode != identity.inode ||
+        header.size != identity.size || header.mtimeNs != identity.mtimeNs) return false;
+    if (header.blockSize != blockSize || header.hashAlgorithm != static_cast<uint32_t>(strongHash) ||
+        header.weakHashAlgorithm != static_cast<uint32_t>(weakHash)) return false;
+    if (header.strongLength == 0 || header.strongLength > HashUtils::digestLength(strongHash)) return false;
+
+    const size_t recordSize = sizeof(uint32_t) + header.strongLength;
+    const uint64_t expectedBlocks = (identity.size + blockSize - 1) / blockSize;
+    if (header.blockCount != expectedBlocks || entry.size() != sizeof(EntryHeader) + header.blockCount * recordSize) return false;
+
+    blocks.resize(header.blockCount);
+    const char* record = entry.data() + sizeof(EntryHeader);
+    for (uint64_t i = 0; i < header.blockCount; ++i, record += recordSize) {
+        blocks[i].offset = i * blockSize;
+        blocks[i].length = std::min<uint64_t>(blockSize, identity.size - blocks[i].offset);
+        std::memcpy(&blocks[i].weakHash, record, sizeof(uint32_t));
+        blocks[i].strongHash.length = static_cast<uint8_t>(header.strongLength);
+        std::memcpy(blocks[i].strongHash.bytes, record + sizeof(uint32_t), header.strongLength);
+    }
+    return true;
+}
+
+// written to a private temp file and renamed over the entry, readers never see a partial entry.
+// A file modified too recently is not cached, its next sync hashes it again
+bool SignatureCache::store(const FileIdentity& identity, size_t blockSize, WeakHashAlgorithm weakHash,
+                           StrongHashAlgorithm strongHash, const std::vector<BlockInfo>& blocks) {
+    std::string path = entryPath(identity);
+    if (path.empty()) return false;
+    struct timespec now{};
+    if (clock_gettime(CLOCK_REALTIME, &now) < 0 || !olderThan(identity.mtimeNs, nanoseconds(now))) return false;
+
+    uint32_t strongLength = blocks.empty() ? HashUtils::digestLength(strongHash) : blocks.front().strongHash.length;
+    for (const BlockInfo& b : blocks) {
+        if (b.strongHash.length != strongLength) return false;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(cacheDirectory(), ec);
+    if (ec) return false;
+
+    EntryHeader header{};
+    std::memcpy(header.magic, ENTRY_MAGIC, sizeof(ENTRY_MAGIC));
+    header.version = ENTRY_VERSION;
+    header.device = identity.device;
+    header.inode = identity.inode;
+    header.size = identity.size;
+    header.mtimeNs = identity.mtimeNs;
+    header.blockSize = static_cast<uint32_t>(blockSize);
+    header.hashAlgorithm = static_cast<uint32_t>(strongHash);
+    header.weakHashAlgorithm = static_cast<uint32_t>(weakHash);
+    header.strongLength = strongLength;
+    header.blockCount = blocks.size();
+
+    std::string tempPath = path + ".tmp." + std::to_string(getpid()) + "." +
+                           std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+
+        std::vector<char> records(blocks.size() * (sizeof(uint32_t) + strongLength));
+        char* record = records.data();
+        for (const BlockInfo& b : blocks) {
+            std::memcpy(record, &b.weakHash, sizeof(uint32_t));
+            std::memcpy(record + sizeof(uint32_t), b.strongHash.bytes, strongLength);
+            record += sizeof(uint32_t) + strongLength;
+        }
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(records.data(), records.size());
+        if (!out) {
+            out.close();
+            std::remove(tempPath.c_str());
+            return false;
+        }
+    }
+    // what load compares with is the entry's own mtime, on the cache's filesystem
+    struct stat written{};
+    if (stat(tempPath.c_str(), &written) < 0 || !olderThan(identity.mtimeNs, nanoseconds(written.st_mtim))) {
+        std::remove(tempPath.c_str());
+        return false;
+    }
+
+    if (std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        std::remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+void SignatureCache::invalidate(const FileIdentity& identity) {
+    std::string path = entryPath(identity);
+    if (!path.empty()) std::remove(path.c_str());
+}
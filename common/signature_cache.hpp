@@ -0,0 +1,43 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "block_info.hpp"
+#include "weak_hash.hpp"
+#include "hash_utils.hpp"
+
+// identity of a file as seen by the cache, any change of content changes one of these
+struct FileIdentity {
+    uint64_t device = 0;
+    uint64_t inode = 0;
+    uint64_t size = 0;
+    uint64_t mtimeNs = 0;
+
+    bool operator==(const FileIdentity& other) const {
+        return device == other.device && inode == other.inode && size == other.size && mtimeNs == other.mtimeNs;
+    }
+    bool operator!=(const FileIdentity& other) const { return !(*this == other); }
+};
+
+// persistent store of block signatures so an unchanged basis file is never hashed twice
+// entries live in one central directory ($FILESYNC_CACHE_DIR, else $XDG_CACHE_HOME/filesync,
+// else ~/.cache/filesync), one file per (device,inode). An entry only hits when size, mtime,
+// block size and hash algorithms all match, and only when the file's mtime is older than the entry
+// (a rewrite within the same timestamp tick keeps size and mtime). Setting FILESYNC_CACHE_DIR to
+// "" disables the cache.
+// all operations are best effort, a failure simply means a miss
+class SignatureCache {
+public:
+    static bool enabled();
+    static bool identify(int fd, FileIdentity& identity);
+    static bool identify(const std::string& path, FileIdentity& identity);
+    static bool load(const FileIdentity& identity, size_t blockSize, WeakHashAlgorithm weakHash,
+                     StrongHashAlgorithm strongHash, std::vector<BlockInfo>& blocks);
+    static bool store(const FileIdentity& identity, size_t blockSize, WeakHashAlgorithm weakHash,
+                      StrongHashAlgorithm strongHash, const std::vector<BlockInfo>& blocks);
+    static void invalidate(const FileIdentity& identity);
+
+private:
+    static std::string cacheDirectory();
+    static std::string entryPath(const FileIdentity& identity);
+};
@@ -1,40 +1,94 @@
 #include "thread_pool.hpp"
+#include <cstdlib>
+#include <algorithm>
+
+namespace {
+// pool and deque of the worker running on this thread, tasks it submits stay on its deque
+thread_local const ThreadPool* currentPool = nullptr;
+thread_local size_t currentWorker = 0;
+}
 
 ThreadPool::ThreadPool(size_t threads) {
+    threads = std::max<size_t>(threads, 1);
+    for (size_t i = 0; i < threads; ++i) queues_.push_back(std::make_unique<Worker>());
     for (size_t i = 0; i < threads; ++i) {
-        workers.emplace_back([this]() {
-            for (;;) {
-                std::function<void()> task;
-                // lock
-                {
-                    std::unique_lock<std::mutex> lock(this->queue_mutex);
-                    this->condition.wait(lock, [this]() {
-                        return this->stop || !this->tasks.empty();
-                    });
-
-                    if (this->stop && this->tasks.empty())
-                        return;
-
-                    task = std::move(this->tasks.front());
-                    this->tasks.pop();
-                }
-
-                task(); // Execute the task
-            }
-        });
+        workers_.emplace_back([this, i]() { run(i); });
     }
 }
 
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        stop_ = true;
+    }
+    wake_.notify_all(); // Wake all threads
+    for (std::thread &worker : workers_)
+        worker.join();
+}
 
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool(defaultThreadCount());
+    return pool;
+}
 
+size_t ThreadPool::defaultThreadCount() {
+    if (const char* threads = std::getenv("FILESYNC_THREADS")) {
+        long count = std::atol(threads);
+        if (count > 0) return static_cast<size_t>(count);
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
 
-
-ThreadPool::~ThreadPool() {
+void ThreadPool::push(Task task) {
+    size_t target = currentPool == this ? currentWorker : nextQueue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
     {
-        std::unique_lock<std::mutex> lock(queue_mutex);
-        stop = true;
+        std::lock_guard<std::mutex> lock(queues_[target]->mutex);
+        if (stop_)
+            throw std::runtime_error("submit on stopped ThreadPool");
+        queues_[target]->tasks.push_back(std::move(task));
+    }
+    // pairs with the sleeping_ increment in run(): either this sees the sleeper or it sees the task
+    queued_.fetch_add(1);
+    if (sleeping_.load() > 0) {
+        { std::lock_guard<std::mutex> lock(sleepMutex_); }
+        wake_.notify_one();
+    }
+}
+
+// own deque from the front (submission order), then the back of the others
+bool ThreadPool::take(size_t self, Task& task) {
+    const size_t count = queues_.size();
+    for (size_t k = 0; k < count; ++k) {
+        Worker& queue = *queues_[(self + k) % count];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) continue;
+        if (k == 0) {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        } else {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        queued_.fetch_sub(1);
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::run(size_t self) {
+    currentPool = this;
+    currentWorker = self;
+    for (;;) {
+        Task task;
+        if (take(self, task)) {
+            task(); // Execute the task
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        sleeping_.fetch_add(1);
+        wake_.wait(lock, [this]() { return stop_ || queued_.load() > 0; });
+        sleeping_.fetch_sub(1);
+        if (stop_ && queued_.load() == 0)
+            return;
     }
-    condition.notify_all(); // Wake all threads
-    for (std::thread &worker : workers)
-        worker.join();
 }
@@ -1,26 +1,78 @@
+#pragma once
 #include <vector>
-#include <queue>
+#include <deque>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <functional>
 #include <future>
-#include <iostream>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
 
+// work stealing pool: every worker has its own deque and runs it oldest first, an idle worker
+// takes the newest task of another one. Outside threads hand tasks to the workers in turn, a
+// task submitted by a worker stays on its deque, so there is no single queue everyone locks.
+// hashing, matching and applying all share one process wide pool (shared()) sized to the machine
 class ThreadPool {
 public:
-    ThreadPool(size_t threads);             
+    explicit ThreadPool(size_t threads);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
     template<class F, class... Args>
-    auto submit(F&& f, Args&&... args) -> std::future<decltype(f(args...))>;  
-    ~ThreadPool();                          
+    auto submit(F&& f, Args&&... args) -> std::future<decltype(f(args...))>;
+
+    size_t size() const { return workers_.size(); }
+
+    // created on first use with defaultThreadCount() workers
+    static ThreadPool& shared();
+    // FILESYNC_THREADS if set, otherwise one per hardware thread
+    static size_t defaultThreadCount();
 
 private:
-    std::vector<std::thread> workers;       
-    std::queue<std::function<void()>> tasks;
+    // move only, so the packaged_task is held directly instead of behind a shared_ptr
+    class Task {
+    public:
+        Task() = default;
+        template<class F>
+        explicit Task(F&& f) : callable_(std::make_unique<Callable<std::decay_t<F>>>(std::forward<F>(f))) {}
+        void operator()() { callable_->run(); }
+
+    private:
+        struct CallableBase {
+            virtual ~CallableBase() = default;
+            virtual void run() = 0;
+        };
+        template<class F>
+        struct Callable : CallableBase {
+            explicit Callable(F&& f) : f(std::move(f)) {}
+            void run() override { f(); }
+            F f;
+        };
+        std::unique_ptr<CallableBase> callable_;
+    };
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void push(Task task);
+    bool take(size_t self, Task& task);
+    void run(size_t self);
+
+    std::vector<std::unique_ptr<Worker>> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> nextQueue_{0};   // round robin for tasks from outside the pool
+    std::atomic<size_t> queued_{0};      // tasks waiting in any deque
 
-    std::mutex queue_mutex;                 
-    std::condition_variable condition;      
-    bool stop = false;                      
+    // idle workers sleep here, a submit only takes the lock when one does
+    std::mutex sleepMutex_;
+    std::condition_variable wake_;
+    std::atomic<size_t> sleeping_{0};
+    std::atomic<bool> stop_{false};
 };
 
 // submitting the task
@@ -28,19 +80,29 @@ template<class F, class... Args>
 auto ThreadPool::submit(F&& f, Args&&... args) -> std::future<decltype(f(args...))> {
     using return_type = decltype(f(args...));
 
-    auto task = std::make_shared<std::packaged_task<return_type()>>(
+    std::packaged_task<return_type()> task(
         std::bind(std::forward<F>(f), std::forward<Args>(args)...)
     );
 
-    std::future<return_type> res = task->get_future();
-    {
-        std::unique_lock<std::mutex> lock(queue_mutex);
-
-        if (stop)
-            throw std::runtime_error("submit on stopped ThreadPool");
+    std::future<return_type> res = task.get_future();
+    push(Task(std::move(task)));
+    return res;
+}
 
-        tasks.emplace([task]() { (*task)(); });
+// waits for every future of a container when it goes out of scope. Shared pool tasks that point
+// into the caller's frame must finish before it unwinds, also on an early return or an exception
+template<class Futures>
+class WaitForAll {
+public:
+    explicit WaitForAll(Futures& futures) : futures_(futures) {}
+    ~WaitForAll() {
+        for (auto& future : futures_) {
+            if (future.valid()) future.wait();
+        }
     }
-    condition.notify_one();
-    return res;
-}
\ No newline at end of file
+    WaitForAll(const WaitForAll&) = delete;
+    WaitForAll& operator=(const WaitForAll&) = delete;
+
+private:
+    Futures& futures_;
+};
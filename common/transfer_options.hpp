@@ -0,0 +1,32 @@
+#pragma once
+#include <cstdint>
+#include "weak_hash.hpp"
+#include "hash_utils.hpp"
+
+// how the destination file is cut into the blocks that the source matches against
+enum class ChunkingMode : uint8_t {
+    FIXED = 0,  // fixed size blocks, source runs a rolling search byte by byte
+    CDC = 1     // content defined chunks, source chunks its file the same way and looks chunks up by hash
+};
+
+// optional protocol features, the client offers the ones it knows and the server answers with
+// the ones both sides support, so a peer without a feature simply never turns it on
+enum TransferFeature : uint32_t {
+    COMPRESSED_LITERALS = 1u << 0,  // insert payloads travel through a shared deflate stream
+    FILE_DIGEST = 1u << 1           // the source follows the delta with a digest of its file, the destination
+                                    // only keeps a new file that matches it
+};
+inline constexpr uint32_t SUPPORTED_TRANSFER_FEATURES = COMPRESSED_LITERALS | FILE_DIGEST;
+
+// per transfer settings chosen by the client and sent to the server right after the file path
+struct TransferOptions {
+    ChunkingMode chunking = ChunkingMode::FIXED;
+    uint32_t blockSize = 0;   // requested fixed block size, 0 lets the destination pick from the file size
+    uint32_t features = SUPPORTED_TRANSFER_FEATURES;   // TransferFeature bits
+    bool inPlace = false;   // destination rewrites its file where it lies instead of building a copy
+    WeakHashAlgorithm weakHash = WeakHashAlgorithm::POLYNOMIAL;   // rolling checksum of fixed blocks
+    StrongHashAlgorithm strongHash = HashUtils::STRONG_HASH_ALGORITHM;   // digest that confirms a match
+    // the signature carries whole digests instead of the truncated ones, the client asks for it
+    // when it syncs a file again after its digest did not match (rsync's second pass)
+    bool fullStrongHash = false;
+};
@@ -0,0 +1,27 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// LEB128 style variable length integers, 7 bits per byte, high bit set on all but the last byte
+// small numbers (lengths, offsets relative to the previous copy) take one or two bytes instead of eight
+namespace Varint {
+    inline constexpr size_t MAX_BYTES = 10;   // a full uint64_t
+
+    inline void put(std::vector<uint8_t>& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<uint8_t>(value) | 0x80);
+            value >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    // signed deltas, small magnitudes of either sign stay small
+    inline uint64_t zigzagEncode(int64_t value) {
+        return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    }
+
+    inline int64_t zigzagDecode(uint64_t value) {
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+}
@@ -0,0 +1,67 @@
+#include "weak_hash.hpp"
+#include "hash_utils.hpp"
+
+uint32_t PolynomialHash::hash(const uint8_t* data) const {
+    return roller_.hash(reinterpret_cast<const char*>(data));
+}
+
+namespace {
+const char* const NAMES[WEAK_HASH_ALGORITHM_COUNT] = {"polynomial", "adler", "buzhash", "gear"};
+}
+
+namespace WeakHash {
+uint32_t compute(WeakHashAlgorithm algorithm, const char* data, size_t len) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    switch (algorithm) {
+    case WeakHashAlgorithm::ADLER:
+        return AdlerHash(len).hash(bytes);
+    case WeakHashAlgorithm::BUZHASH:
+        return BuzHash(len).hash(bytes);
+    case WeakHashAlgorithm::GEAR:
+        return GearHash(len).hash(bytes);
+    case WeakHashAlgorithm::POLYNOMIAL:
+        break;
+    }
+    return HashUtils::computeWeakHash(data, len);
+}
+
+// the polynomial hash is a serial chain of modular reductions per block, it runs LANES blocks side by side
+void computeBlocks(WeakHashAlgorithm algorithm, const char* data, size_t blockSize, size_t count, uint32_t* out) {
+    if (algorithm == WeakHashAlgorithm::POLYNOMIAL) {
+        RollingHash(blockSize).hashBlocks(data, count, out);
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) out[i] = compute(algorithm, data + i * blockSize, blockSize);
+}
+
+// as measured by bench/weak_hash_bench (false candidates per window and block): polynomial and
+// buzhash are close to their 30 and 32 bits, adler's sums only reach about 26 on text. gear only
+// sees the last 64 bytes of a block, blocks that end alike all match, so it vouches for nothing
+int matchBits(WeakHashAlgorithm algorithm) {
+    switch (algorithm) {
+    case WeakHashAlgorithm::ADLER:
+        return 24;
+    case WeakHashAlgorithm::GEAR:
+        return 0;
+    case WeakHashAlgorithm::POLYNOMIAL:
+    case WeakHashAlgorithm::BUZHASH:
+        break;
+    }
+    return 30;
+}
+
+bool fromName(const std::string& name, WeakHashAlgorithm& algorithm) {
+    for (uint8_t i = 0; i < WEAK_HASH_ALGORITHM_COUNT; ++i) {
+        if (name == NAMES[i]) {
+            algorithm = static_cast<WeakHashAlgorithm>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* name(WeakHashAlgorithm algorithm) {
+    uint8_t index = static_cast<uint8_t>(algorithm);
+    return index < WEAK_HASH_ALGORITHM_COUNT ? NAMES[index] : "unknown";
+}
+}
@@ -0,0 +1,158 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include "rolling_hash.hpp"
+
+// rolling checksum the source slides over its file to find candidate blocks. The client picks it
+// per transfer, the destination hashes its blocks with it and names it in the signature header
+enum class WeakHashAlgorithm : uint8_t {
+    POLYNOMIAL = 0,   // sum of byte * 257^k mod 1e9+7
+    ADLER = 1,        // rsync's checksum, two 16 bit sums
+    BUZHASH = 2,      // cyclic polynomial: rotations and xors of a per byte table
+    GEAR = 3          // gear hash, the top 32 bits only depend on the last 64 bytes of the window
+};
+inline constexpr uint8_t WEAK_HASH_ALGORITHM_COUNT = 4;
+
+// 256 pseudo random words (splitmix64), fixed so both peers compute the same hashes
+constexpr std::array<uint64_t, 256> makeByteTable(uint64_t seed) {
+    std::array<uint64_t, 256> table{};
+    uint64_t state = seed;
+    for (size_t i = 0; i < table.size(); ++i) {
+        state += 0x9E3779B97F4A7C15ull;
+        uint64_t z = state;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        table[i] = z ^ (z >> 31);
+    }
+    return table;
+}
+
+// policies below share one shape, the matcher is instantiated once per policy:
+//   explicit Policy(size_t window)
+//   uint32_t hash(const uint8_t* data) const                                window starting at data
+//   void hashWindows(const char* data, size_t count, uint32_t* out) const   out[i] = hash(data + i)
+
+// hashWindows by rolling one window after the other, for a policy that has
+//   uint32_t roll(uint32_t hash, uint8_t out, uint8_t in) const
+template <class Policy>
+void rollWindows(const Policy& policy, size_t window, const char* data, size_t count, uint32_t* out) {
+    if (count == 0) return;
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    uint32_t hash = policy.hash(bytes);
+    out[0] = hash;
+    for (size_t i = 1; i < count; ++i) {
+        hash = policy.roll(hash, bytes[i - 1], bytes[i - 1 + window]);
+        out[i] = hash;
+    }
+}
+
+class PolynomialHash {
+public:
+    explicit PolynomialHash(size_t window) : roller_(window) {}
+    uint32_t hash(const uint8_t* data) const;
+    void hashWindows(const char* data, size_t count, uint32_t* out) const { roller_.hashWindows(data, count, out); }
+
+private:
+    RollingHash roller_;   // vectorized, a modular reduction per byte is too slow to roll serially
+};
+
+class AdlerHash {
+public:
+    explicit AdlerHash(size_t window) : window_(static_cast<uint32_t>(window)) {}
+
+    // [16 bit weighted sum][16 bit byte sum]
+    uint32_t hash(const uint8_t* data) const {
+        uint32_t a = 0, b = 0;
+        for (uint32_t i = 0; i < window_; ++i) {
+            a += data[i];
+            b += a;
+        }
+        return (b << 16) | (a & 0xFFFF);
+    }
+    // the sums roll unmasked, only their low 16 bits are ever looked at
+    void hashWindows(const char* data, size_t count, uint32_t* out) const {
+        if (count == 0) return;
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+        uint32_t hash = this->hash(bytes);
+        uint32_t a = hash & 0xFFFF, b = hash >> 16;
+        out[0] = hash;
+        for (size_t i = 1; i < count; ++i) {
+            uint32_t gone = bytes[i - 1];
+            a += bytes[i - 1 + window_] - gone;
+            b += a - window_ * gone;
+            out[i] = (b << 16) | (a & 0xFFFF);
+        }
+    }
+
+private:
+    uint32_t window_;
+};
+
+class BuzHash {
+public:
+    explicit BuzHash(size_t window) : window_(window), outRotation_(window % 32) {}
+
+    uint32_t hash(const uint8_t* data) const {
+        uint32_t hash = 0;
+        for (size_t i = 0; i < window_; ++i) hash = rotl(hash, 1) ^ table(data[i]);
+        return hash;
+    }
+    // after the rotation the leaving byte's word has turned window times
+    uint32_t roll(uint32_t hash, uint8_t out, uint8_t in) const {
+        return rotl(hash, 1) ^ rotl(table(out), outRotation_) ^ table(in);
+    }
+    void hashWindows(const char* data, size_t count, uint32_t* out) const { rollWindows(*this, window_, data, count, out); }
+
+private:
+    static constexpr std::array<uint64_t, 256> TABLE = makeByteTable(0x6A09E667F3BCC908ull);
+    static uint32_t table(uint8_t byte) { return static_cast<uint32_t>(TABLE[byte]); }
+    static uint32_t rotl(uint32_t v, unsigned r) { return (v << r) | (v >> ((32 - r) & 31)); }
+
+    size_t window_;
+    unsigned outRotation_;
+};
+
+// a byte shifts out of the 64 bit state by itself after 64 more, so rolling only adds the new one.
+// needs a window of at least 64 bytes (blocks are 512 or more)
+class GearHash {
+public:
+    static constexpr size_t SPAN = 64;
+
+    explicit GearHash(size_t window) : window_(window) {}
+
+    uint32_t hash(const uint8_t* data) const {
+        uint64_t state = 0;
+        for (size_t i = window_ > SPAN ? window_ - SPAN : 0; i < window_; ++i) state = (state << 1) + TABLE[data[i]];
+        return static_cast<uint32_t>(state >> 32);
+    }
+    void hashWindows(const char* data, size_t count, uint32_t* out) const {
+        if (count == 0) return;
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+        uint64_t state = 0;
+        for (size_t i = window_ > SPAN ? window_ - SPAN : 0; i < window_; ++i) state = (state << 1) + TABLE[bytes[i]];
+        out[0] = static_cast<uint32_t>(state >> 32);
+        for (size_t i = 1; i < count; ++i) {
+            state = (state << 1) + TABLE[bytes[i - 1 + window_]];
+            out[i] = static_cast<uint32_t>(state >> 32);
+        }
+    }
+
+private:
+    static constexpr std::array<uint64_t, 256> TABLE = makeByteTable(0xBB67AE8584CAA73Bull);
+
+    size_t window_;
+};
+
+namespace WeakHash {
+// weak hash of one block with the given algorithm
+uint32_t compute(WeakHashAlgorithm algorithm, const char* data, size_t len);
+// out[i] = weak hash of data[i*blockSize, (i+1)*blockSize) for i < count
+void computeBlocks(WeakHashAlgorithm algorithm, const char* data, size_t blockSize, size_t count, uint32_t* out);
+// bits of evidence a matching weak hash gives that a window equals a block, the strong hash
+// length of a signature is cut by them (HashUtils::strongHashLength)
+int matchBits(WeakHashAlgorithm algorithm);
+bool fromName(const std::string& name, WeakHashAlgorithm& algorithm);
+const char* name(WeakHashAlgorithm algorithm);
+}
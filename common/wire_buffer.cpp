@@ -0,0 +1,278 @@
+#include "wire_buffer.hpp"
+#include "varint.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <climits>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+WireWriter::WireWriter(size_t capacity) : capacity_(capacity) {
+    buffer_.reserve(capacity_);
+}
+
+void WireWriter::extendBufferSegment(size_t len) {
+    if (segments_.empty() || segments_.back().ref || segments_.back().fileFd >= 0) {
+        segments_.push_back({ nullptr, buffer_.size() - len, 0 });
+    }
+    segments_.back().len += len;
+    pending_ += len;
+}
+
+uint8_t* WireWriter::reserve(size_t len) {
+    size_t at = buffer_.size();
+    buffer_.resize(at + len);
+    extendBufferSegment(len);
+    return buffer_.data() + at;
+}
+
+void WireWriter::put(const void* data, size_t len) {
+    if (len == 0) return;
+    std::memcpy(reserve(len), data, len);
+}
+
+void WireWriter::putVarint(uint64_t v) {
+    size_t before = buffer_.size();
+    Varint::put(buffer_, v);
+    extendBufferSegment(buffer_.size() - before);
+}
+
+void WireWriter::putRef(const void* data, size_t len) {
+    if (len == 0) return;
+    segments_.push_back({ static_cast<const uint8_t*>(data), 0, len });
+    pending_ += len;
+}
+
+void WireWriter::putFile(int fileFd, uint64_t offset, size_t len) {
+    if (len == 0) return;
+    segments_.push_back({ nullptr, static_cast<size_t>(offset), len, fileFd });
+    pending_ += len;
+}
+
+bool WireWriter::flush(int fd, bool more) {
+    if (queue_) return queueSegments();
+    // runs of memory segments leave in one gather write each, file ranges between them by sendfile
+    std::vector<iovec> iov;
+    iov.reserve(segments_.size());
+    bool ok = true;
+    for (size_t s = 0; ok && s < segments_.size(); ) {
+        iov.clear();
+        for (; s < segments_.size() && segments_[s].fileFd < 0; ++s) {
+            const Segment& segment = segments_[s];
+            const uint8_t* base = segment.ref ? segment.ref : buffer_.data() + segment.offset;
+            iov.push_back({ const_cast<uint8_t*>(base), segment.len });
+        }
+        bool fileNext = s < segments_.size();
+        ok = sendIov(fd, iov, more || fileNext);
+        if (ok && fileNext) ok = sendFileRange(fd, segments_[s++]);
+    }
+    segments_.clear();
+    buffer_.clear();
+    pending_ = 0;
+    return ok;
+}
+
+bool WireWriter::sendIov(int fd, std::vector<iovec>& iov, bool more) {
+    size_t first = 0;
+    while (first < iov.size()) {
+        msghdr msg{};
+        msg.msg_iov = iov.data() + first;
+        msg.msg_iovlen = std::min<size_t>(iov.size() - first, IOV_MAX);
+        bool last = first + msg.msg_iovlen == iov.size();
+        ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL | (more || !last ? MSG_MORE : 0));
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+
+        // skip what went out, a partial write leaves the rest of an iovec
+        size_t left = sent;
+        while (first < iov.size() && left >= iov[first].iov_len) {
+            left -= iov[first].iov_len;
+            first++;
+        }
+        if (left > 0) {
+            iov[first].iov_base = static_cast<uint8_t*>(iov[first].iov_base) + left;
+            iov[first].iov_len -= left;
+        }
+    }
+    return true;
+}
+
+// the kernel copies from the page cache to the socket, the bytes never pass through the process.
+// sendfile marks all but the tail of each call as more to come itself
+bool WireWriter::sendFileRange(int fd, const Segment& segment) {
+    off_t offset = static_cast<off_t>(segment.offset);
+    size_t left = segment.len;
+    while (left > 0) {
+        ssize_t sent = sendfile(fd, segment.fileFd, &offset, left);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        left -= sent;
+    }
+    return true;
+}
+
+// a server keeps thousands of connections, their buffers only grow as far as their messages need
+void WireWriter::sendTo(Queue queue) {
+    queue_ = std::move(queue);
+    std::vector<uint8_t>().swap(buffer_);
+}
+
+bool WireWriter::queueSegments() {
+    const size_t FILE_SLAB = 256 * 1024;
+    std::vector<uint8_t> slab;
+    bool ok = true;
+    for (size_t s = 0; ok && s < segments_.size(); ++s) {
+        const Segment& segment = segments_[s];
+        if (segment.fileFd < 0) {
+            ok = queue_(segment.ref ? segment.ref : buffer_.data() + segment.offset, segment.len);
+            continue;
+        }
+        slab.resize(std::min(segment.len, FILE_SLAB));
+        for (size_t done = 0; ok && done < segment.len; ) {
+            ssize_t got = pread(segment.fileFd, slab.data(), std::min(slab.size(), segment.len - done), segment.offset + done);
+            if (got < 0 && errno == EINTR) continue;
+            ok = got > 0 && queue_(slab.data(), got);
+            done += got > 0 ? got : 0;
+        }
+    }
+    segments_.clear();
+    buffer_.clear();
+    pending_ = 0;
+    return ok;
+}
+
+WireReader::WireReader(size_t capacity) : capacity_(capacity), buffer_(capacity) {}
+
+void WireReader::receiveFrom(Source source) {
+    source_ = std::move(source);
+    std::vector<uint8_t>().swap(buffer_);
+    begin_ = end_ = 0;
+}
+
+bool WireReader::fill(int fd, size_t len) {
+    if (available() >= len) return true;
+    if (source_) return fillFromSource(len);
+    if (available() == 0) begin_ = end_ = 0;
+    if (begin_ + len > buffer_.size()) {
+        // move the unread bytes to the front, and grow for a record bigger than the slab
+        std::memmove(buffer_.data(), buffer_.data() + begin_, available());
+        end_ -= begin_;
+        begin_ = 0;
+        if (len > buffer_.size()) buffer_.resize(len);
+    }
+    while (available() < len) {
+        ssize_t got = recv(fd, buffer_.data() + end_, buffer_.size() - end_, 0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        end_ += got;
+    }
+    return true;
+}
+
+// bytes from the mark on stay in the buffer, a rewind needs them
+bool WireReader::fillFromSource(size_t len) {
+    if (len > capacity_) return false;
+    size_t keep = marked_ ? mark_ : begin_;
+    if (begin_ + len > buffer_.size()) {
+        std::memmove(buffer_.data(), buffer_.data() + keep, end_ - keep);
+        begin_ -= keep;
+        end_ -= keep;
+        mark_ -= marked_ ? keep : 0;
+        keep = 0;
+        // grows by doubling up to the usual slab, further only for a bigger message
+        size_t grown = std::min(capacity_, std::max<size_t>(buffer_.size() * 2, 4096));
+        if (begin_ + len > buffer_.size()) buffer_.resize(std::max(begin_ + len, grown));
+    }
+    while (available() < len) {
+        size_t got = source_(buffer_.data() + end_, buffer_.size() - end_);
+        if (got == 0) {
+            starved_ = true;
+            wanted_ = begin_ - keep + len;
+            return false;
+        }
+        end_ += got;
+    }
+    return true;
+}
+
+bool WireReader::read(int fd, void* out, size_t len) {
+    if (source_) {
+        if (!fill(fd, len)) return false;
+        std::memcpy(out, data(), len);
+        consume(len);
+        return true;
+    }
+    uint8_t* dest = static_cast<uint8_t*>(out);
+    size_t buffered = std::min(len, available());
+    std::memcpy(dest, data(), buffered);
+    consume(buffered);
+    dest += buffered;
+    len -= buffered;
+    if (len == 0) return true;
+
+    if (len < buffer_.size() / 2) {
+        if (!fill(fd, len)) return false;
+        std::memcpy(dest, data(), len);
+        consume(len);
+        return true;
+    }
+    // the buffer is empty here, a big payload skips it
+    while (len > 0) {
+        ssize_t got = recv(fd, dest, len, MSG_WAITALL);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        dest += got;
+        len -= got;
+    }
+    return true;
+}
+
+bool WireReader::readInto(int fd, void* out, size_t len, size_t& done) {
+    uint8_t* dest = static_cast<uint8_t*>(out);
+    if (!source_) {
+        if (!read(fd, dest + done, len - done)) return false;
+        done = len;
+        return true;
+    }
+    size_t buffered = std::min(len - done, available());
+    std::memcpy(dest + done, data(), buffered);
+    consume(buffered);
+    done += buffered;
+    if (marked_) mark_ = begin_;
+    while (done < len) {
+        size_t got = source_(dest + done, len - done);
+        if (got == 0) {
+            starved_ = true;
+            wanted_ = available() + (len - done);
+            return false;
+        }
+        done += got;
+    }
+    return true;
+}
+
+bool WireReader::readU8(int fd, uint8_t& v) {
+    if (!fill(fd, 1)) return false;
+    v = *data();
+    consume(1);
+    return true;
+}
+
+bool WireReader::readU32(int fd, uint32_t& v) {
+    if (!fill(fd, sizeof(v))) return false;
+    v = Wire::loadU32(data());
+    consume(sizeof(v));
+    return true;
+}
+
+bool WireReader::readVarint(int fd, uint64_t& v) {
+    v = 0;
+    for (size_t i = 0; i < Varint::MAX_BYTES; ++i) {
+        uint8_t byte;
+        if (!readU8(fd, byte)) return false;
+        v |= static_cast<uint64_t>(byte & 0x7F) << (7 * i);
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
@@ -0,0 +1,131 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <functional>
+#include <sys/uio.h>
+
+// big endian field access for records encoded straight into (or parsed straight out of) a buffer
+namespace Wire {
+    inline void storeU32(uint8_t* p, uint32_t v) {
+        p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+    }
+    inline void storeU64(uint8_t* p, uint64_t v) {
+        storeU32(p, static_cast<uint32_t>(v >> 32));
+        storeU32(p + 4, static_cast<uint32_t>(v));
+    }
+    inline uint32_t loadU32(const uint8_t* p) {
+        return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+    }
+    inline uint64_t loadU64(const uint8_t* p) {
+        return (uint64_t(loadU32(p)) << 32) | loadU32(p + 4);
+    }
+}
+
+// outgoing bytes of a connection, collected and sent with as few syscalls as possible.
+// small fields are copied into the buffer, large payloads are only referenced and go out
+// with the buffered bytes in one sendmsg (gather write), so they are never copied.
+// ranges of a file go out with sendfile, straight from the page cache
+class WireWriter {
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 256 * 1024;
+
+    explicit WireWriter(size_t capacity = DEFAULT_CAPACITY);
+
+    void put(const void* data, size_t len);
+    void putU8(uint8_t v) { *reserve(sizeof(v)) = v; }
+    void putU32(uint32_t v) { Wire::storeU32(reserve(sizeof(v)), v); }
+    void putU64(uint64_t v) { Wire::storeU64(reserve(sizeof(v)), v); }
+    void putVarint(uint64_t v);
+    // room for len bytes that the caller encodes in place
+    uint8_t* reserve(size_t len);
+    // data must stay valid until the next flush
+    void putRef(const void* data, size_t len);
+    // len bytes of the file at offset, fileFd must stay open until the next flush
+    void putFile(int fileFd, uint64_t offset, size_t len);
+
+    size_t pending() const { return pending_; }
+    // more=true marks a flush in the middle of a message (MSG_MORE), the kernel may hold it back
+    bool flush(int fd, bool more = false);
+
+    // a connection of the event driven server is written by its event loop, not by the session:
+    // with a queue set, flush hands everything to it as plain bytes (referenced data and file
+    // ranges copied, they need not outlive the flush) and fd is not touched
+    using Queue = std::function<bool(const uint8_t* data, size_t len)>;
+    void sendTo(Queue queue);
+    // keeps memory bounded while a long message is encoded
+    bool flushIfFull(int fd) { return pending_ < capacity_ || flush(fd, true); }
+
+private:
+    // a run of the buffer, a referenced payload or a file range. The buffer can still grow so
+    // runs are offsets
+    struct Segment {
+        const uint8_t* ref;   // nullptr for a run of the buffer or a file range
+        size_t offset;        // in the buffer or in the file
+        size_t len;
+        int fileFd = -1;
+    };
+    void extendBufferSegment(size_t len);
+    bool sendIov(int fd, std::vector<iovec>& iov, bool more);
+    static bool sendFileRange(int fd, const Segment& segment);
+    bool queueSegments();
+
+    size_t capacity_;
+    std::vector<uint8_t> buffer_;
+    std::vector<Segment> segments_;
+    size_t pending_ = 0;
+    Queue queue_;
+};
+
+// incoming bytes of a connection, read in large slabs so many small records cost one recv.
+// fill() makes a record available contiguously and it is parsed where it lies
+class WireReader {
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 256 * 1024;
+
+    explicit WireReader(size_t capacity = DEFAULT_CAPACITY);
+
+    bool fill(int fd, size_t len);
+    const uint8_t* data() const { return buffer_.data() + begin_; }
+    size_t available() const { return end_ - begin_; }
+    void consume(size_t len) { begin_ += len; }
+
+    // copies len bytes out, big payloads are received straight into out
+    bool read(int fd, void* out, size_t len);
+    bool readU8(int fd, uint8_t& v);
+    bool readU32(int fd, uint32_t& v);
+    bool readVarint(int fd, uint64_t& v);
+
+    // out[done, len) as far as the bytes go, done moves past what was copied and true once it
+    // reaches len. With a source the bytes go straight from it into out, a long payload never
+    // passes through the buffer and what was copied stays taken (the mark moves past it)
+    bool readInto(int fd, void* out, size_t len, size_t& done);
+
+    // the event driven server's counterpart of WireWriter::sendTo: with a source set, fill()
+    // takes what the source has ready (it returns how many bytes it copied to out, 0 when
+    // nothing is there) and fails with starved() instead of waiting on fd. A message that
+    // starves halfway is parsed again from mark() once missing() more bytes have come in, one
+    // that keeps its own progress marks each piece it got. The buffer stays within capacity,
+    // a fill for more than that fails
+    using Source = std::function<size_t(uint8_t* out, size_t len)>;
+    void receiveFrom(Source source);
+    void mark() { marked_ = true; mark_ = begin_; starved_ = false; }
+    void unmark() { marked_ = false; }
+    void rewind() { begin_ = mark_; marked_ = false; }
+    bool starved() const { return starved_; }
+    size_t missing() const { return wanted_ > available() ? wanted_ - available() : 0; }
+
+private:
+    bool fillFromSource(size_t len);
+
+    size_t capacity_;
+    std::vector<uint8_t> buffer_;
+    size_t begin_ = 0;
+    size_t end_ = 0;
+    Source source_;
+    bool marked_ = false;
+    size_t mark_ = 0;
+    bool starved_ = false;
+    size_t wanted_ = 0;   // bytes from the mark the starved message needed at least
+};
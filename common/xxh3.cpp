@@ -0,0 +1,292 @@
+#include "xxh3.hpp"
+#include "cpu_features.hpp"
+#include <cstring>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "XXH3 reads its input little endian");
+
+namespace {
+constexpr uint32_t PRIME32_1 = 0x9E3779B1u;
+constexpr uint32_t PRIME32_2 = 0x85EBCA77u;
+constexpr uint32_t PRIME32_3 = 0xC2B2AE3Du;
+constexpr uint64_t PRIME64_1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t PRIME64_3 = 0x165667B19E3779F9ull;
+constexpr uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ull;
+constexpr uint64_t PRIME64_5 = 0x27D4EB2F165667C5ull;
+constexpr uint64_t PRIME_MX1 = 0x165667919E3779F9ull;
+constexpr uint64_t PRIME_MX2 = 0x9FB21C651E98DF25ull;
+
+constexpr size_t SECRET_SIZE = 192;
+constexpr size_t SECRET_SIZE_MIN = 136;
+constexpr size_t STRIPE_LENGTH = 64;
+constexpr size_t SECRET_CONSUME_RATE = 8;       // secret bytes further per stripe
+constexpr size_t STRIPES_PER_BLOCK = (SECRET_SIZE - STRIPE_LENGTH) / SECRET_CONSUME_RATE;
+constexpr size_t BLOCK_LENGTH = STRIPE_LENGTH * STRIPES_PER_BLOCK;
+constexpr size_t MIDSIZE_MAX = 240;
+constexpr size_t MIDSIZE_START_OFFSET = 3;
+constexpr size_t MIDSIZE_LAST_OFFSET = 17;
+constexpr size_t LAST_STRIPE_SECRET_START = 7;
+constexpr size_t MERGE_SECRET_START = 11;
+
+alignas(64) constexpr uint8_t SECRET[SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+struct Hash128 {
+    uint64_t low;
+    uint64_t high;
+};
+
+uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t read64(const uint8_t* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+Hash128 multiply(uint64_t a, uint64_t b) {
+    unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+    return {static_cast<uint64_t>(product), static_cast<uint64_t>(product >> 64)};
+}
+
+uint64_t multiplyFold(uint64_t a, uint64_t b) {
+    Hash128 product = multiply(a, b);
+    return product.low ^ product.high;
+}
+
+uint64_t xorShift(uint64_t v, unsigned shift) {
+    return v ^ (v >> shift);
+}
+
+uint64_t avalanche(uint64_t h) {
+    h = xorShift(h, 37);
+    h *= PRIME_MX1;
+    return xorShift(h, 32);
+}
+
+uint64_t avalanche64(uint64_t h) {
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t mix16(const uint8_t* input, const uint8_t* secret, uint64_t seed) {
+    return multiplyFold(read64(input) ^ (read64(secret) + seed), read64(input + 8) ^ (read64(secret + 8) - seed));
+}
+
+Hash128 mix32(Hash128 acc, const uint8_t* first, const uint8_t* second, const uint8_t* secret, uint64_t seed) {
+    acc.low += mix16(first, secret, seed);
+    acc.low ^= read64(second) + read64(second + 8);
+    acc.high += mix16(second, secret + 16, seed);
+    acc.high ^= read64(first) + read64(first + 8);
+    return acc;
+}
+
+// shared ending of the 17..240 byte paths
+Hash128 finishMid(Hash128 acc, size_t len) {
+    Hash128 h;
+    h.low = avalanche(acc.low + acc.high);
+    h.high = 0 - avalanche(acc.low * PRIME64_1 + acc.high * PRIME64_4 + len * PRIME64_2);
+    return h;
+}
+
+Hash128 hash0To16(const uint8_t* input, size_t len) {
+    if (len > 8) {
+        uint64_t flipLow = read64(SECRET + 32) ^ read64(SECRET + 40);
+        uint64_t flipHigh = read64(SECRET + 48) ^ read64(SECRET + 56);
+        uint64_t inputLow = read64(input);
+        uint64_t inputHigh = read64(input + len - 8);
+        Hash128 m = multiply(inputLow ^ inputHigh ^ flipLow, PRIME64_1);
+        m.low += static_cast<uint64_t>(len - 1) << 54;
+        inputHigh ^= flipHigh;
+        m.high += inputHigh + static_cast<uint64_t>(static_cast<uint32_t>(inputHigh)) * (PRIME32_2 - 1);
+        m.low ^= __builtin_bswap64(m.high);
+        Hash128 h = multiply(m.low, PRIME64_2);
+        h.high += m.high * PRIME64_2;
+        return {avalanche(h.low), avalanche(h.high)};
+    }
+    if (len >= 4) {
+        uint64_t input64 = read32(input) + (static_cast<uint64_t>(read32(input + len - 4)) << 32);
+        uint64_t flip = read64(SECRET + 16) ^ read64(SECRET + 24);
+        Hash128 m = multiply(input64 ^ flip, PRIME64_1 + (len << 2));
+        m.high += m.low << 1;
+        m.low ^= m.high >> 3;
+        m.low = xorShift(m.low, 35);
+        m.low *= PRIME_MX2;
+        m.low = xorShift(m.low, 28);
+        m.high = avalanche(m.high);
+        return m;
+    }
+    if (len > 0) {
+        uint32_t combinedLow = (static_cast<uint32_t>(input[0]) << 16) | (static_cast<uint32_t>(input[len >> 1]) << 24) |
+                               input[len - 1] | (static_cast<uint32_t>(len) << 8);
+        uint32_t swapped = __builtin_bswap32(combinedLow);
+        uint32_t combinedHigh = (swapped << 13) | (swapped >> 19);
+        uint64_t flipLow = read32(SECRET) ^ read32(SECRET + 4);
+        uint64_t flipHigh = read32(SECRET + 8) ^ read32(SECRET + 12);
+        return {avalanche64(combinedLow ^ flipLow), avalanche64(combinedHigh ^ flipHigh)};
+    }
+    return {avalanche64(read64(SECRET + 64) ^ read64(SECRET + 72)), avalanche64(read64(SECRET + 80) ^ read64(SECRET + 88))};
+}
+
+Hash128 hash17To128(const uint8_t* input, size_t len) {
+    Hash128 acc{len * PRIME64_1, 0};
+    if (len > 32) {
+        if (len > 64) {
+            if (len > 96) acc = mix32(acc, input + 48, input + len - 64, SECRET + 96, 0);
+            acc = mix32(acc, input + 32, input + len - 48, SECRET + 64, 0);
+        }
+        acc = mix32(acc, input + 16, input + len - 32, SECRET + 32, 0);
+    }
+    acc = mix32(acc, input, input + len - 16, SECRET, 0);
+    return finishMid(acc, len);
+}
+
+Hash128 hash129To240(const uint8_t* input, size_t len) {
+    Hash128 acc{len * PRIME64_1, 0};
+    for (size_t i = 32; i < 160; i += 32) acc = mix32(acc, input + i - 32, input + i - 16, SECRET + i - 32, 0);
+    acc.low = avalanche(acc.low);
+    acc.high = avalanche(acc.high);
+    for (size_t i = 160; i <= len; i += 32) {
+        acc = mix32(acc, input + i - 32, input + i - 16, SECRET + MIDSIZE_START_OFFSET + i - 160, 0);
+    }
+    acc = mix32(acc, input + len - 16, input + len - 32, SECRET + SECRET_SIZE_MIN - MIDSIZE_LAST_OFFSET - 16, 0);
+    return finishMid(acc, len);
+}
+
+// long inputs: eight 64 bit accumulators take one 64 byte stripe at a time, a block of 16 stripes
+// walks the secret 8 bytes per stripe and is followed by a scramble
+void accumulateScalar(uint64_t* acc, const uint8_t* stripe, const uint8_t* secret) {
+    for (size_t lane = 0; lane < 8; ++lane) {
+        uint64_t value = read64(stripe + lane * 8);
+        uint64_t keyed = value ^ read64(secret + lane * 8);
+        acc[lane ^ 1] += value;
+        acc[lane] += static_cast<uint64_t>(static_cast<uint32_t>(keyed)) * (keyed >> 32);
+    }
+}
+
+void scrambleScalar(uint64_t* acc, const uint8_t* secret) {
+    for (size_t lane = 0; lane < 8; ++lane) {
+        acc[lane] = (xorShift(acc[lane], 47) ^ read64(secret + lane * 8)) * PRIME32_1;
+    }
+}
+
+void hashLongScalar(const uint8_t* input, size_t len, uint64_t* acc) {
+    const size_t blocks = (len - 1) / BLOCK_LENGTH;
+    for (size_t b = 0; b < blocks; ++b) {
+        for (size_t s = 0; s < STRIPES_PER_BLOCK; ++s) {
+            accumulateScalar(acc, input + b * BLOCK_LENGTH + s * STRIPE_LENGTH, SECRET + s * SECRET_CONSUME_RATE);
+        }
+        scrambleScalar(acc, SECRET + SECRET_SIZE - STRIPE_LENGTH);
+    }
+    const size_t stripes = ((len - 1) - blocks * BLOCK_LENGTH) / STRIPE_LENGTH;
+    for (size_t s = 0; s < stripes; ++s) {
+        accumulateScalar(acc, input + blocks * BLOCK_LENGTH + s * STRIPE_LENGTH, SECRET + s * SECRET_CONSUME_RATE);
+    }
+    accumulateScalar(acc, input + len - STRIPE_LENGTH, SECRET + SECRET_SIZE - STRIPE_LENGTH - LAST_STRIPE_SECRET_START);
+}
+
+#if defined(__x86_64__)
+// the accumulators stay in two registers for the whole input
+__attribute__((target("avx2")))
+inline void accumulateAvx2(__m256i* acc, const uint8_t* stripe, const uint8_t* secret) {
+    for (int i = 0; i < 2; ++i) {
+        __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(stripe) + i);
+        __m256i keyed = _mm256_xor_si256(value, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(secret) + i));
+        __m256i product = _mm256_mul_epu32(keyed, _mm256_srli_epi64(keyed, 32));
+        __m256i swapped = _mm256_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+        acc[i] = _mm256_add_epi64(product, _mm256_add_epi64(acc[i], swapped));
+    }
+}
+
+__attribute__((target("avx2")))
+inline void scrambleAvx2(__m256i* acc, const uint8_t* secret) {
+    const __m256i prime = _mm256_set1_epi32(static_cast<int>(PRIME32_1));
+    for (int i = 0; i < 2; ++i) {
+        __m256i keyed = _mm256_xor_si256(_mm256_xor_si256(acc[i], _mm256_srli_epi64(acc[i], 47)),
+                                         _mm256_loadu_si256(reinterpret_cast<const __m256i*>(secret) + i));
+        __m256i low = _mm256_mul_epu32(keyed, prime);
+        __m256i high = _mm256_mul_epu32(_mm256_srli_epi64(keyed, 32), prime);
+        acc[i] = _mm256_add_epi64(low, _mm256_slli_epi64(high, 32));
+    }
+}
+
+__attribute__((target("avx2")))
+void hashLongAvx2(const uint8_t* input, size_t len, uint64_t* out) {
+    __m256i acc[2] = {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(out)),
+                      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(out) + 1)};
+    const size_t blocks = (len - 1) / BLOCK_LENGTH;
+    for (size_t b = 0; b < blocks; ++b) {
+        for (size_t s = 0; s < STRIPES_PER_BLOCK; ++s) {
+            accumulateAvx2(acc, input + b * BLOCK_LENGTH + s * STRIPE_LENGTH, SECRET + s * SECRET_CONSUME_RATE);
+        }
+        scrambleAvx2(acc, SECRET + SECRET_SIZE - STRIPE_LENGTH);
+    }
+    const size_t stripes = ((len - 1) - blocks * BLOCK_LENGTH) / STRIPE_LENGTH;
+    for (size_t s = 0; s < stripes; ++s) {
+        accumulateAvx2(acc, input + blocks * BLOCK_LENGTH + s * STRIPE_LENGTH, SECRET + s * SECRET_CONSUME_RATE);
+    }
+    accumulateAvx2(acc, input + len - STRIPE_LENGTH, SECRET + SECRET_SIZE - STRIPE_LENGTH - LAST_STRIPE_SECRET_START);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), acc[0]);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out) + 1, acc[1]);
+}
+#else
+void hashLongAvx2(const uint8_t* input, size_t len, uint64_t* acc) {
+    hashLongScalar(input, len, acc);
+}
+#endif
+
+uint64_t mergeAccumulators(const uint64_t* acc, const uint8_t* secret, uint64_t start) {
+    uint64_t result = start;
+    for (size_t i = 0; i < 4; ++i) {
+        result += multiplyFold(acc[2 * i] ^ read64(secret + 16 * i), acc[2 * i + 1] ^ read64(secret + 16 * i + 8));
+    }
+    return avalanche(result);
+}
+
+Hash128 hashLong(const uint8_t* input, size_t len) {
+    uint64_t acc[8] = {PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1};
+    if (CpuFeatures::avx2()) {
+        hashLongAvx2(input, len, acc);
+    } else {
+        hashLongScalar(input, len, acc);
+    }
+    return {mergeAccumulators(acc, SECRET + MERGE_SECRET_START, len * PRIME64_1),
+            mergeAccumulators(acc, SECRET + SECRET_SIZE - sizeof(acc) - MERGE_SECRET_START, ~(len * PRIME64_2))};
+}
+}
+
+namespace Xxh3 {
+void hash128(const void* data, size_t len, uint8_t out[DIGEST_LENGTH]) {
+    const uint8_t* input = static_cast<const uint8_t*>(data);
+    Hash128 h = len <= 16 ? hash0To16(input, len)
+              : len <= 128 ? hash17To128(input, len)
+              : len <= MIDSIZE_MAX ? hash129To240(input, len)
+              : hashLong(input, len);
+    uint64_t high = __builtin_bswap64(h.high), low = __builtin_bswap64(h.low);
+    std::memcpy(out, &high, sizeof(high));
+    std::memcpy(out + sizeof(high), &low, sizeof(low));
+}
+}
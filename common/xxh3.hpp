@@ -0,0 +1,13 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// XXH3 128 bit hash (xxHash 0.8, seed 0 and the default secret), a fast non cryptographic strong
+// hash. Port of the reference implementation by Yann Collet (BSD 2-Clause), only the one shot
+// 128 bit variant. Long inputs accumulate with AVX2 when the cpu has it
+namespace Xxh3 {
+constexpr size_t DIGEST_LENGTH = 16;
+
+// digest in canonical (big endian, high half first) byte order
+void hash128(const void* data, size_t len, uint8_t out[DIGEST_LENGTH]);
+}
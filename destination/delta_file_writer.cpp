@@ -0,0 +1,174 @@
+#include "delta_file_writer.hpp"
+#include "../common/thread_pool.hpp"
+#include "../common/range_copier.hpp"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <algorithm>
+#include <string>
+
+DeltaFileWriter::DeltaFileWriter(const std::string& path) : path_(path), tempPath_(path + ".sync.tmp"), sliceStarts_{0} {}
+
+DeltaFileWriter::~DeltaFileWriter() {
+    discard();
+}
+
+Result<void> DeltaFileWriter::open() {
+    oldFd_ = ::open(path_.c_str(), O_RDONLY);
+    tempFd_ = ::open(tempPath_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    struct stat old;
+    if (oldFd_ < 0 || tempFd_ < 0 || fstat(oldFd_, &old) != 0) {
+        discard();
+        return Result<void>::Error("File open failed during delta application");
+    }
+    oldSize_ = old.st_size;
+    return Result<void>::Ok();
+}
+
+// pieces are cut where they cross a slice edge
+void DeltaFileWriter::addPiece(Piece piece) {
+    while (piece.length > 0) {
+        uint64_t sliceEnd = (piece.target / SLICE_SIZE + 1) * SLICE_SIZE;
+        uint64_t length = std::min(piece.length, sliceEnd - piece.target);
+        pieces_.push_back({ piece.target, length, piece.source, piece.data });
+        if (piece.target + length == sliceEnd) sliceStarts_.push_back(pieces_.size());
+        piece.target += length;
+        piece.source += length;
+        if (piece.data) piece.data += length;
+        piece.length -= length;
+    }
+}
+
+Result<void> DeltaFileWriter::add(std::vector<DeltaInstruction>&& frame) {
+    for (const DeltaInstruction& delta : frame) {
+        if (delta.type == DeltaType::COPY_RANGE && (delta.offset > oldSize_ || delta.length > oldSize_ - delta.offset)) {
+            return Result<void>::Error("Copy of " + std::to_string(delta.length) + " bytes at " + std::to_string(delta.offset) +
+                                       " runs past the end of the old file (" + std::to_string(oldSize_) + " bytes)");
+        }
+    }
+    for (const DeltaInstruction& delta : frame) {
+        if (delta.type == DeltaType::COPY_RANGE) {
+            if (copyRun_.length > 0 && delta.offset == copyRun_.source + copyRun_.length) {
+                copyRun_.length += delta.length;
+            } else {
+                addPiece(copyRun_);
+                copyRun_ = { outOffset_, delta.length, delta.offset, nullptr };
+            }
+            outOffset_ += delta.length;
+        } else if (delta.type == DeltaType::INSERT) {
+            addPiece(copyRun_);
+            copyRun_.length = 0;
+            addPiece({ outOffset_, delta.data.size(), 0, delta.data.data() });
+            outOffset_ += delta.data.size();
+        }
+    }
+    return writeQueued(std::move(frame));
+}
+
+Result<void> DeltaFileWriter::writeQueued(std::vector<DeltaInstruction>&& frame) {
+    if (!waitWriting()) {
+        return Result<void>::Error("Failed to write the new file");
+    }
+    // the previous frame is written, its literals go now
+    writingFrame_ = std::move(frame);
+    writingPieces_ = std::move(pieces_);
+    pieces_.clear();
+    std::vector<size_t> sliceStarts = std::move(sliceStarts_);
+    sliceStarts_.assign(1, 0);
+    if (writingPieces_.empty()) return Result<void>::Ok();
+    if (sliceStarts.back() != writingPieces_.size()) sliceStarts.push_back(writingPieces_.size());
+
+    // only a hint, cloned ranges replace the preallocated extents anyway
+    uint64_t start = writingPieces_.front().target;
+    fallocate(tempFd_, 0, start, writingPieces_.back().target + writingPieces_.back().length - start);
+
+    ThreadPool& pool = ThreadPool::shared();
+    for (size_t s = 0; s + 1 < sliceStarts.size(); ++s) {
+        writing_.push_back(pool.submit([this](size_t first, size_t last) {
+            RangeCopier copier(oldFd_, tempFd_);
+            for (size_t i = first; i < last; ++i) {
+                const Piece& piece = writingPieces_[i];
+                if (!piece.data) {
+                    if (!copier.copy(piece.source, piece.target, piece.length)) return false;
+                    continue;
+                }
+                for (uint64_t written = 0; written < piece.length; ) {
+                    ssize_t put = pwrite(tempFd_, piece.data + written, piece.length - written, piece.target + written);
+                    if (put < 0 && errno == EINTR) continue;
+                    if (put <= 0) return false;
+                    written += put;
+                }
+            }
+            return true;
+        }, sliceStarts[s], sliceStarts[s + 1]));
+    }
+    return Result<void>::Ok();
+}
+
+// every slice is waited for, even after one failed, the tasks point into this object
+bool DeltaFileWriter::waitWriting() {
+    bool written = true;
+    for (auto& slice : writing_) {
+        try {
+            written = slice.get() && written;
+        } catch (...) {
+            written = false;
+        }
+    }
+    writing_.clear();
+    return written;
+}
+
+Result<void> DeltaFileWriter::finish() {
+    addPiece(copyRun_);
+    copyRun_.length = 0;
+    Result<void> queued = writeQueued({});
+    if (!queued.success || !waitWriting()) {
+        discard();
+        return Result<void>::Error("Failed to write the new file");
+    }
+    writingFrame_.clear();
+
+    // preallocation already set the size, this only matters when it was not supported
+    if (ftruncate(tempFd_, outOffset_) != 0) {
+        discard();
+        return Result<void>::Error("Failed to set the size of the new file");
+    }
+
+    close(oldFd_);
+    oldFd_ = -1;
+    int tempFd = tempFd_;
+    tempFd_ = -1;
+    if (close(tempFd) != 0) {
+        std::remove(tempPath_.c_str());
+        return Result<void>::Error("Failed to write the new file");
+    }
+    finished_ = true;
+    return Result<void>::Ok();
+}
+
+Result<void> DeltaFileWriter::commit() {
+    if (!finished_) return Result<void>::Error("The new file is not finished");
+    finished_ = false;
+    // Atomic swap, rename replaces the old file in one step
+    if (std::rename(tempPath_.c_str(), path_.c_str()) != 0) {
+        std::remove(tempPath_.c_str());
+        return Result<void>::Error("Failed to replace the old file");
+    }
+    return Result<void>::Ok();
+}
+
+void DeltaFileWriter::discard() {
+    waitWriting();
+    if (oldFd_ >= 0) close(oldFd_);
+    oldFd_ = -1;
+    if (tempFd_ >= 0) {
+        close(tempFd_);
+        std::remove(tempPath_.c_str());
+    }
+    tempFd_ = -1;
+    if (finished_) std::remove(tempPath_.c_str());
+    finished_ = false;
+}
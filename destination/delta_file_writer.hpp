@@ -0,0 +1,71 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <future>
+#include <cstdint>
+#include "../common/delta_instruction.hpp"
+#include "../common/result.hpp"
+
+// writes the new file of a delta into <file>.sync.tmp while the delta is still arriving, then
+// renames it over the file once it has been checked. Every piece knows its output offset (prefix sum), so a frame is cut
+// into slices of SLICE_SIZE output bytes that the shared pool writes while the next frame is
+// received. add() waits for the previous frame first, so at most two frames are held, whatever
+// the size of the delta.
+// runs of copies that continue each other are merged, across frames too, so an unchanged stretch
+// of any size becomes a single clone or in kernel copy instead of a read and a write per block
+class DeltaFileWriter {
+public:
+    // a piece cut at a slice edge keeps its offsets relative to the files, source and target move on
+    // together, whatever the sync's block size. Being a multiple of the filesystem block size, an
+    // edge never splits a clone whose offsets were both aligned into unaligned halves
+    static constexpr uint64_t SLICE_SIZE = 16 * 1024 * 1024;
+
+    explicit DeltaFileWriter(const std::string& path);
+    // a new file that was not committed is removed
+    ~DeltaFileWriter();
+    DeltaFileWriter(const DeltaFileWriter&) = delete;
+    DeltaFileWriter& operator=(const DeltaFileWriter&) = delete;
+
+    Result<void> open();
+    // the frame is kept (for its literals) until it is written. A copy from past the end of the
+    // old file fails it before anything of the frame is queued
+    Result<void> add(std::vector<DeltaInstruction>&& frame);
+    // writes what is left, the new file is then complete at tempPath()
+    Result<void> finish();
+    const std::string& tempPath() const { return tempPath_; }
+    // replaces the file with the finished new one
+    Result<void> commit();
+
+private:
+    // part of the new file, a range of the old file (data == nullptr) or literal data
+    struct Piece {
+        uint64_t target;
+        uint64_t length;
+        uint64_t source;
+        const char* data;
+    };
+
+    void addPiece(Piece piece);
+    // waits for the frame being written, then starts writing the queued pieces
+    Result<void> writeQueued(std::vector<DeltaInstruction>&& frame);
+    bool waitWriting();
+    void discard();
+
+    std::string path_;
+    std::string tempPath_;
+    int oldFd_ = -1;
+    uint64_t oldSize_ = 0;
+    int tempFd_ = -1;
+    bool finished_ = false;   // the new file is written and closed, not renamed yet
+    uint64_t outOffset_ = 0;
+    Piece copyRun_{ 0, 0, 0, nullptr };   // copy that the next frame may still extend
+
+    // queued for the next write: pieces and the first piece of every slice
+    std::vector<Piece> pieces_;
+    std::vector<size_t> sliceStarts_;
+
+    // being written by the pool, the frame keeps the literals the pieces point into alive
+    std::vector<DeltaInstruction> writingFrame_;
+    std::vector<Piece> writingPieces_;
+    std::vector<std::future<bool>> writing_;
+};
@@ -1,73 +1,393 @@
 #include "destination_manager.hpp"
-#include <fstream>
 #include<iostream>
 #include "../common/hash_utils.hpp"
+#include "../common/weak_hash.hpp"
 #include "../common/config.hpp"
+#include "../common/mapped_file.hpp"
+#include "../common/thread_pool.hpp"
+#include "../common/signature_cache.hpp"
+#include "../common/cdc_chunker.hpp"
+#include "in_place_applier.hpp"
 #include<stdexcept>
-DestinationManager::DestinationManager(const std::string& destinationPath) : destPath_(destinationPath),blockSize_(Config::BLOCK_SIZE) {}
+#include<algorithm>
+#include<cmath>
+#include<chrono>
+DestinationManager::DestinationManager(const std::string& destinationPath, const TransferOptions& options) : destPath_(destinationPath),blockSize_(Config::MIN_BLOCK_SIZE),options_(options) {}
 
-Result<std::vector<BlockInfo>> DestinationManager::getFileBlockHashes() const{
-    std::ifstream file(destPath_, std::ios::binary);
-    std::vector<BlockInfo> blocks;
+// rsync style, about sqrt(size) so block size and block count grow together
+// (a 10 GB file gets ~100 kb blocks and ~100k of them instead of 80 million 128 byte ones)
+size_t DestinationManager::chooseBlockSize(uint64_t fileSize) {
+    size_t blockSize = static_cast<size_t>(std::sqrt(static_cast<double>(fileSize)));
+    blockSize -= blockSize % Config::BLOCK_SIZE_ALIGN;
+    return std::clamp(blockSize, Config::MIN_BLOCK_SIZE, Config::MAX_BLOCK_SIZE);
+}
+
+// the cache keeps full digests, the signature only carries what its header asks for
+void DestinationManager::truncateStrongHashes(Signature& signature) {
+    for (BlockInfo& block : signature.blocks) {
+        block.strongHash.truncate(signature.header.strongLength);
+    }
+}
+
+Result<Signature> DestinationManager::getFileBlockHashes(){
+    Result<void> hashed = hashFile(nullptr);
+    if (!hashed.success) return Result<Signature>::Error(hashed.message);
+    Signature signature = basis_;
+    truncateStrongHashes(signature);
+    return Result<Signature>::Ok(std::move(signature));
+}
+
+Result<void> DestinationManager::streamFileBlockHashes(const SignatureSink& sink){
+    return hashFile(&sink);
+}
 
-    if (!file) {
+// block size of this transfer, a requested one is only kept within bounds
+size_t DestinationManager::blockSizeFor(uint64_t fileSize) const {
+    if (options_.blockSize != 0) {
+        return std::clamp<size_t>(options_.blockSize, Config::MIN_BLOCK_SIZE, Config::MAX_BLOCK_SIZE);
+    }
+    return chooseBlockSize(fileSize);
+}
+
+void DestinationManager::hashFixedBlocks(const char* data, size_t fileSize, size_t first, size_t last, BlockInfo* blocks) const {
+    size_t batchEnd = std::max(first, std::min(last, fileSize / blockSize_));
+    std::vector<uint32_t> weak(batchEnd - first);
+    std::vector<StrongHash> strong(batchEnd - first);
+    const char* start = data + first * blockSize_;
+    WeakHash::computeBlocks(options_.weakHash, start, blockSize_, weak.size(), weak.data());
+    HashUtils::computeStrongHashes(options_.strongHash, start, blockSize_, strong.size(), strong.data());
+    for (size_t i = first; i < last; ++i) {
+        BlockInfo& block = blocks[i];
+        block.offset = i * blockSize_;
+        block.length = std::min(blockSize_, fileSize - block.offset);
+        if (i < batchEnd) {
+            block.weakHash = weak[i - first];
+            block.strongHash = strong[i - first];
+        } else {
+            block.weakHash = WeakHash::compute(options_.weakHash, data + block.offset, block.length);
+            block.strongHash = HashUtils::computeStrongHash(options_.strongHash, data + block.offset, block.length);
+        }
+    }
+}
+
+// blocks are hashed in parallel straight from the mapping
+// every task fills its own slice of the preallocated result, so no locking or merging is needed.
+// with a sink, finished slices are handed on in order while the later ones are still hashed
+Result<void> DestinationManager::hashFile(const SignatureSink* sink){
+    basisHashed_ = false;
+    // an in place apply that was interrupted is finished before the file is looked at,
+    // one interrupted before its journal was complete never touched it
+    InPlaceApplier::discardUnfinished(destPath_);
+    if (InPlaceApplier::pending(destPath_)) {
+        Result<void> recovered = InPlaceApplier::recover(destPath_);
+        if (!recovered.success) return recovered;
+    }
+
+    MappedFile file;
+    if (!file.open(destPath_)) {
         std::cerr << "Error opening destination file: " << destPath_ << "\n";
-        return Result<std::vector<BlockInfo>>::Error("Failed to open file: " + destPath_);
+        return Result<void>::Error("Failed to open file: " + destPath_);
     }
+    blockSize_ = blockSizeFor(file.size());
 
-    size_t offset = 0;
-    std::vector<char> buffer(blockSize_);
+    Signature& signature = basis_;
+    signature = Signature{};
+    signature.header.chunking = options_.chunking;
+    if (options_.chunking == ChunkingMode::CDC) {
+        signature.header.blockSize = Config::CDC_AVG_CHUNK_SIZE;
+        signature.header.minChunkSize = Config::CDC_MIN_CHUNK_SIZE;
+        signature.header.maxChunkSize = Config::CDC_MAX_CHUNK_SIZE;
+    } else {
+        signature.header.blockSize = blockSize_;
+        signature.header.weakHashAlgorithm = options_.weakHash;
+    }
+    signature.header.fileSize = file.size();
+    signature.header.strongHashAlgorithm = options_.strongHash;
+    const int weakBits = options_.chunking == ChunkingMode::FIXED ? WeakHash::matchBits(options_.weakHash) : 0;
+    signature.header.strongLength = options_.fullStrongHash ? HashUtils::digestLength(options_.strongHash)
+                                  : HashUtils::strongHashLength(options_.strongHash, file.size(), signature.header.blockSize, weakBits);
+
+    // unchanged since it was last hashed, nothing to do
+    // (only fixed blocks are cached, their offsets are implicit)
+    const bool cacheable = options_.chunking == ChunkingMode::FIXED;
+    FileIdentity identity;
+    bool identified = cacheable && SignatureCache::identify(file.fd(), identity);
+    basisIdentity_ = identity;
+    if (identified && SignatureCache::load(identity, blockSize_, options_.weakHash, options_.strongHash, signature.blocks)) {
+        if (sink && (!sink->header(signature.header, signature.blocks.size()) ||
+                     !sink->blocks(signature.blocks.data(), signature.blocks.size()))) {
+            return Result<void>::Error("Failed to hand on the block hashes");
+        }
+        basisHashed_ = true;
+        return Result<void>::Ok();
+    }
+
+    file.adviseSequential();
+    const char* data = file.data();
+    const size_t fileSize = file.size();
 
     try{
-        while (file.read(buffer.data(), blockSize_) || file.gcount() > 0) {
-            size_t bytesRead = file.gcount();
-            uint32_t weakHash = HashUtils::computeWeakHash(buffer.data(), bytesRead);
-            std::string strongHash = HashUtils::computeStrongHash(buffer.data(),bytesRead);
-            blocks.emplace_back(offset, weakHash, strongHash);
-            offset += bytesRead;
+        ThreadPool& pool = ThreadPool::shared();
+
+        // content defined chunks are cut first, fixed blocks follow from the block size
+        std::vector<uint64_t> chunkEnds;
+        size_t blockCount = (fileSize + blockSize_ - 1) / blockSize_;
+        if (options_.chunking == ChunkingMode::CDC) {
+            CdcChunker chunker(signature.header.minChunkSize, signature.header.blockSize, signature.header.maxChunkSize);
+            chunkEnds = chunker.chunkEnds(data, fileSize, pool);
+            blockCount = chunkEnds.size();
+        }
+        if (sink && !sink->header(signature.header, blockCount)) {
+            return Result<void>::Error("Failed to hand on the block hashes");
+        }
+
+        const size_t blocksPerSlice = std::max<size_t>(1, Config::CHUNK_SIZE / signature.header.blockSize);
+        std::vector<BlockInfo>& blocks = signature.blocks;
+        blocks.resize(blockCount);
+        std::vector<std::future<void>> futures;
+        WaitForAll<std::vector<std::future<void>>> waitFutures(futures);
+
+        for (size_t first = 0; first < blockCount; first += blocksPerSlice) {
+            size_t last = std::min(first + blocksPerSlice, blockCount);
+            futures.emplace_back(
+                pool.submit([&, first, last]() {
+                    if (options_.chunking == ChunkingMode::FIXED) {
+                        hashFixedBlocks(data, fileSize, first, last, blocks.data());
+                        return;
+                    }
+                    // chunks are looked up by strong hash alone, no rolling search needs the weak one
+                    for (size_t i = first; i < last; ++i) {
+                        size_t offset = i == 0 ? 0 : chunkEnds[i - 1];
+                        blocks[i].offset = offset;
+                        blocks[i].length = chunkEnds[i] - offset;
+                        blocks[i].strongHash = HashUtils::computeStrongHash(options_.strongHash, data + offset, blocks[i].length);
+                    }
+                })
+            );
+        }
+
+        // several slices go at once when the next ones are already done
+        size_t handedOn = 0;
+        for (size_t k = 0; k < futures.size(); ++k) {
+            futures[k].get();
+            if (!sink) continue;
+            if (k + 1 < futures.size() && futures[k + 1].wait_for(std::chrono::seconds(0)) == std::future_status::ready) continue;
+            size_t done = std::min((k + 1) * blocksPerSlice, blockCount);
+            if (!sink->blocks(blocks.data() + handedOn, done - handedOn)) {
+                return Result<void>::Error("Failed to hand on the block hashes");
+            }
+            handedOn = done;
         }
     }catch(const std::exception& e){
-        return Result<std::vector<BlockInfo>>::Error(std::string("Error while hashing: ") + e.what());
+        return Result<void>::Error(std::string("Error while hashing: ") + e.what());
     }catch(...){
-        return Result<std::vector<BlockInfo>>::Error("Unknown error occurred while hashing file blocks.");
+        return Result<void>::Error("Unknown error occurred while hashing file blocks.");
     }
 
-    // return the result with ok and blocks
-    return Result<std::vector<BlockInfo>>::Ok(blocks);
+    // only cache if the file did not change while it was being hashed
+    FileIdentity after;
+    if (identified && SignatureCache::identify(file.fd(), after) && after == identity) {
+        SignatureCache::store(identity, blockSize_, options_.weakHash, options_.strongHash, signature.blocks);
+    }
+    basisHashed_ = true;
+    return Result<void>::Ok();
 }
 
 Result<void> DestinationManager::applyDelta(const std::vector<DeltaInstruction>& deltas){
-    std::ifstream oldFile(destPath_, std::ios::binary);
-    std::string tempFilePath = destPath_ + ".sync.tmp";
-    std::ofstream tempFile(tempFilePath, std::ios::binary | std::ios::trunc);
+    Result<void> begun = beginApply();
+    if (!begun.success) return begun;
+    Result<void> applied = applyFrame(std::vector<DeltaInstruction>(deltas));
+    if (!applied.success) return applied;
+    return finishApply();
+}
 
-    if (!oldFile.is_open() || !tempFile.is_open()) {
-        return Result<void>::Error("File open failed during delta application");
-    }
+Result<void> DestinationManager::beginApply(){
+    hadOld_ = SignatureCache::identify(destPath_, oldIdentity_);
+    basisCurrent_ = basisHashed_ && hadOld_ && oldIdentity_ == basisIdentity_;
+    collected_.clear();
+    copies_.clear();
+    newSize_ = 0;
+    if (options_.inPlace) return Result<void>::Ok();
+
+    writer_ = std::make_unique<DeltaFileWriter>(destPath_);
+    Result<void> opened = writer_->open();
+    if (!opened.success) writer_.reset();
+    return opened;
+}
 
+// a failed frame drops the new file, later frames and finishApply then fail too
+Result<void> DestinationManager::applyFrame(std::vector<DeltaInstruction>&& frame){
     try{
-        for (const auto& delta : deltas) {
-            if (delta.type == DeltaType::COPY) {
-                oldFile.seekg(delta.offset, std::ios::beg);
-                std::vector<char> buffer(blockSize_);
-                oldFile.read(buffer.data(), blockSize_);
-                tempFile.write(buffer.data(), oldFile.gcount());
-            } else if (delta.type == DeltaType::INSERT) {
-                tempFile.write(delta.data.data(), delta.data.size());
-            }
+        recordCopies(frame);
+        if (options_.inPlace) {
+            collected_.insert(collected_.end(), std::make_move_iterator(frame.begin()), std::make_move_iterator(frame.end()));
+            return Result<void>::Ok();
         }
-
-        oldFile.close();
-        tempFile.close();
-
-        // Atomic swap
-        std::remove(destPath_.c_str());                // Delete old file
-        std::rename(tempFilePath.c_str(), destPath_.c_str()); // Replace with new
+        if (!writer_) return Result<void>::Error("No delta is being applied");
+        Result<void> added = writer_->add(std::move(frame));
+        if (!added.success) writer_.reset();
+        return added;
     }catch(const std::exception &e){
+        writer_.reset();
         return Result<void>::Error(std::string("Exception during delta apply: ") + e.what());
     }catch(...){
+        writer_.reset();
         return Result<void>::Error("Unknown error during delta apply");
     }
+}
+
+Result<void> DestinationManager::finishApply(const StrongHash* expectedDigest){
+    digestMismatch_ = false;
+    Result<void> applied = Result<void>::Ok();
+    if (options_.inPlace) {
+        applied = InPlaceApplier::apply(destPath_, collected_);
+        std::vector<DeltaInstruction>().swap(collected_);
+    } else if (!writer_) {
+        applied = Result<void>::Error("No delta is being applied");
+    } else {
+        try{
+            applied = writer_->finish();
+        }catch(const std::exception &e){
+            applied = Result<void>::Error(std::string("Exception during delta apply: ") + e.what());
+        }catch(...){
+            applied = Result<void>::Error("Unknown error during delta apply");
+        }
+    }
+    // a new file is checked before it replaces the old one
+    if (applied.success) applied = checkNewFile(options_.inPlace ? destPath_ : writer_->tempPath(), expectedDigest);
+    if (applied.success && writer_) applied = writer_->commit();
+    writer_.reset();
+
+    if (hadOld_ && (applied.success || (options_.inPlace && digestMismatch_))) SignatureCache::invalidate(oldIdentity_);
+    if (applied.success) cacheNewSignature();
+    basis_ = Signature{};
+    basisHashed_ = false;
+    std::vector<CopyRun>().swap(copies_);
+    newSignature_ = Signature{};
+    newSigned_ = false;
+    return applied;
+}
 
+// copies that continue each other are one run, like the writer merges them
+void DestinationManager::recordCopies(const std::vector<DeltaInstruction>& frame){
+    for (const DeltaInstruction& delta : frame) {
+        if (delta.type == DeltaType::INSERT) {
+            newSize_ += delta.data.size();
+            continue;
+        }
+        if (!copies_.empty() && copies_.back().target + copies_.back().length == newSize_ &&
+            copies_.back().source + copies_.back().length == delta.offset) {
+            copies_.back().length += delta.length;
+        } else {
+            copies_.push_back({ newSize_, delta.offset, delta.length });
+        }
+        newSize_ += delta.length;
+    }
+}
+
+Signature DestinationManager::signNewFile(const MappedFile& file) const {
+    Signature signature;
+    signature.header = basis_.header;
+    signature.header.fileSize = file.size();
+    const size_t blockCount = (file.size() + blockSize_ - 1) / blockSize_;
+    std::vector<BlockInfo>& blocks = signature.blocks;
+    blocks.resize(blockCount);
+
+    // new block k is derived when one copy covers it and reads a basis block of the same length
+    std::vector<uint8_t> derived(blockCount, 0);
+    if (basisCurrent_ && file.size() == newSize_) {
+        size_t run = 0;
+        for (size_t k = 0; k < blockCount; ++k) {
+            uint64_t offset = k * blockSize_;
+            uint64_t length = std::min<uint64_t>(blockSize_, file.size() - offset);
+            while (run < copies_.size() && copies_[run].target + copies_[run].length <= offset) run++;
+            if (run == copies_.size()) break;
+            const CopyRun& copy = copies_[run];
+            if (copy.target > offset || offset + length > copy.target + copy.length) continue;
+            uint64_t source = copy.source + (offset - copy.target);
+            if (source % blockSize_ != 0 || source / blockSize_ >= basis_.blocks.size()) continue;
+            const BlockInfo& basisBlock = basis_.blocks[source / blockSize_];
+            if (basisBlock.length != length) continue;
+            blocks[k] = basisBlock;
+            blocks[k].offset = offset;
+            derived[k] = 1;
+        }
+    }
+
+    // runs of the other blocks are hashed in parallel, a slice of blocks per task
+    ThreadPool& pool = ThreadPool::shared();
+    const size_t blocksPerSlice = std::max<size_t>(1, Config::CHUNK_SIZE / blockSize_);
+    std::vector<std::future<void>> futures;
+    WaitForAll<std::vector<std::future<void>>> waitFutures(futures);
+    for (size_t first = 0; first < blockCount; first += blocksPerSlice) {
+        size_t last = std::min(first + blocksPerSlice, blockCount);
+        futures.emplace_back(pool.submit([&, first, last]() {
+            for (size_t i = first; i < last; ) {
+                if (derived[i]) {
+                    i++;
+                    continue;
+                }
+                size_t end = i;
+                while (end < last && !derived[end]) end++;
+                hashFixedBlocks(file.data(), file.size(), i, end, blocks.data());
+                i = end;
+            }
+        }));
+    }
+    for (auto& future : futures) future.get();
+    return signature;
+}
+
+Result<void> DestinationManager::checkNewFile(const std::string& path, const StrongHash* expectedDigest){
+    const bool derivable = basisHashed_ && options_.chunking == ChunkingMode::FIXED &&
+                           blockSizeFor(newSize_) == blockSize_ && SignatureCache::enabled();
+    if (!expectedDigest && !derivable) return Result<void>::Ok();
+    try{
+        MappedFile file;
+        if (!file.open(path)) {
+            return expectedDigest ? Result<void>::Error("Failed to open the new file to check it") : Result<void>::Ok();
+        }
+        // the digest is taken over blocks of the signature's block size, whole fixed blocks come from signNewFile
+        StrongHash digest;
+        if (options_.chunking == ChunkingMode::FIXED) {
+            FileIdentity identity, after;
+            bool identified = SignatureCache::identify(file.fd(), identity);
+            Signature signature = signNewFile(file);
+            if (expectedDigest) {
+                std::vector<StrongHash> strong(signature.blocks.size());
+                for (size_t i = 0; i < strong.size(); ++i) strong[i] = signature.blocks[i].strongHash;
+                digest = HashUtils::fileDigest(options_.strongHash, file.size(), strong.data(), strong.size());
+            }
+            if (derivable && identified && SignatureCache::identify(file.fd(), after) && after == identity) {
+                newSignature_ = std::move(signature);
+                newIdentity_ = identity;
+                newSigned_ = true;
+            }
+        } else if (expectedDigest) {
+            digest = HashUtils::fileDigest(options_.strongHash, file.data(), file.size(), Config::CDC_AVG_CHUNK_SIZE);
+        }
+        if (expectedDigest && digest != *expectedDigest) {
+            digestMismatch_ = true;
+            return Result<void>::Error("The new file does not match the digest of the source file");
+        }
+    }catch(const std::exception& e){
+        return Result<void>::Error(std::string("Error while checking the new file: ") + e.what());
+    }catch(...){
+        return Result<void>::Error("Unknown error while checking the new file");
+    }
     return Result<void>::Ok();
-}
\ No newline at end of file
+}
+
+// the new file is the basis of the next sync. Its entry is derived from the delta, when the
+// next sync would cut the file the same way; otherwise that sync hashes the file and caches it.
+// it was signed before the rename, which keeps the identity
+void DestinationManager::cacheNewSignature(){
+    FileIdentity identity;
+    try{
+        if (newSigned_ && SignatureCache::identify(destPath_, identity) && identity == newIdentity_) {
+            SignatureCache::store(identity, blockSize_, options_.weakHash, options_.strongHash, newSignature_.blocks);
+        }
+    }catch(...){
+        // best effort, like every cache operation
+    }
+}
@@ -1,15 +1,77 @@
 #pragma once
 #include<string>
 #include<vector>
+#include<memory>
 #include "../common/block_info.hpp"
 #include "../common/delta_instruction.hpp"
 #include "../common/result.hpp"
+#include "../common/signature.hpp"
+#include "../common/transfer_options.hpp"
+#include "../common/signature_cache.hpp"
+#include "../common/mapped_file.hpp"
+#include "delta_file_writer.hpp"
 class DestinationManager{
 public:
-    DestinationManager(const std::string& destinationPath);
-    Result<std::vector<BlockInfo>> getFileBlockHashes() const;
+    DestinationManager(const std::string& destinationPath, const TransferOptions& options = TransferOptions{});
+    // the block size of the signature is picked here, from the file size or the requested one
+    Result<Signature> getFileBlockHashes();
+    // the same signature handed to sink while the file is still being hashed, so sending it
+    // overlaps hashing. Strong hashes are full length, the header says how much of them counts
+    Result<void> streamFileBlockHashes(const SignatureSink& sink);
+    // every block the last streamFileBlockHashes handed on, with full digests
+    const std::vector<BlockInfo>& hashedBlocks() const { return basis_.blocks; }
+    static size_t chooseBlockSize(uint64_t fileSize);
     Result<void> applyDelta(const std::vector<DeltaInstruction>& deltas);
+    // the same, a frame at a time while the delta is still being received: frames go into the
+    // new file as they come, so memory does not grow with the delta. An in place apply orders
+    // its copies over the whole delta, it collects the frames and runs at finishApply
+    Result<void> beginApply();
+    Result<void> applyFrame(std::vector<DeltaInstruction>&& frame);
+    // with the source's file digest (FILE_DIGEST) the new file replaces the old one only if it
+    // matches. An in place apply is checked after the fact, a mismatch leaves the file as applied
+    Result<void> finishApply(const StrongHash* expectedDigest = nullptr);
+    // the last finishApply failed because the new file did not match the digest: a false match of
+    // truncated strong hashes, syncing again with whole ones (fullStrongHash) fixes it
+    bool digestMismatch() const { return digestMismatch_; }
 private:
+    // copy of the delta, where it lands in the new file
+    struct CopyRun {
+        uint64_t target;
+        uint64_t source;
+        uint64_t length;
+    };
+
+    // fills basis_ with full digests
+    Result<void> hashFile(const SignatureSink* sink);
+    size_t blockSizeFor(uint64_t fileSize) const;
+    // fixed blocks [first, last) of data, the full ones hashed as one batch
+    void hashFixedBlocks(const char* data, size_t fileSize, size_t first, size_t last, BlockInfo* blocks) const;
+    void recordCopies(const std::vector<DeltaInstruction>& frame);
+    // signature of the new file: a block that a copy took whole from an aligned basis block keeps
+    // that block's hashes, only the others (the written ranges) are read and hashed
+    Signature signNewFile(const MappedFile& file) const;
+    // the new file at path is signed when its digest is checked or its cache entry can be derived
+    Result<void> checkNewFile(const std::string& path, const StrongHash* expectedDigest);
+    void cacheNewSignature();
+    static void truncateStrongHashes(Signature& signature);
     std::string destPath_;
     size_t blockSize_;
+    TransferOptions options_;
+    Signature basis_;   // full digests, fixed blocks only: kept until the apply is done
+    bool basisHashed_ = false;
+    FileIdentity basisIdentity_;   // of the file basis_ was taken from
+    bool basisCurrent_ = false;    // the file is still that one when the apply begins
+
+    // apply in progress
+    std::unique_ptr<DeltaFileWriter> writer_;
+    std::vector<DeltaInstruction> collected_;   // in place only
+    std::vector<CopyRun> copies_;
+    uint64_t newSize_ = 0;
+    FileIdentity oldIdentity_;
+    bool hadOld_ = false;
+    bool digestMismatch_ = false;
+    // signed new file, waiting for the cache until it has replaced the old one
+    Signature newSignature_;
+    FileIdentity newIdentity_;
+    bool newSigned_ = false;
 };
\ No newline at end of file
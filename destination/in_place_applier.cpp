@@ -0,0 +1,358 @@
+#include "in_place_applier.hpp"
+#include "../common/range_copier.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <deque>
+#include <set>
+
+namespace {
+    // on disk layout, native byte order since the journal never leaves the machine
+    //   header, stepCount step records, literal data, scratch area for one staged piece
+    constexpr char JOURNAL_MAGIC[4] = {'F', 'S', 'I', 'J'};
+    constexpr uint32_t JOURNAL_VERSION = 1;
+    constexpr uint64_t PIECE_SIZE = 1024 * 1024;   // short moves go through the scratch area in pieces of this size
+
+    enum class StepKind : uint32_t {
+        COPY = 1,          // old range to its new place, the two do not overlap
+        STAGED_COPY = 2,   // piece of a short move, saved in the scratch area first so it can be redone
+        LITERAL = 3        // data kept in the journal
+    };
+
+    struct Step {
+        StepKind kind;
+        uint32_t reserved;
+        uint64_t target;   // offset in the new file
+        uint64_t length;
+        uint64_t from;     // offset in the old file for copies, in the journal for literals
+    };
+
+    struct JournalHeader {
+        char magic[4];
+        uint32_t version;
+        uint64_t newSize;
+        uint64_t stepCount;
+        uint64_t scratchOffset;
+        // progress, rewritten as the copies complete
+        uint64_t nextStep;
+        uint64_t stagedStep;   // step whose piece sits in the scratch area plus one, 0 for none
+    };
+
+    struct CopyNode {
+        uint64_t source;
+        uint64_t target;
+        uint64_t length;
+    };
+
+    // literal of the new file, either insert data or an old range saved to break a cycle
+    struct Literal {
+        uint64_t target;
+        uint64_t length;
+        const char* data;     // nullptr for a saved old range
+        uint64_t source;
+    };
+
+    bool overlaps(uint64_t a, uint64_t aLength, uint64_t b, uint64_t bLength) {
+        return a < b + bLength && b < a + aLength;
+    }
+
+    bool writeAll(int fd, const char* data, size_t length, uint64_t offset) {
+        while (length > 0) {
+            ssize_t put = pwrite(fd, data, length, offset);
+            if (put < 0 && errno == EINTR) continue;
+            if (put <= 0) return false;
+            data += put;
+            offset += put;
+            length -= put;
+        }
+        return true;
+    }
+
+    bool readAll(int fd, char* data, size_t length, uint64_t offset) {
+        while (length > 0) {
+            ssize_t got = pread(fd, data, length, offset);
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) return false;
+            data += got;
+            offset += got;
+            length -= got;
+        }
+        return true;
+    }
+
+    // the renamed journal only survives a crash once its directory entry is on disk
+    void syncDirectoryOf(const std::string& path) {
+        size_t slash = path.find_last_of('/');
+        std::string dir = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+        int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd < 0) return;
+        fsync(fd);
+        close(fd);
+    }
+
+    // copy runs that actually move data, and the literals, in new file order
+    uint64_t splitDelta(const std::vector<DeltaInstruction>& deltas, std::vector<CopyNode>& copies, std::vector<Literal>& literals) {
+        uint64_t target = 0;
+        for (size_t i = 0; i < deltas.size(); ++i) {
+            const DeltaInstruction& delta = deltas[i];
+            if (delta.type == DeltaType::COPY_RANGE) {
+                uint64_t length = delta.length;
+                while (i + 1 < deltas.size() && deltas[i + 1].type == DeltaType::COPY_RANGE &&
+                       deltas[i + 1].offset == delta.offset + length) {
+                    length += deltas[++i].length;
+                }
+                // data already in place is neither read nor written
+                if (delta.offset != target) copies.push_back({ delta.offset, target, length });
+                target += length;
+            } else if (delta.type == DeltaType::INSERT) {
+                if (!delta.data.empty()) literals.push_back({ target, delta.data.size(), delta.data.data(), 0 });
+                target += delta.data.size();
+            }
+        }
+        return target;
+    }
+
+    // a copy has to run before every other copy whose target overlaps its source
+    // returns the copies in a valid order, the ones taken out to break cycles go to broken
+    std::vector<size_t> orderCopies(const std::vector<CopyNode>& copies, std::vector<size_t>& broken) {
+        const size_t n = copies.size();
+        std::vector<std::vector<size_t>> runsBefore(n);
+        std::vector<size_t> waitingOn(n, 0);
+
+        std::vector<size_t> bySource(n);
+        uint64_t maxLength = 0;
+        for (size_t i = 0; i < n; ++i) {
+            bySource[i] = i;
+            maxLength = std::max(maxLength, copies[i].length);
+        }
+        std::sort(bySource.begin(), bySource.end(), [&](size_t a, size_t b) { return copies[a].source < copies[b].source; });
+
+        for (size_t b = 0; b < n; ++b) {
+            // a source that overlaps this target starts at most maxLength before it
+            uint64_t from = copies[b].target > maxLength ? copies[b].target - maxLength : 0;
+            auto it = std::lower_bound(bySource.begin(), bySource.end(), from,
+                                       [&](size_t a, uint64_t value) { return copies[a].source < value; });
+            for (; it != bySource.end() && copies[*it].source < copies[b].target + copies[b].length; ++it) {
+                size_t a = *it;
+                if (a == b || !overlaps(copies[a].source, copies[a].length, copies[b].target, copies[b].length)) continue;
+                runsBefore[a].push_back(b);
+                waitingOn[b]++;
+            }
+        }
+
+        std::vector<size_t> order;
+        std::vector<bool> done(n, false);
+        std::set<std::pair<uint64_t, size_t>> remaining;   // by length, the cheapest one breaks a cycle
+        std::deque<size_t> ready;
+        for (size_t i = 0; i < n; ++i) {
+            remaining.insert({ copies[i].length, i });
+            if (waitingOn[i] == 0) ready.push_back(i);
+        }
+        auto finish = [&](size_t i) {
+            done[i] = true;
+            remaining.erase({ copies[i].length, i });
+            for (size_t b : runsBefore[i]) {
+                if (--waitingOn[b] == 0 && !done[b]) ready.push_back(b);
+            }
+        };
+        while (!remaining.empty()) {
+            if (ready.empty()) {
+                // only cycles left, saving a source up front frees everything waiting on it
+                size_t i = remaining.begin()->second;
+                broken.push_back(i);
+                finish(i);
+                continue;
+            }
+            size_t i = ready.front();
+            ready.pop_front();
+            if (done[i]) continue;
+            order.push_back(i);
+            finish(i);
+        }
+        return order;
+    }
+
+    // one copy as journal steps, a copy overlapping its own source moves from the far end in
+    // pieces no longer than the shift, or through the scratch area when the shift is short
+    void appendCopySteps(const CopyNode& copy, std::vector<Step>& steps) {
+        bool forward = copy.target < copy.source;
+        uint64_t shift = forward ? copy.source - copy.target : copy.target - copy.source;
+        if (shift >= copy.length) {
+            steps.push_back({ StepKind::COPY, 0, copy.target, copy.length, copy.source });
+            return;
+        }
+        StepKind kind = shift >= PIECE_SIZE ? StepKind::COPY : StepKind::STAGED_COPY;
+        uint64_t piece = kind == StepKind::COPY ? shift : PIECE_SIZE;
+        for (uint64_t done = 0; done < copy.length; done += piece) {
+            uint64_t length = std::min(piece, copy.length - done);
+            uint64_t at = forward ? done : copy.length - done - length;
+            steps.push_back({ kind, 0, copy.target + at, length, copy.source + at });
+        }
+    }
+}
+
+std::string InPlaceApplier::journalPath(const std::string& path) {
+    return path + ".sync.journal";
+}
+
+std::string InPlaceApplier::unfinishedJournalPath(const std::string& path) {
+    return journalPath(path) + ".tmp";
+}
+
+void InPlaceApplier::discardUnfinished(const std::string& path) {
+    std::remove(unfinishedJournalPath(path).c_str());
+}
+
+bool InPlaceApplier::pending(const std::string& path) {
+    return access(journalPath(path).c_str(), F_OK) == 0;
+}
+
+Result<void> InPlaceApplier::apply(const std::string& path, const std::vector<DeltaInstruction>& deltas) {
+    if (pending(path)) {
+        return Result<void>::Error("An earlier in place apply of " + path + " was not rolled forward");
+    }
+
+    std::vector<CopyNode> copies;
+    std::vector<Literal> literals;
+    uint64_t newSize = splitDelta(deltas, copies, literals);
+    std::vector<size_t> broken;
+    std::vector<size_t> order = orderCopies(copies, broken);
+    for (size_t i : broken) {
+        literals.push_back({ copies[i].target, copies[i].length, nullptr, copies[i].source });
+    }
+
+    std::vector<Step> steps;
+    for (size_t i : order) appendCopySteps(copies[i], steps);
+    const size_t copySteps = steps.size();
+    uint64_t dataOffset = sizeof(JournalHeader) + (copySteps + literals.size()) * sizeof(Step);
+    for (const Literal& literal : literals) {
+        steps.push_back({ StepKind::LITERAL, 0, literal.target, literal.length, dataOffset });
+        dataOffset += literal.length;
+    }
+
+    JournalHeader header{};
+    std::memcpy(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    header.version = JOURNAL_VERSION;
+    header.newSize = newSize;
+    header.stepCount = steps.size();
+    header.scratchOffset = dataOffset;
+
+    // the journal is complete and on disk before the file is touched
+    std::string tempPath = unfinishedJournalPath(path);
+    int oldFd = open(path.c_str(), O_RDONLY);
+    int journalFd = open(tempPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    bool written = oldFd >= 0 && journalFd >= 0 &&
+                   writeAll(journalFd, reinterpret_cast<const char*>(&header), sizeof(header), 0) &&
+                   writeAll(journalFd, reinterpret_cast<const char*>(steps.data()), steps.size() * sizeof(Step), sizeof(header));
+    if (written) {
+        RangeCopier saver(oldFd, journalFd);
+        for (size_t i = 0; written && i < literals.size(); ++i) {
+            const Literal& literal = literals[i];
+            const Step& step = steps[copySteps + i];
+            written = literal.data ? writeAll(journalFd, literal.data, literal.length, step.from)
+                                   : saver.copy(literal.source, step.from, literal.length);
+        }
+    }
+    written = written && fdatasync(journalFd) == 0;
+    if (oldFd >= 0) close(oldFd);
+    if (journalFd >= 0) close(journalFd);
+    if (!written || std::rename(tempPath.c_str(), journalPath(path).c_str()) != 0) {
+        std::remove(tempPath.c_str());
+        return Result<void>::Error("Failed to write the in place journal for " + path);
+    }
+    syncDirectoryOf(path);
+
+    return recover(path);
+}
+
+// runs the journal from the recorded step on. Every copy reads a source that no earlier step
+// wrote over, and its own write never overlaps it, so the step in flight at a crash is simply
+// redone. Literals are idempotent and only run once all copies are done
+Result<void> InPlaceApplier::recover(const std::string& path) {
+    discardUnfinished(path);
+    int journalFd = open(journalPath(path).c_str(), O_RDWR);
+    if (journalFd < 0) {
+        return Result<void>::Error("Failed to open the in place journal for " + path);
+    }
+    int fd = -1;
+    auto fail = [&](const std::string& message) {
+        if (fd >= 0) close(fd);
+        close(journalFd);
+        return Result<void>::Error(message + ", the journal is kept to retry");
+    };
+
+    JournalHeader header;
+    struct stat st;
+    if (!readAll(journalFd, reinterpret_cast<char*>(&header), sizeof(header), 0) ||
+        std::memcmp(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0 || header.version != JOURNAL_VERSION ||
+        fstat(journalFd, &st) != 0 || header.stepCount > (st.st_size - sizeof(header)) / sizeof(Step) ||
+        header.nextStep > header.stepCount) {
+        return fail("Corrupt in place journal for " + path);
+    }
+    std::vector<Step> steps(header.stepCount);
+    if (!readAll(journalFd, reinterpret_cast<char*>(steps.data()), steps.size() * sizeof(Step), sizeof(header))) {
+        return fail("Failed to read the in place journal for " + path);
+    }
+
+    fd = open(path.c_str(), O_RDWR);
+    if (fd < 0) {
+        return fail("Failed to open " + path + " for in place apply");
+    }
+
+    auto saveProgress = [&](uint64_t nextStep, uint64_t stagedStep) {
+        header.nextStep = nextStep;
+        header.stagedStep = stagedStep;
+        return writeAll(journalFd, reinterpret_cast<const char*>(&header.nextStep),
+                        2 * sizeof(uint64_t), offsetof(JournalHeader, nextStep)) &&
+               fdatasync(journalFd) == 0;
+    };
+
+    RangeCopier copier(fd, fd);
+    std::vector<char> buffer;
+    for (uint64_t k = header.nextStep; k < steps.size(); ++k) {
+        const Step& step = steps[k];
+        if (step.kind == StepKind::COPY) {
+            if (!copier.copy(step.from, step.target, step.length) || fdatasync(fd) != 0 || !saveProgress(k + 1, 0)) {
+                return fail("Failed to move a range of " + path);
+            }
+        } else if (step.kind == StepKind::STAGED_COPY) {
+            buffer.resize(step.length);
+            bool staged = header.stagedStep == k + 1;
+            if (staged) {
+                staged = readAll(journalFd, buffer.data(), step.length, header.scratchOffset);
+            } else {
+                staged = readAll(fd, buffer.data(), step.length, step.from) &&
+                         writeAll(journalFd, buffer.data(), step.length, header.scratchOffset) &&
+                         saveProgress(k, k + 1);
+            }
+            if (!staged || !writeAll(fd, buffer.data(), step.length, step.target) ||
+                fdatasync(fd) != 0 || !saveProgress(k + 1, 0)) {
+                return fail("Failed to move a range of " + path);
+            }
+        } else if (step.kind == StepKind::LITERAL) {
+            buffer.resize(std::min(step.length, PIECE_SIZE));
+            for (uint64_t done = 0; done < step.length; done += buffer.size()) {
+                size_t length = std::min<uint64_t>(buffer.size(), step.length - done);
+                if (!readAll(journalFd, buffer.data(), length, step.from + done) ||
+                    !writeAll(fd, buffer.data(), length, step.target + done)) {
+                    return fail("Failed to write literal data into " + path);
+                }
+            }
+        } else {
+            return fail("Corrupt in place journal for " + path);
+        }
+    }
+
+    if (ftruncate(fd, header.newSize) != 0 || fdatasync(fd) != 0) {
+        return fail("Failed to finish the in place apply of " + path);
+    }
+    close(fd);
+    close(journalFd);
+    std::remove(journalPath(path).c_str());
+    return Result<void>::Ok();
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "../common/delta_instruction.hpp"
+#include "../common/result.hpp"
+
+// applies a delta by rewriting the destination file where it lies, like rsync --inplace,
+// so no second copy of the file is needed and only the regions that change are written.
+//
+// copies read the old file while other steps overwrite it, so they are ordered: a copy runs
+// before anything that writes over its source. Copies that depend on each other in a cycle are
+// broken by saving the source of the smallest one up front and writing it as a literal.
+// A copy that overlaps its own source moves piece by piece from the far end, like memmove.
+// Literal data goes last, once no copy needs the old contents any more.
+//
+// the whole plan, with all literal data, is written to <file>.sync.journal before the file is
+// touched, and the journal records durably which step comes next, so an apply that is interrupted
+// is rolled forward (recover) before the file is used again
+class InPlaceApplier {
+public:
+    static Result<void> apply(const std::string& path, const std::vector<DeltaInstruction>& deltas);
+    static bool pending(const std::string& path);
+    static Result<void> recover(const std::string& path);
+    // a journal still being written when the apply was interrupted, the file was not touched yet
+    static void discardUnfinished(const std::string& path);
+
+private:
+    static std::string journalPath(const std::string& path);
+    static std::string unfinishedJournalPath(const std::string& path);
+};
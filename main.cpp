@@ -2,6 +2,8 @@
 #include "sync/server_mode.hpp"
 #include "sync/client_mode.hpp"
 #include<iostream>
+#include<string>
+#include<cstdlib>
 int main(int argc, char** argv) {
 
     if(argc<2){
@@ -11,7 +13,19 @@ int main(int argc, char** argv) {
 
     std::string mode=argv[1];
     if(mode=="server"){
-        ServerMode server(8080);
+        // server [--max-connections <n>] [--max-active <n>]
+        ServerLimits limits;
+        for(int i=2;i<argc;i+=2){
+            std::string option=argv[i];
+            long value=i+1<argc ? std::atol(argv[i+1]) : 0;
+            if(value<=0 || (option!="--max-connections" && option!="--max-active")){
+                std::cerr << "Usage: server [--max-connections <n>] [--max-active <n>]\n";
+                return 1;
+            }
+            if(option=="--max-connections") limits.maxConnections=value;
+            else limits.maxActiveSessions=value;
+        }
+        ServerMode server(8080,limits);
         server.startServer();
     }else{
         ClientMode client;
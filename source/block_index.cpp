@@ -0,0 +1,152 @@
+#include "block_index.hpp"
+#include "../common/cpu_features.hpp"
+#include <algorithm>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace {
+unsigned log2Ceil(uint64_t v) {
+    unsigned bits = 0;
+    while ((uint64_t(1) << bits) < v) bits++;
+    return bits;
+}
+}
+
+void BlockIndex::begin(uint8_t strongLength, Key key) {
+    strongLength_ = strongLength;
+    key_ = key;
+    keys_.clear();
+    strong_.clear();
+}
+
+void BlockIndex::add(const BlockInfo& block) {
+    keys_.push_back(key_ == Key::WEAK_HASH ? block.weakHash : strongKey(block.strongHash));
+    strong_.insert(strong_.end(), block.strongHash.bytes, block.strongHash.bytes + strongLength_);
+}
+
+void BlockIndex::finish() {
+    const size_t count = keys_.size();
+
+    // 16-32 filter bits per block, at least 8 KB: a small signature costs nothing and false
+    // positives (about blocks / bits of all windows) stay a few percent
+    unsigned filterBits = std::max(16u, log2Ceil(count * 16));
+    filterShift_ = 32 - std::min(filterBits, 32u);
+    filter_.assign((uint64_t(1) << (32 - filterShift_)) / 64, 0);
+    prefetchFilter_ = filter_.size() * sizeof(uint64_t) > FILTER_CACHED_BYTES;
+
+    // about one bucket per block
+    unsigned directoryBits = std::min(log2Ceil(count), 32u);
+    directoryShift_ = 32 - directoryBits;
+    directory_.assign((uint64_t(1) << directoryBits) + 1, 0);
+
+    // [mixed key][block number] in one word. Equal keys are ordered by strong hash, so a key that
+    // many blocks share (a weak hash that only sees part of the block, or repeated content) is
+    // binary searched, and equal strong hashes keep block order so a lookup finds the lowest block
+    std::vector<uint64_t> order(count);
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t k = keys_[i];
+        order[i] = (static_cast<uint64_t>(k * DIRECTORY_MIX) << 32) | i;
+        uint64_t bit = static_cast<uint64_t>(k * FILTER_MIX) >> filterShift_;
+        filter_[bit >> 6] |= uint64_t(1) << (bit & 63);
+    }
+    std::sort(order.begin(), order.end(), [this](uint64_t a, uint64_t b) {
+        if ((a >> 32) != (b >> 32)) return a < b;
+        int strong = std::memcmp(&strong_[(a & UINT32_MAX) * strongLength_], &strong_[(b & UINT32_MAX) * strongLength_], strongLength_);
+        return strong != 0 ? strong < 0 : a < b;
+    });
+
+    std::vector<uint8_t> strongByBlock;
+    strongByBlock.swap(strong_);
+    blocks_.resize(count);
+    entryOf_.resize(count);
+    strong_.resize(count * strongLength_);
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t block = static_cast<uint32_t>(order[i]);
+        keys_[i] = static_cast<uint32_t>(order[i] >> 32);
+        blocks_[i] = block;
+        entryOf_[block] = static_cast<uint32_t>(i);
+        std::memcpy(&strong_[i * strongLength_], &strongByBlock[size_t(block) * strongLength_], strongLength_);
+        directory_[(static_cast<uint64_t>(keys_[i]) >> directoryShift_) + 1]++;
+    }
+    // bucket sizes -> bucket starts
+    for (size_t b = 1; b < directory_.size(); ++b) directory_[b] += directory_[b - 1];
+}
+
+size_t BlockIndex::skipAbsent(const uint32_t* keys, size_t count) const {
+    const size_t PREFETCH_DISTANCE = 16;
+    // the vector kernel leaves the last few keys (or the one it stopped at) to the loops below
+    size_t i = CpuFeatures::avx2() ? skipAbsentAvx2(keys, count) : 0;
+    if (prefetchFilter_) {
+        for (; i + PREFETCH_DISTANCE < count; ++i) {
+            uint64_t ahead = static_cast<uint64_t>(keys[i + PREFETCH_DISTANCE] * FILTER_MIX) >> filterShift_;
+            __builtin_prefetch(&filter_[ahead >> 6]);
+            if (mayContain(keys[i])) return i;
+        }
+    }
+    for (; i < count; ++i) {
+        if (mayContain(keys[i])) return i;
+    }
+    return count;
+}
+
+bool BlockIndex::contains(uint32_t key) const {
+    uint32_t mixed = key * DIRECTORY_MIX;
+    uint64_t bucket = static_cast<uint64_t>(mixed) >> directoryShift_;
+    for (uint32_t i = directory_[bucket]; i < directory_[bucket + 1] && keys_[i] <= mixed; ++i) {
+        if (keys_[i] == mixed) return true;
+    }
+    return false;
+}
+
+uint32_t BlockIndex::find(uint32_t key, const StrongHash& strong) const {
+    if (strong.length != strongLength_) return NOT_FOUND;
+    uint32_t mixed = key * DIRECTORY_MIX;
+    uint64_t bucket = static_cast<uint64_t>(mixed) >> directoryShift_;
+    auto bucketEnd = keys_.begin() + directory_[bucket + 1];
+    auto first = std::lower_bound(keys_.begin() + directory_[bucket], bucketEnd, mixed);
+    auto last = std::upper_bound(first, bucketEnd, mixed);
+    // the entries of this key, by strong hash
+    size_t low = first - keys_.begin(), high = last - keys_.begin();
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (std::memcmp(&strong_[middle * strongLength_], strong.bytes, strongLength_) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low < static_cast<size_t>(last - keys_.begin()) &&
+        std::memcmp(&strong_[low * strongLength_], strong.bytes, strongLength_) == 0) {
+        return blocks_[low];
+    }
+    return NOT_FOUND;
+}
+
+#if defined(__x86_64__)
+// eight keys per step: their filter words are gathered in one instruction (eight loads in flight,
+// so a filter that does not fit the cache needs no prefetching), bits are tested side by side.
+// stops at the first step with a key that may be present, or before the last partial step
+__attribute__((target("avx2")))
+size_t BlockIndex::skipAbsentAvx2(const uint32_t* keys, size_t count) const {
+    const int* words = reinterpret_cast<const int*>(filter_.data());   // bit b is bit b%32 of word b/32
+    const __m256i mix = _mm256_set1_epi32(FILTER_MIX);
+    const __m128i shift = _mm_cvtsi32_si128(filterShift_);
+    const __m256i low5 = _mm256_set1_epi32(31);
+    const __m256i one = _mm256_set1_epi32(1);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i k = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i));
+        __m256i bit = _mm256_srl_epi32(_mm256_mullo_epi32(k, mix), shift);
+        __m256i word = _mm256_i32gather_epi32(words, _mm256_srli_epi32(bit, 5), 4);
+        __m256i set = _mm256_and_si256(_mm256_srlv_epi32(word, _mm256_and_si256(bit, low5)), one);
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(set, one)));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i;
+}
+#else
+size_t BlockIndex::skipAbsentAvx2(const uint32_t*, size_t) const {
+    return 0;
+}
+#endif
@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "../common/block_info.hpp"
+
+// lookup structure over the destination's blocks, probed at every byte the source window slides.
+// plain arrays (struct of arrays) instead of node based hash maps, about 12 bytes per block
+// plus the strong hash:
+//   filter     one bit per key, 16-32 bits per block so most of it stays in cache, turns away nearly every
+//              window whose weak hash is in no block with a single load
+//   directory  top bits of the mixed key -> first entry of that bucket, 1-2 entries per bucket
+//   entries    mixed key, block number and strong hash, sorted by mixed key, then strong hash
+class BlockIndex {
+public:
+    static constexpr uint32_t NOT_FOUND = UINT32_MAX;
+
+    // what blocks are looked up by: the rolling hash of a fixed window, or for content defined
+    // chunks (no rolling search) the first bytes of the strong hash
+    enum class Key { WEAK_HASH, STRONG_HASH };
+
+    BlockIndex() = default;
+    // filled while the signature is still arriving: begin(), add() blocks 0,1,2,... as they come
+    // (their key and strong hash are only stored), finish() sorts them into place before the
+    // first lookup. Every strong hash has strongLength bytes
+    void begin(uint8_t strongLength, Key key);
+    void add(const BlockInfo& block);
+    void finish();
+
+    static uint32_t strongKey(const StrongHash& strong) {
+        uint32_t key;
+        std::memcpy(&key, strong.bytes, sizeof(key));
+        return key;
+    }
+
+    // false: no block has this key. true: probably one has
+    bool mayContain(uint32_t key) const {
+        uint64_t bit = static_cast<uint64_t>(key * FILTER_MIX) >> filterShift_;
+        return (filter_[bit >> 6] >> (bit & 63)) & 1;
+    }
+    // number of leading keys that are surely in no block, the filter words of the keys ahead are
+    // prefetched when the filter is too big for the cache
+    size_t skipAbsent(const uint32_t* keys, size_t count) const;
+    bool contains(uint32_t key) const;
+    // lowest numbered block with this key and strong hash, NOT_FOUND if none
+    uint32_t find(uint32_t key, const StrongHash& strong) const;
+
+    // one expected block checked without a lookup, block < size()
+    size_t size() const { return keys_.size(); }
+    bool blockHasKey(uint32_t block, uint32_t key) const { return keys_[entryOf_[block]] == key * DIRECTORY_MIX; }
+    bool blockHasStrong(uint32_t block, const StrongHash& strong) const {
+        return strong.length == strongLength_ &&
+               std::memcmp(&strong_[size_t(entryOf_[block]) * strongLength_], strong.bytes, strongLength_) == 0;
+    }
+
+private:
+    size_t skipAbsentAvx2(const uint32_t* keys, size_t count) const;
+
+    // odd multipliers, a bijection on 32 bits that spreads the key into the top bits
+    static constexpr uint32_t DIRECTORY_MIX = 0x9E3779B1u;
+    static constexpr uint32_t FILTER_MIX = 0x85EBCA77u;
+    static constexpr size_t FILTER_CACHED_BYTES = 512 * 1024;
+
+    std::vector<uint64_t> filter_ = std::vector<uint64_t>(1, 0);
+    bool prefetchFilter_ = false;
+    unsigned filterShift_ = 32 - 6;
+    std::vector<uint32_t> directory_ = std::vector<uint32_t>(2, 0);
+    unsigned directoryShift_ = 32;
+    std::vector<uint32_t> keys_;      // mixed keys, sorted (until finish: keys in block order)
+    std::vector<uint32_t> blocks_;    // block number of each entry
+    std::vector<uint32_t> entryOf_;   // entry of each block number
+    std::vector<uint8_t> strong_;     // strongLength_ bytes per entry (until finish: per block)
+    uint8_t strongLength_ = 0;
+    Key key_ = Key::WEAK_HASH;
+};
@@ -2,177 +2,492 @@
 #include "../common/hash_utils.hpp"
 #include "../common/thread_pool.hpp"
 #include "../common/config.hpp"
-#include <fstream>
+#include "../common/cdc_chunker.hpp"
+#include "../common/weak_hash.hpp"
 #include<iostream>
 #include<vector>
 #include<deque>
+#include<stdexcept>
+#include<algorithm>
+#include<cstring>
 
 
-SourceManager::SourceManager(const std::string& sourcePath,const std::vector<BlockInfo>& destBlocks) : sourcePath_(sourcePath),destBlocks_(std::move(destBlocks)),blockSize_(Config::BLOCK_SIZE),chunkSize_(Config::CHUNK_SIZE){
-    for(auto blockInfo:destBlocks_){
-        destHashToOffset[{blockInfo.weakHash,blockInfo.strongHash}]=blockInfo.offset;
-        weakHashSet.insert(blockInfo.weakHash);
+SourceManager::SourceManager(const std::string& sourcePath,const Signature& signature) : sourcePath_(sourcePath){
+    beginSignature(signature.header);
+    addBlocks(signature.blocks.data(),signature.blocks.size());
+    finishSignature();
+}
+
+SourceManager::SourceManager(const std::string& sourcePath) : sourcePath_(sourcePath){}
+
+SourceManager::~SourceManager() = default;
+
+SignatureSink SourceManager::signatureSink(){
+    return {
+        [this](const SignatureHeader& header,size_t){ beginSignature(header); return true; },
+        [this](const BlockInfo* blocks,size_t count){ addBlocks(blocks,count); return true; }
+    };
+}
+
+void SourceManager::beginSignature(const SignatureHeader& header){
+    header_=header;
+    blockSize_=header.blockSize;
+    chunkSize_=std::max<size_t>(Config::CHUNK_SIZE,header.blockSize*Config::MIN_BLOCKS_PER_CHUNK);
+    processChunk_=chooseProcessChunk(header.weakHashAlgorithm,header.blockSize);
+    blockCount_=0;
+    chunkOffsets_.assign(1,0);
+    index_.begin(header_.strongLength,header_.chunking==ChunkingMode::CDC ? BlockIndex::Key::STRONG_HASH : BlockIndex::Key::WEAK_HASH);
+}
+
+// FIXED: block i sits at i*blockSize_, a short last block can never match a full window
+// so only the full blocks (a prefix) are indexed. CDC: every chunk, and where it starts
+void SourceManager::addBlocks(const BlockInfo* blocks,size_t count){
+    for(size_t i=0;i<count;++i){
+        const BlockInfo& block=blocks[i];
+        if(header_.chunking==ChunkingMode::CDC){
+            chunkOffsets_.push_back(block.offset+block.length);
+            index_.add(block);
+        }else if(block.length==blockSize_ && index_.size()==blockCount_+i){
+            index_.add(block);
+        }
     }
+    blockCount_+=count;
 }
 
-// Processing in chunks
-// it is confirm that chunkSize>blockSize_
-// chunk is to be very large
-void SourceManager::ProcessChunk(size_t start,size_t chunkId,std::vector<std::vector<DeltaInstruction>> &result) const{
-    std::ifstream file(sourcePath_, std::ios::binary);
-    if (!file) {
-        std::cerr << "Error opening file: " << sourcePath_ << '\n';
-        return;
+void SourceManager::finishSignature(){
+    if(header_.chunking!=ChunkingMode::CDC) chunkOffsets_.clear();
+    index_.finish();
+}
+
+bool SourceManager::useLocalBasis(const std::string& destinationPath){
+    return basis_.open(destinationPath);
+}
+
+namespace {
+// holds back the newest batch so a literal run or a copy run that continues into the next batch
+// becomes a single instruction, the held insert only grows up to maxHeldInsert bytes
+class RunMerger {
+public:
+    RunMerger(const DeltaSink& sink,size_t maxHeldInsert) : sink_(sink),maxHeldInsert_(maxHeldInsert) {}
+
+    // false once the sink stopped
+    bool push(std::vector<DeltaInstruction>&& next){
+        if(next.empty()) return true;
+        if(!held_.empty() && join(held_.back(),next.front())){
+            next.erase(next.begin());
+            const DeltaInstruction& last=held_.back();
+            if(next.empty() && (last.type==DeltaType::COPY_RANGE || last.data.size()<maxHeldInsert_)) return true;
+        }
+        if(!held_.empty() && !sink_(std::move(held_))) return false;
+        held_=std::move(next);
+        return true;
     }
 
-    file.seekg(0, std::ios::end);         // move to end
-    size_t fileSize = file.tellg();       // get position = size
-    file.seekg(start, std::ios::beg);     // seek back to start for reading
+    bool finish(){
+        return held_.empty() || sink_(std::move(held_));
+    }
 
-    if (start >= fileSize) {
-        std::cerr << "Start offset " << start << " is beyond file size for chunk " << chunkId<< " File size"<<fileSize << '\n';
+private:
+    static bool join(DeltaInstruction& last,const DeltaInstruction& first){
+        if(last.type==DeltaType::INSERT && first.type==DeltaType::INSERT){
+            last.data.append(first.data);
+            return true;
+        }
+        if(last.type==DeltaType::COPY_RANGE && first.type==DeltaType::COPY_RANGE && last.offset+last.length==first.offset){
+            last.length+=first.length;
+            return true;
+        }
+        return false;
     }
 
-    std::vector<DeltaInstruction> deltas;  // to store the delta instructions
+    const DeltaSink& sink_;
+    size_t maxHeldInsert_;
+    std::vector<DeltaInstruction> held_;
+};
+
+// block size arithmetic of the matcher, a power of two needs no division
+struct AnyBlockSize {
+    size_t size;
+    size_t remainder(size_t bytes) const { return bytes % size; }
+};
+struct PowerOfTwoBlockSize {
+    size_t size;
+    size_t remainder(size_t bytes) const { return bytes & (size - 1); }
+};
+}
+
+SourceManager::ChunkProcessor SourceManager::chooseProcessChunk(WeakHashAlgorithm algorithm,size_t blockSize){
+    // [weak hash][block size is a power of two]
+    static constexpr ChunkProcessor PROCESSORS[WEAK_HASH_ALGORITHM_COUNT][2]={
+        {&SourceManager::ProcessChunk<PolynomialHash,AnyBlockSize>,&SourceManager::ProcessChunk<PolynomialHash,PowerOfTwoBlockSize>},
+        {&SourceManager::ProcessChunk<AdlerHash,AnyBlockSize>,&SourceManager::ProcessChunk<AdlerHash,PowerOfTwoBlockSize>},
+        {&SourceManager::ProcessChunk<BuzHash,AnyBlockSize>,&SourceManager::ProcessChunk<BuzHash,PowerOfTwoBlockSize>},
+        {&SourceManager::ProcessChunk<GearHash,AnyBlockSize>,&SourceManager::ProcessChunk<GearHash,PowerOfTwoBlockSize>},
+    };
+    const bool powerOfTwo=blockSize!=0 && (blockSize&(blockSize-1))==0;
+    return PROCESSORS[static_cast<size_t>(algorithm)][powerOfTwo ? 1 : 0];
+}
+
+// number of source bytes covered by an instruction
+static size_t sourceLength(const DeltaInstruction& inst){
+    if(inst.type==DeltaType::COPY_RANGE) return inst.length;
+    return inst.data.size();
+}
 
-    std::vector<char> buffer(blockSize_);
-    std::vector<char> pendingInsert;  // to be inserted when no match has been found
+// Processing in chunks
+// windows start at [start,limit) but may read up to blockSize_-1 bytes past limit, so a block
+// straddling the chunk edge can still match. end is the first window start past the chunk.
+// with resyncWith the scan stops as soon as it reaches a window start that the earlier scan of
+// the same chunk also visited, from there on both scans are identical (up to which of several equal
+// blocks a predicted match names) and the old result is reused
+// consecutive matched blocks are merged into one copy range as they are found. After a match the
+// block that follows it in the destination is the likely next one, it is checked directly (strong
+// hash, or the bytes of a local basis) before any rolling hash is computed, so an unchanged
+// stretch costs one strong hash or memcmp per block
+// the window is just a pointer into the mapping, literal bytes are tracked as a range and
+// copied out once when the run ends
+template<class WeakHash,class BlockSize>
+ChunkDelta SourceManager::ProcessChunk(const SharedMapping& mapping,size_t start,size_t limit,const ChunkDelta* resyncWith) const{
+    const MappedFile& file=*mapping;
+    ChunkDelta chunk;
+    chunk.start=start;
+    chunk.limit=limit;
+    chunk.end=start;
+    if (start >= limit) return chunk;   // an earlier match already covered this whole chunk
 
-    size_t offset = start,startIndex=0;   // startIndex is for correct order in buffer due to circular shift
-    size_t totalBytesRead=0; // will be helpful in keeping track so that we do not step in the next chunk
-    file.read(buffer.data(), blockSize_);
+    const char* data=file.data();
+    const size_t fileSize=file.size();
+    file.adviseWillNeed(start, limit - start + blockSize_);
 
-    size_t bytesInWindow = file.gcount();
-    totalBytesRead+=bytesInWindow;
-    if (bytesInWindow == 0) return ;
+    const BlockSize block{blockSize_};
+    std::vector<DeltaInstruction>& deltas = chunk.instructions;  // to store the delta instructions
 
-    uint32_t hash = HashUtils::computeWeakHash(buffer.data(), bytesInWindow);
+    size_t offset = start;          // start of the current window
+    size_t literalStart = start;    // unmatched bytes are [literalStart,offset)
+    auto flushLiteral=[&](size_t upTo){
+        if(upTo>literalStart) deltas.push_back(DeltaInstruction::makeInsert(LiteralBytes::fromFile(mapping,literalStart,upTo-literalStart)));
+        literalStart=upTo;
+    };
 
-    const uint64_t base = 257;
-    const uint64_t mod = 1e9 + 7;
-    uint64_t basePow = 1;
-    for (size_t i = 1; i < blockSize_; ++i)
-        basePow = (basePow * base) % mod;
+    // resync cursor over the earlier result, it only moves forward as offset does
+    size_t resyncInd=0,resyncPos=resyncWith ? resyncWith->start : 0;
 
-    while(true){
-        if(bytesInWindow<blockSize_){
-            // just insert that complete window pendingInsert and that will be at the end of file
-            for(size_t ind=0;ind<bytesInWindow;ind++) pendingInsert.push_back(buffer[ind]);
-            break;
+    // weak hashes come from a batch computed ahead for every window start, [batchStart,batchEnd).
+    // a batch is big enough that setting up its lanes (a window each) stays a small part of it,
+    // a match that jumps past the batch starts the next one where it lands
+    const size_t HASH_BATCH_MIN = 64 * 1024, HASH_BATCH_MAX = 1024 * 1024;
+    const size_t windowEnd = fileSize >= blockSize_ ? std::min(limit, fileSize - blockSize_ + 1) : 0;
+    const size_t batchSize = std::clamp(RollingHash::LANES * blockSize_ * 8, HASH_BATCH_MIN, HASH_BATCH_MAX);
+    const WeakHash roller(blockSize_);
+    std::vector<uint32_t> hashes;
+    size_t batchStart = 0, batchEnd = 0;
+
+    // destination block expected at offset, the one after the last match. A chunk starts out
+    // expecting the block at its own offset, unchanged data usually has not moved
+    const uint32_t NO_PREDICTION = BlockIndex::NOT_FOUND;
+    uint32_t predicted = block.remainder(start) == 0 ? static_cast<uint32_t>(std::min<size_t>(start / blockSize_, NO_PREDICTION)) : NO_PREDICTION;
+    const bool strongSuffices = HashUtils::strongHashSuffices(header_.strongLength, fileSize / blockSize_ + 1);
+    auto isPredicted = [&](const char* window){
+        if(basis_.isOpen()){
+            size_t basisOffset = static_cast<size_t>(predicted) * blockSize_;
+            return basisOffset + blockSize_ <= basis_.size() && std::memcmp(window, basis_.data() + basisOffset, blockSize_) == 0;
         }
+        if(!strongSuffices && !index_.blockHasKey(predicted, roller.hash(reinterpret_cast<const uint8_t*>(window)))) return false;
+        return index_.blockHasStrong(predicted, HashUtils::computeStrongHash(header_.strongHashAlgorithm, window, blockSize_, header_.strongLength));
+    };
 
-        bool matched=false;
-        auto it=weakHashSet.find(hash);
-        if(it!=weakHashSet.end()){
-            // weak hash matches something lets confirm with strong hash
-            std::vector<char> snapshot(blockSize_);
-            for (size_t i = 0; i < blockSize_; ++i) {
-                snapshot[i] = buffer[(startIndex + i) % blockSize_];
+    while(offset<limit){
+        if(resyncWith){
+            const std::vector<DeltaInstruction>& old=resyncWith->instructions;
+            while(resyncInd<old.size() && resyncPos+sourceLength(old[resyncInd])<=offset){
+                resyncPos+=sourceLength(old[resyncInd]);
+                resyncInd++;
             }
-            std::string strongHashForWindow=HashUtils::computeStrongHash(snapshot.data(),blockSize_);
-            auto ptr=destHashToOffset.find({hash,strongHashForWindow});
-            if(ptr!=destHashToOffset.end()){
-                // exact match found
-                matched=true;
-                if (!pendingInsert.empty()) {
-                    // these characters are not matched and need to be inserted
-                    deltas.push_back(DeltaInstruction::makeInsert(pendingInsert));
-                    pendingInsert.clear();
+            // the earlier scan visited every byte of its inserts and every block start inside its copy runs
+            if(resyncInd<old.size() && (old[resyncInd].type==DeltaType::INSERT || block.remainder(offset-resyncPos)==0)){
+                // converged, take the rest from the earlier scan
+                if(old[resyncInd].type==DeltaType::INSERT){
+                    // the old insert continues our literal run
+                    flushLiteral(resyncPos+old[resyncInd].data.size());
+                }else{
+                    // the rest of the old copy run
+                    flushLiteral(offset);
+                    size_t skipped=offset-resyncPos;
+                    appendCopyRange(deltas,old[resyncInd].offset+skipped,old[resyncInd].length-skipped);
                 }
-                deltas.push_back(DeltaInstruction::makeCopy(ptr->second));
+                resyncInd++;
+                deltas.insert(deltas.end(),old.begin()+resyncInd,old.end());
+                chunk.end=resyncWith->end;
+                return chunk;
             }
         }
 
-        if(matched){
-            // then need to skip the offset by window size
-            offset += blockSize_;
-            file.clear();
-            file.seekg(offset);
-            size_t bytesToRead=std::min(blockSize_,chunkSize_-totalBytesRead);  // if going outside chunk then don't read it
-            file.read(buffer.data(), bytesToRead);
-            bytesInWindow = file.gcount();
-            totalBytesRead+=bytesInWindow;
-            if (bytesInWindow==0) break;
-            startIndex=0;
-            hash = HashUtils::computeWeakHash(buffer.data(), bytesInWindow);
-        }else{
-            // emit 1 byte insert
-            pendingInsert.push_back(buffer[startIndex]);
-
-            // Slide window
-            char outByte = buffer[startIndex];
-            char inByte;
-            file.read(&inByte, 1);
-            totalBytesRead++;
-            if (!file||totalBytesRead>chunkSize_) {
-                // all remaining thing to be inserted in pending 
-                int tempInd=(startIndex+1)%blockSize_;
-                while(tempInd!=startIndex){
-                    pendingInsert.push_back(buffer[tempInd]);
-                    tempInd=(tempInd+1)%blockSize_;
-                }
-                break;
+        if(offset+blockSize_>fileSize){
+            // no full window left, rest of the file is literal
+            offset=fileSize;
+            break;
+        }
+
+        if(predicted<index_.size()){
+            if(isPredicted(data+offset)){
+                flushLiteral(offset);
+                appendCopyRange(deltas,static_cast<size_t>(predicted)*blockSize_,blockSize_);
+                predicted++;
+                offset += blockSize_;
+                literalStart = offset;
+                continue;
+            }
+            predicted = NO_PREDICTION;
+        }
+
+        if(offset<batchStart || offset>=batchEnd){
+            batchStart=offset;
+            batchEnd=std::min(windowEnd,offset+batchSize);
+            hashes.resize(batchEnd-batchStart);
+            roller.hashWindows(data+batchStart,batchEnd-batchStart,hashes.data());
+        }
+        // windows whose weak hash is in no block, most of an unmatched region, only touch the filter
+        offset+=index_.skipAbsent(&hashes[offset-batchStart],batchEnd-1-offset);
+        const uint32_t hash=hashes[offset-batchStart];
+
+        if(index_.mayContain(hash) && index_.contains(hash)){
+            // weak hash matches something lets confirm with strong hash
+            StrongHash strongHashForWindow=HashUtils::computeStrongHash(header_.strongHashAlgorithm,data+offset,blockSize_,header_.strongLength);
+            uint32_t matched=index_.find(hash,strongHashForWindow);
+            if(matched!=BlockIndex::NOT_FOUND){
+                // exact match found, pending bytes are not matched and need to be inserted
+                flushLiteral(offset);
+                appendCopyRange(deltas,static_cast<size_t>(matched)*blockSize_,blockSize_);
+
+                // skip the offset by window size, next window may run past limit
+                offset += blockSize_;
+                literalStart = offset;
+                predicted = matched + 1;
+                continue;
             }
-            offset += 1;
-            buffer[startIndex] = inByte;
-            startIndex = (startIndex + 1) % blockSize_;
-            
-            hash = (mod + hash - (static_cast<uint64_t>(outByte) * basePow) % mod) % mod;
-            hash = (hash * base + static_cast<unsigned char>(inByte)) % mod;
         }
-    }
 
-    if (!pendingInsert.empty())
-        deltas.push_back(DeltaInstruction::makeInsert(pendingInsert));
-    result[chunkId]=std::move(deltas);
+        // Slide window by one byte
+        offset += 1;
+    }
 
+    flushLiteral(offset);
+    chunk.end=offset;
+    return chunk;
 }
 
 
 Result<std::vector<DeltaInstruction>> SourceManager::getDelta() const{
-    try{
-        const size_t THREAD_COUNT = 4;
+    std::vector<DeltaInstruction> combinedResult;
+    Result<void> res=streamDelta([&combinedResult](std::vector<DeltaInstruction>&& chunk){
+        combinedResult.insert(combinedResult.end(), std::make_move_iterator(chunk.begin()), std::make_move_iterator(chunk.end()));
+        return true;
+    });
+    if(!res.success){
+        return Result<std::vector<DeltaInstruction>>::Error(res.message);
+    }
+    return Result<std::vector<DeltaInstruction>>::Ok(std::move(combinedResult));
+}
+
+// chunks are processed in parallel but handed on strictly in order
+// at most Config::MAX_PENDING_CHUNKS results are kept waiting, so memory stays bounded
+// while the earlier chunks are still being consumed (e.g. sent over the network).
+// FIXED: chunks of chunkSize_ bytes, rolled and looked up by weak hash
+// CDC: both sides cut their files by content, so a chunk either exists in the destination
+// with the same hash or is literal. One lookup per chunk, no rolling search
+class SourceManager::DeltaStream {
+public:
+    DeltaStream(const SourceManager& source,SharedMapping file,ThreadPool& pool);
+    // false once the whole delta has been handed out
+    bool next(std::vector<DeltaInstruction>& batch);
+
+private:
+    bool nextChunk(std::vector<DeltaInstruction>& instructions);
+    void submitChunks();
+    ChunkDelta matchCdcChunks(size_t first,size_t last) const;
 
-        std::ifstream file(sourcePath_, std::ios::binary | std::ios::ate);
-        if (!file) {
-            return Result<std::vector<DeltaInstruction>>::Error("Failed to open source file");
+    const SourceManager& source_;
+    SharedMapping file_;
+    ThreadPool& pool_;
+    const bool cdc_;
+    std::vector<uint64_t> chunkEnds_;   // CDC only
+    size_t totalChunks_=0;
+    size_t nextChunk_=0;
+    size_t scanEnd_=0;   // where the previous chunk's scan stopped
+    std::deque<std::future<ChunkDelta>> pending_;   // reorder buffer, front is the next chunk to emit
+    WaitForAll<std::deque<std::future<ChunkDelta>>> waitPending_{pending_};
+    std::deque<std::vector<DeltaInstruction>> merged_;   // out of the merger, not handed out yet
+    DeltaSink collect_;
+    RunMerger merger_;
+    bool finished_=false;
+};
+
+SourceManager::DeltaStream::DeltaStream(const SourceManager& source,SharedMapping file,ThreadPool& pool)
+    : source_(source),file_(std::move(file)),pool_(pool),cdc_(source.header_.chunking==ChunkingMode::CDC),
+      collect_([this](std::vector<DeltaInstruction>&& batch){ merged_.push_back(std::move(batch)); return true; }),
+      merger_(collect_,source.chunkSize_){
+    const size_t fileSize=file_->size();
+    if(cdc_){
+        const SignatureHeader& header=source.header_;
+        CdcChunker chunker(header.minChunkSize,header.blockSize,header.maxChunkSize);
+        chunkEnds_=chunker.chunkEnds(file_->data(),fileSize,pool_);
+        totalChunks_=chunkEnds_.size();
+    }else{
+        totalChunks_=fileSize/source.chunkSize_;
+        if(fileSize%source.chunkSize_) totalChunks_++;  // last chunk not complete
+    }
+}
+
+bool SourceManager::DeltaStream::next(std::vector<DeltaInstruction>& batch){
+    while(merged_.empty() && !finished_){
+        std::vector<DeltaInstruction> instructions;
+        if(nextChunk(instructions)){
+            merger_.push(std::move(instructions));
+        }else{
+            merger_.finish();
+            finished_=true;
         }
-        size_t fileSize = file.tellg();
-        size_t totalChunks = fileSize/chunkSize_;
-        if(fileSize%chunkSize_) totalChunks++;  // last chunk not complete
+    }
+    if(merged_.empty()) return false;
+    batch=std::move(merged_.front());
+    merged_.pop_front();
+    return true;
+}
+
+// the tasks ahead are topped up again as soon as one result is taken, they go on matching
+// while the consumer is busy with it (or waits for its peer)
+bool SourceManager::DeltaStream::nextChunk(std::vector<DeltaInstruction>& instructions){
+    submitChunks();
+    if(pending_.empty()) return false;
+    ChunkDelta chunk=pending_.front().get();
+    pending_.pop_front();
+    submitChunks();
+
+    // previous chunk ran past our start, rescan from where it stopped
+    if(!cdc_ && scanEnd_!=chunk.start){
+        chunk=(source_.*source_.processChunk_)(file_,scanEnd_,chunk.limit,&chunk);
+    }
+    scanEnd_=chunk.end;
+    instructions=std::move(chunk.instructions);
+    return true;
+}
 
-        std::vector<std::vector<DeltaInstruction>> chunksResult(totalChunks);
+void SourceManager::DeltaStream::submitChunks(){
+    const size_t chunkSize=source_.chunkSize_;
+    while(nextChunk_<totalChunks_ && pending_.size()<Config::MAX_PENDING_CHUNKS){
+        if(cdc_){
+            // about chunkSize bytes of chunks per task
+            size_t first=nextChunk_;
+            size_t batchStart=first==0 ? 0 : chunkEnds_[first-1];
+            while(nextChunk_<totalChunks_ && chunkEnds_[nextChunk_]-batchStart<chunkSize) nextChunk_++;
+            if(nextChunk_<totalChunks_) nextChunk_++;
+            size_t last=nextChunk_;
+            pending_.emplace_back(pool_.submit([this,first,last](){
+                return matchCdcChunks(first,last);
+            }));
+            continue;
+        }
+        size_t start=nextChunk_*chunkSize;
+        size_t limit=std::min(start+chunkSize,file_->size());
+        nextChunk_++;
+        pending_.emplace_back(
+            pool_.submit([this,start,limit](){
+                return (source_.*source_.processChunk_)(file_,start,limit,nullptr);
+            })
+        );
+    }
+}
 
-        ThreadPool pool(THREAD_COUNT);
-        std::vector<std::future<void>> futures;
+// chunks [first,last) matched by one task
+ChunkDelta SourceManager::DeltaStream::matchCdcChunks(size_t first,size_t last) const{
+    const char* data=file_->data();
+    const SignatureHeader& header=source_.header_;
+    ChunkDelta result;
+    std::vector<DeltaInstruction>& deltas=result.instructions;
+    size_t literalStart=first==0 ? 0 : chunkEnds_[first-1];
+    for(size_t i=first;i<last;++i){
+        size_t offset=i==0 ? 0 : chunkEnds_[i-1];
+        size_t len=chunkEnds_[i]-offset;
+        StrongHash strong=HashUtils::computeStrongHash(header.strongHashAlgorithm,data+offset,len,header.strongLength);
+        uint32_t chunk=source_.index_.find(BlockIndex::strongKey(strong),strong);
+        if(chunk==BlockIndex::NOT_FOUND || source_.chunkOffsets_[chunk+1]-source_.chunkOffsets_[chunk]!=len) continue;  // stays literal
 
-        for (size_t chunkId = 0; chunkId < totalChunks; ++chunkId) {
-            size_t start = chunkId * chunkSize_;
+        if(offset>literalStart) deltas.push_back(DeltaInstruction::makeInsert(LiteralBytes::fromFile(file_,literalStart,offset-literalStart)));
+        appendCopyRange(deltas,source_.chunkOffsets_[chunk],len);
+        literalStart=chunkEnds_[i];
+    }
+    size_t end=last==0 ? 0 : chunkEnds_[last-1];
+    if(end>literalStart) deltas.push_back(DeltaInstruction::makeInsert(LiteralBytes::fromFile(file_,literalStart,end-literalStart)));
+    return result;
+}
 
-            futures.emplace_back(
-                pool.submit([=,&chunksResult]() {
-                    this->ProcessChunk(start, chunkId, chunksResult);
-                })
-            );
+Result<void> SourceManager::streamDelta(const DeltaSink& sink) const{
+    try{
+        auto file = std::make_shared<MappedFile>();
+        if (!file->open(sourcePath_)) {
+            return Result<void>::Error("Failed to open source file");
         }
+        file->adviseSequential();
 
-        // Wait for all threads to complete
-        for (auto& f : futures) {
-            f.get();
+        DeltaStream stream(*this, std::move(file), ThreadPool::shared());
+        std::vector<DeltaInstruction> batch;
+        while (stream.next(batch)) {
+            if (!sink(std::move(batch))) {
+                return Result<void>::Error("Delta consumer stopped the generation");
+            }
         }
+        return Result<void>::Ok();
 
-        std::vector<DeltaInstruction> combinedResult;
-        for (const auto& chunk : chunksResult) {
-            combinedResult.insert(combinedResult.end(), chunk.begin(), chunk.end());
+    }catch(const std::exception &e){
+        return Result<void>::Error(std::string("Exception in streamDelta: ") + e.what());
+    }catch(...){
+        return Result<void>::Error("Unknown error occurred in streamDelta()");
+    }
+}
+
+Result<void> SourceManager::beginDelta(){
+    try{
+        delta_.reset();
+        auto file = std::make_shared<MappedFile>();
+        if (!file->open(sourcePath_)) {
+            return Result<void>::Error("Failed to open source file");
         }
-        
-        return Result<std::vector<DeltaInstruction>>::Ok(combinedResult);
+        file->adviseSequential();
+        delta_ = std::make_unique<DeltaStream>(*this, std::move(file), ThreadPool::shared());
+        return Result<void>::Ok();
+    }catch(const std::exception &e){
+        return Result<void>::Error(std::string("Exception in beginDelta: ") + e.what());
+    }catch(...){
+        return Result<void>::Error("Unknown error occurred in beginDelta()");
+    }
+}
 
+Result<bool> SourceManager::nextDelta(std::vector<DeltaInstruction>& batch){
+    if (!delta_) return Result<bool>::Error("No delta is being generated");
+    try{
+        bool more = delta_->next(batch);
+        if (!more) delta_.reset();
+        return Result<bool>::Ok(more);
     }catch(const std::exception &e){
-        return Result<std::vector<DeltaInstruction>>::Error(std::string("Exception in getDelta: ") + e.what());
+        delta_.reset();
+        return Result<bool>::Error(std::string("Exception in nextDelta: ") + e.what());
     }catch(...){
-        return Result<std::vector<DeltaInstruction>>::Error("Unknown error occurred in getDelta()");
+        delta_.reset();
+        return Result<bool>::Error("Unknown error occurred in nextDelta()");
     }
-    
+}
 
-}
\ No newline at end of file
+Result<StrongHash> SourceManager::fileDigest() const{
+    try{
+        MappedFile file;
+        if (!file.open(sourcePath_)) {
+            return Result<StrongHash>::Error("Failed to open source file");
+        }
+        file.adviseSequential();
+        return Result<StrongHash>::Ok(HashUtils::fileDigest(header_.strongHashAlgorithm, file.data(), file.size(), header_.blockSize));
+    }catch(const std::exception &e){
+        return Result<StrongHash>::Error(std::string("Exception in fileDigest: ") + e.what());
+    }catch(...){
+        return Result<StrongHash>::Error("Unknown error occurred in fileDigest()");
+    }
+}
@@ -1,37 +1,70 @@
 #pragma once
 #include<string>
 #include<vector>
-#include <unordered_map>
-#include<unordered_set>
-#include<utility>
+#include<functional>
+#include<memory>
 #include "../common/block_info.hpp"
 #include "../common/delta_instruction.hpp"
 #include "../common/result.hpp"
+#include "../common/mapped_file.hpp"
+#include "../common/signature.hpp"
+#include "block_index.hpp"
 
-struct PairHash {
-    template <class T1, class T2>
-    std::size_t operator () (const std::pair<T1, T2>& p) const {
-        auto h1 = std::hash<T1>{}(p.first);
-        auto h2 = std::hash<T2>{}(p.second);
+class ThreadPool;
 
-        // A common way to combine hashes (boost::hash_combine equivalent)
-        // You can experiment with other combinations if needed, but this is a good starting point.
-        return h1 ^ (h2 << 1);
-    }
+// delta of one chunk of the source file
+struct ChunkDelta {
+    size_t start = 0;   // first window start of the scan
+    size_t limit = 0;   // windows start before this offset
+    size_t end = 0;     // first window start past the chunk, the next chunk picks up from here
+    std::vector<DeltaInstruction> instructions;
 };
 
-
 class SourceManager{
 public:
-    SourceManager(const std::string& sourcePath,const std::vector<BlockInfo>& destBlocks);
+    SourceManager(const std::string& sourcePath,const Signature& signature);
+    // the signature can also be taken in while it arrives: the sink indexes every batch as it
+    // comes, finishSignature() completes the index before any delta is generated
+    explicit SourceManager(const std::string& sourcePath);
+    ~SourceManager();
+    SignatureSink signatureSink();
+    void finishSignature();
+    size_t blockCount() const { return blockCount_; }
     Result<std::vector<DeltaInstruction>> getDelta() const;
+    Result<void> streamDelta(const DeltaSink& sink) const;
+    // the same delta a batch at a time, for a consumer that cannot always take the next one (the
+    // event driven server parks a session whose client reads slowly). Chunks ahead of the
+    // consumer go on being matched, up to Config::MAX_PENDING_CHUNKS of them
+    Result<void> beginDelta();
+    // false once the delta is complete, batch is then left alone
+    Result<bool> nextDelta(std::vector<DeltaInstruction>& batch);
+    // digest of the source file the destination checks its new file against (FILE_DIGEST),
+    // over blocks of the signature's block size
+    Result<StrongHash> fileDigest() const;
+    // the destination file the signature was made from is on this machine (local sync),
+    // expected blocks are then compared byte for byte instead of by hash
+    bool useLocalBasis(const std::string& destinationPath);
 
 private:
-    void ProcessChunk(size_t start,size_t chunkId,std::vector<std::vector<DeltaInstruction>> &result) const;
+    // literals point into the mapping and keep it alive, the source bytes are never copied
+    using SharedMapping = std::shared_ptr<const MappedFile>;
+    class DeltaStream;
+    // the matcher is compiled once per weak hash and kind of block size, a transfer picks its
+    // instance from a table (chooseProcessChunk) so the rolling and block arithmetic inline
+    using ChunkProcessor = ChunkDelta (SourceManager::*)(const SharedMapping&,size_t,size_t,const ChunkDelta*) const;
+    static ChunkProcessor chooseProcessChunk(WeakHashAlgorithm algorithm,size_t blockSize);
+    template<class WeakHash,class BlockSize>
+    ChunkDelta ProcessChunk(const SharedMapping& mapping,size_t start,size_t limit,const ChunkDelta* resyncWith) const;
+    void beginSignature(const SignatureHeader& header);
+    void addBlocks(const BlockInfo* blocks,size_t count);
     std::string sourcePath_;
-    std::vector<BlockInfo> destBlocks_;
-    size_t blockSize_;
-    size_t chunkSize_;
-    std::unordered_map<std::pair<uint32_t,std::string>,size_t,PairHash> destHashToOffset;
-    std::unordered_set<uint32_t> weakHashSet;
+    SignatureHeader header_;
+    size_t blockSize_=0;
+    size_t chunkSize_=0;
+    ChunkProcessor processChunk_=nullptr;
+    size_t blockCount_=0;                  // blocks of the signature taken in so far
+    BlockIndex index_;                     // FIXED: full blocks by weak hash, CDC: chunks by strong hash
+    std::vector<uint64_t> chunkOffsets_;   // CDC only, chunk i is [chunkOffsets_[i],chunkOffsets_[i+1])
+    MappedFile basis_;                     // local destination file, not open for a remote one
+    std::unique_ptr<DeltaStream> delta_;   // beginDelta, its tasks use the members above
 };
\ No newline at end of file
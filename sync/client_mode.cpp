@@ -3,6 +3,7 @@
 #include <sstream>
 #include <thread>
 #include <algorithm>
+#include "../common/weak_hash.hpp"
 
 void ClientMode::startCLI() {
     std::cout << "Client CLI started. Type 'help' for commands.\n";
@@ -55,31 +56,33 @@ void ClientMode::handleCommand(const std::string& cmd) {
     }else if(keyword=="push"){
         int sessionId;
         std::string localPath,remotePath;
-        if (!(iss >> sessionId >> localPath >> remotePath)) {
-            std::cerr << "Usage: push <session_id> <local_path> <remote_path>\n";
+        TransferOptions options;
+        if (!(iss >> sessionId >> localPath >> remotePath) || !parseTransferOptions(iss, options)) {
+            std::cerr << "Usage: push <session_id> <local_path> <remote_path> [--cdc] [--block-size <bytes>] [--no-compress] [--inplace] [--weak-hash <name>] [--strong-hash <name>]\n";
             return;
         }
         if (sessionId < 0 || sessionId >= (int)sessions_.size() || !sessions_[sessionId]) {
             std::cerr << "Invalid session ID.\n";
             return;
         }
-        std::thread([this, sessionId, localPath,remotePath]() {
-            sessions_[sessionId]->runTransaction("push",localPath,remotePath);
+        std::thread([this, sessionId, localPath,remotePath,options]() {
+            sessions_[sessionId]->runTransaction("push",localPath,remotePath,options);
         }).detach();
 
     }else if(keyword=="pull"){
         int sessionId;
         std::string localPath,remotePath;
-        if (!(iss >> sessionId >> remotePath >> localPath)) {
-            std::cerr << "Usage: push <session_id> <remote_path> <local_path>\n";
+        TransferOptions options;
+        if (!(iss >> sessionId >> remotePath >> localPath) || !parseTransferOptions(iss, options)) {
+            std::cerr << "Usage: pull <session_id> <remote_path> <local_path> [--cdc] [--block-size <bytes>] [--no-compress] [--inplace] [--weak-hash <name>] [--strong-hash <name>]\n";
             return;
         }
         if (sessionId < 0 || sessionId >= (int)sessions_.size() || !sessions_[sessionId]) {
             std::cerr << "Invalid session ID.\n";
             return;
         }
-        std::thread([this, sessionId, localPath,remotePath]() {
-            sessions_[sessionId]->runTransaction("pull",localPath,remotePath);
+        std::thread([this, sessionId, localPath,remotePath,options]() {
+            sessions_[sessionId]->runTransaction("pull",localPath,remotePath,options);
         }).detach();
     }
      else if (keyword == "send") {
@@ -128,12 +131,54 @@ void ClientMode::printHelp() const {
               << " connect <ip> <port>                           Connect to server (max 3)\n"
               << " push <session_id> <local_path> <remote_path>  Push the local content to remote file\n"
               << " pull <session_id> <remote_path> <local_path>  Pull the remote content to local file\n"
+              << "   options for push/pull:\n"
+              << "     --cdc                                       Content defined chunks instead of fixed blocks\n"
+              << "     --block-size <bytes>                        Fixed block size, picked from the file size by default\n"
+              << "     --no-compress                               Send literal data uncompressed\n"
+              << "     --inplace                                   Update the destination file in place, no temporary copy\n"
+              << "     --weak-hash <name>                          Rolling checksum of fixed blocks: polynomial (default), adler, buzhash, gear\n"
+              << "     --strong-hash <name>                        Digest that confirms a match: sha1 (default), blake3, xxh3\n"
               << " disconnect <session_id>                       Disconnect from server\n"
               << " list                                          List active sessions\n"
               << " help                                          Show this help\n"
               << " exit                                          Exit client\n";
 }
 
+// optional flags after the paths of push/pull
+bool ClientMode::parseTransferOptions(std::istringstream& iss, TransferOptions& options) const {
+    std::string flag;
+    while (iss >> flag) {
+        if (flag == "--cdc") {
+            options.chunking = ChunkingMode::CDC;
+        } else if (flag == "--inplace") {
+            options.inPlace = true;
+        } else if (flag == "--no-compress") {
+            options.features &= ~COMPRESSED_LITERALS;
+        } else if (flag == "--weak-hash") {
+            std::string name;
+            if (!(iss >> name) || !WeakHash::fromName(name, options.weakHash)) {
+                std::cerr << "--weak-hash needs one of polynomial, adler, buzhash, gear\n";
+                return false;
+            }
+        } else if (flag == "--strong-hash") {
+            std::string name;
+            if (!(iss >> name) || !HashUtils::strongHashFromName(name, options.strongHash)) {
+                std::cerr << "--strong-hash needs one of sha1, blake3, xxh3\n";
+                return false;
+            }
+        } else if (flag == "--block-size") {
+            if (!(iss >> options.blockSize) || options.blockSize == 0) {
+                std::cerr << "--block-size needs a positive number of bytes\n";
+                return false;
+            }
+        } else {
+            std::cerr << "Unknown option " << flag << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
 void ClientMode::listSessions() const {
     std::cout << "Active Sessions:\n";
     for (size_t i = 0; i < sessions_.size(); ++i) {
@@ -3,6 +3,7 @@
 #include <memory>
 #include <vector>
 #include <string>
+#include <sstream>
 
 class ClientMode {
 public:
@@ -16,4 +17,5 @@ private:
     void printHelp() const;
     void listSessions() const;
     int findFreeSlot() const;
+    bool parseTransferOptions(std::istringstream& iss, TransferOptions& options) const;
 };
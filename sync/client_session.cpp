@@ -39,19 +39,34 @@ bool ClientSession::connectToServer() {
     return true;
 }
 
+void printClientMessage(int sessionId, const std::string& message);
+
 // communication with the server
-void ClientSession::runTransaction(const std::string request,const std::string& localPath,const std::string&remotePath) {
+void ClientSession::runTransaction(const std::string request,const std::string& localPath,const std::string&remotePath,const TransferOptions& options) {
     if (!connected_) {
         std::cerr << "[Session " << sessionId_ << "] Not connected.\n";
         return;
     }
 
-    if(request=="push"){
-        pushTransaction(localPath,remotePath);
-    }else if(request=="pull"){
-        pullTransaction(localPath,remotePath);
-    }else{
+    if(request!="push" && request!="pull"){
         std::cerr << "[Session " << sessionId_ << "] Invalid request.\n";
+    }else{
+        digestMismatch_=false;
+        bool push=request=="push";
+        bool done=push ? pushTransaction(localPath,remotePath,options) : pullTransaction(localPath,remotePath,options);
+        // a false match of truncated strong hashes, like rsync's second pass the file is synced
+        // once more with whole ones on a new connection
+        if(!done && digestMismatch_){
+            printClientMessage(sessionId_,"The new file does not match the source, syncing it again with full strong hashes");
+            ::close(socketFD_);
+            connected_=false;
+            TransferOptions again=options;
+            again.fullStrongHash=true;
+            if(connectToServer()){
+                if(push) pushTransaction(localPath,remotePath,again);
+                else pullTransaction(localPath,remotePath,again);
+            }
+        }
     }
 
     // after each transaction close the client session
@@ -97,7 +112,15 @@ void printClientMessage(int sessionId, const std::string& message) {
     std::cout << "\033[36m[Session " << sessionId << ": Client] " << message << "\033[0m\n";
     std::cout<<">>> ";
 }
-bool ClientSession::pushTransaction(const std::string& loaclPath,const std::string& remotePath){
+// the server answers the offered options with the ones this transfer uses
+bool ClientSession::agreeTransferOptions(DataTransfer &dataPipe,TransferOptions& agreed){
+    if(!dataPipe.receiveTransferOptions(socketFD_,agreed) || !dataPipe.useTransferOptions(agreed)){
+        printClientMessage(sessionId_,"Failed to agree on the transfer options");
+        return false;
+    }
+    return true;
+}
+bool ClientSession::pushTransaction(const std::string& loaclPath,const std::string& remotePath,const TransferOptions& options){
     std::string command = "PUSH\n";
     if (send(socketFD_, command.c_str(), command.size(), 0) != (ssize_t)command.size()) {
         printClientMessage(sessionId_,"Failed to send command");
@@ -108,7 +131,7 @@ bool ClientSession::pushTransaction(const std::string& loaclPath,const std::stri
     if(!recievingStatus(dataPipe)) return false; // status for command part
     // sending the remotePath
     
-    if(dataPipe.sendFilePath(socketFD_,remotePath)){
+    if(dataPipe.sendFilePath(socketFD_,remotePath) && dataPipe.sendTransferOptions(socketFD_,options)){
         printClientMessage(sessionId_,"Push request send to the remote machine");
     }else{
         printClientMessage(sessionId_,"Failed to send remote file path");
@@ -116,39 +139,58 @@ bool ClientSession::pushTransaction(const std::string& loaclPath,const std::stri
     }
 
     if(!recievingStatus(dataPipe)) return false;  // status for file path
+    TransferOptions agreed;
+    if(!agreeTransferOptions(dataPipe,agreed)) return false;
 
     // recieving the status for whether hash generation has been successfull on server side or not
     if(!recievingStatus(dataPipe)) return false;  
     
-    // need to recieve the blockHashes from the server
-    std::vector<BlockInfo> blocks;  // this is the blockHashes
-    if(dataPipe.receiveBlockHashes(socketFD_,blocks)){
-        printClientMessage(sessionId_,"Hashes of "+std::to_string(blocks.size())+" blocks recieved");
+    // need to recieve the blockHashes from the server, they are indexed batch by batch as they arrive
+    SourceManager source(loaclPath);
+    if(dataPipe.receiveBlockHashes(socketFD_,source.signatureSink())){
+        source.finishSignature();
+        printClientMessage(sessionId_,"Hashes of "+std::to_string(source.blockCount())+" blocks recieved");
     }else{
         printClientMessage(sessionId_,"Failed to recieve block hashes");
         return false;
     }
 
     // now using this need to generate the delta and send it to the server
-    SourceManager source(loaclPath,blocks); 
 
-    printClientMessage(sessionId_,"Generating the delta instructions");
-    Result<std::vector<DeltaInstruction>> deltaResult=source.getDelta(); 
-    // this delta is need to be send over the network
+    // each chunk of the delta goes on the wire as soon as it is ready
+    printClientMessage(sessionId_,"Generating and streaming the delta instructions");
+    Result<void> deltaResult=source.streamDelta([&](std::vector<DeltaInstruction>&& chunkDelta){
+        return dataPipe.sendDeltaFrame(socketFD_,chunkDelta);
+    });
     if(!deltaResult.success){
+        dataPipe.abortDeltaStream(socketFD_);
         printClientMessage(sessionId_,"Failed to Generate Delta: "+deltaResult.message);
         return false;
     }
 
-    if(dataPipe.serializeAndSendDeltaInstructions(socketFD_,deltaResult.data)){
+    if(dataPipe.endDeltaStream(socketFD_)){
         printClientMessage(sessionId_,"Delta instructions send successfully");
     }else{
         printClientMessage(sessionId_,"Failed to send delta");
         return false;
     }
 
+    // the server checks the new file against the digest of this one
+    const bool digestChecked=agreed.features & FILE_DIGEST;
+    if(digestChecked){
+        Result<StrongHash> digest=source.fileDigest();
+        if(!digest.success || !dataPipe.sendFileDigest(socketFD_,digest.data)){
+            printClientMessage(sessionId_,"Failed to send the file digest");
+            return false;
+        }
+    }
+
     if(!recievingStatus(dataPipe)) return false; // whether deltas are successfully recieved or not
 
+    bool matched=true;
+    if(digestChecked && !dataPipe.receiveDigestMatch(socketFD_,matched)) return false;
+    digestMismatch_=!matched;
+
     if(!recievingStatus(dataPipe)) return false;  // whether delta application was succesfull or not
 
     printClientMessage(sessionId_,"Content Pushed to the remote file");
@@ -156,7 +198,7 @@ bool ClientSession::pushTransaction(const std::string& loaclPath,const std::stri
     return true;
 }
 
-bool ClientSession::pullTransaction(const std::string& loaclPath,const std::string& remotePath){
+bool ClientSession::pullTransaction(const std::string& loaclPath,const std::string& remotePath,const TransferOptions& options){
     std::string command = "PULL\n";
     if (send(socketFD_, command.c_str(), command.size(), 0) != (ssize_t)command.size()) {
         printClientMessage(sessionId_,"Failed to send command");
@@ -168,7 +210,7 @@ bool ClientSession::pullTransaction(const std::string& loaclPath,const std::stri
 
     // sending the remotePath
     
-    if(dataPipe.sendFilePath(socketFD_,remotePath)){
+    if(dataPipe.sendFilePath(socketFD_,remotePath) && dataPipe.sendTransferOptions(socketFD_,options)){
         printClientMessage(sessionId_,"Push request send to the remote machine");
     }else{
         printClientMessage(sessionId_,"Failed to send remote file path");
@@ -176,42 +218,54 @@ bool ClientSession::pullTransaction(const std::string& loaclPath,const std::stri
     }
 
     if(!recievingStatus(dataPipe)) return false; // status for remote file path
+    TransferOptions agreed;
+    if(!agreeTransferOptions(dataPipe,agreed)) return false;
 
-    DestinationManager destination(loaclPath);  // using block size = 8
-    // now this local machine will generate the hashes
-    printClientMessage(sessionId_,"Generating the block hashes...");
-    Result<std::vector<BlockInfo>> blockHashesResult= destination.getFileBlockHashes();
-    if(!blockHashesResult.success){
-        printClientMessage(sessionId_,"Error while generating block hashes:: "+blockHashesResult.message);
-        return false;
-    }
-    // sending this block hashes
-    printClientMessage(sessionId_,"Sending block hashes...");
-    if(dataPipe.serializeAndSendBlockHashes(socketFD_,blockHashesResult.data)){
+    // this side is the destination, it hashes and applies with what both sides agreed on
+    DestinationManager destination(loaclPath,agreed);
+    // now this local machine will generate the hashes, and send them while it is still hashing
+    printClientMessage(sessionId_,"Generating and sending the block hashes...");
+    Result<void> blockHashesResult= destination.streamFileBlockHashes(dataPipe.signatureSender(socketFD_));
+    if(blockHashesResult.success){
         printClientMessage(sessionId_,"Block Hashes sent successfully");
     }else{
-        printClientMessage(sessionId_,"Failed to send block hashes");
+        printClientMessage(sessionId_,"Failed to generate or send block hashes:: "+blockHashesResult.message);
         return false;
     }
 
     if(!recievingStatus(dataPipe)) return false; // status for whether block hashes are successfully recieved or not
 
-    if(!recievingStatus(dataPipe)) return false; // status for whether delta calculated succesfully or not
-    // recieve the delta instructions
-    std::vector<DeltaInstruction> deltas;
-    if(dataPipe.receiveDelta(socketFD_,deltas)){
+    if(!recievingStatus(dataPipe)) return false; // status for whether delta generation has started or not
+    // recieve the delta instructions, server streams them while still generating
+    // and every frame is applied as it arrives, after a failed one the rest is only read
+    Result<void> applyDetaRes= destination.beginApply();
+    bool received = dataPipe.receiveDelta(socketFD_, [&](std::vector<DeltaInstruction>&& frame) {
+        if (applyDetaRes.success) applyDetaRes = destination.applyFrame(std::move(frame));
+        return true;
+    });
+    if(received){
         printClientMessage(sessionId_,"Delta Instructions recieved successfully");
     }else{
         printClientMessage(sessionId_,"Failed to get delta instructions");
+        recievingStatus(dataPipe); // reason sent by the server if it aborted the stream
+        return false;
+    }
+
+    // the server follows the delta with the digest of its file, the new one has to match it
+    StrongHash digest;
+    const bool digestChecked=agreed.features & FILE_DIGEST;
+    if(digestChecked && !dataPipe.receiveFileDigest(socketFD_,digest)){
+        printClientMessage(sessionId_,"Failed to get the file digest");
         return false;
     }
 
-    // now apply this delta
-    Result<void> applyDetaRes= destination.applyDelta(deltas);
+    // now finish applying this delta
+    if (applyDetaRes.success) applyDetaRes = destination.finishApply(digestChecked ? &digest : nullptr);
+    digestMismatch_=destination.digestMismatch();
     if(applyDetaRes.success){
         printClientMessage(sessionId_,"Content pulled successfully");
     }else{
-        printClientMessage(sessionId_,"Error while applying delta instructions");
+        printClientMessage(sessionId_,"Error while applying delta instructions: "+applyDetaRes.message);
     }
     return applyDetaRes.success;
 
@@ -1,6 +1,7 @@
 #pragma once
 #include "../common/block_info.hpp"
 #include "../common/data_transfer.hpp"
+#include "../common/transfer_options.hpp"
 
 #include<string>
 #include<vector>
@@ -13,7 +14,7 @@ public:
     void close();
     bool isConnected() const;
 
-    void runTransaction(const std::string request, const std::string& localPath,const std::string&remotePath); // one interaction
+    void runTransaction(const std::string request, const std::string& localPath,const std::string&remotePath,const TransferOptions& options); // one interaction
     std::string getInfo() const;
 
 private:
@@ -22,8 +23,10 @@ private:
     int sessionId_;
     int socketFD_;
     bool connected_;
+    bool digestMismatch_ = false;   // the last transfer's new file did not match the digest of its source
 
-    bool pullTransaction(const std::string& loaclPath,const std::string& remotePath);
-    bool pushTransaction(const std::string& loaclPath,const std::string& remotePath);
+    bool pullTransaction(const std::string& loaclPath,const std::string& remotePath,const TransferOptions& options);
+    bool pushTransaction(const std::string& loaclPath,const std::string& remotePath,const TransferOptions& options);
     bool recievingStatus(DataTransfer &dataPipe);
+    bool agreeTransferOptions(DataTransfer &dataPipe,TransferOptions& agreed);
 };
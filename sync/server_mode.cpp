@@ -1,30 +1,104 @@
 #include "server_mode.hpp"
-#include "../common/thread_pool.hpp"
-#include "../common/block_info.hpp"
-#include "../destination/destination_manager.hpp"
-#include "../source/source_manager.hpp"
-#include "../common/data_transfer.hpp"
+#include "server_session.hpp"
 #include <iostream>
 #include <cstring>
+#include <cerrno>
+#include <algorithm>
 #include <unistd.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
 #include <arpa/inet.h>
-#include <thread>
-#include<fstream>
-#include<vector>
-const int MAX_CONNECTIONS = 3;
 
-ServerMode::ServerMode(int port):port_(port),serverSocket_(-1),activeClients_(0){}
+namespace {
+// a client is not read any further while this much of what it sent waits for its session
+constexpr size_t INBOX_LIMIT = 1024 * 1024;
+// a session stops streaming out while this much of what it sent is still queued for its client,
+// and goes on once half of it has gone out
+constexpr size_t OUTBOX_LIMIT = 4 * 1024 * 1024;
+// idle connections keep no more than this of a buffer around
+constexpr size_t KEEP_CAPACITY = 64 * 1024;
+constexpr size_t RECEIVE_SLAB = 64 * 1024;
+}
+
+// the event loop and the worker running the session share a connection:
+// the loop moves bytes between the socket and the inbox / outbox, the session takes them from
+// the inbox and queues its own into the outbox. Only the loop touches the socket and epoll
+struct ServerMode::Connection : std::enable_shared_from_this<Connection> {
+    int socket = -1;
+    std::unique_ptr<ServerSession> session;   // only used by the worker running it
+    uint32_t events = 0;                      // watched on the socket, event loop only
+    bool closed = false;                      // event loop only
+
+    std::mutex mutex;                         // guards everything below
+    std::vector<uint8_t> inbox;
+    size_t inboxBegin = 0;
+    std::vector<uint8_t> outbox;
+    size_t outboxBegin = 0;
+    size_t wanted = 1;                        // received bytes the session waits for
+    bool draining = false;                    // the session waits for its outbox instead
+    bool scheduled = false;                   // a worker runs the session or is about to
+    bool finished = false;                    // the session is over
+    bool readPaused = false;                  // inbox full, socket not read
+    bool peerClosed = false;                  // the client will send nothing more
+    bool broken = false;                      // the socket failed or was closed, nothing goes out
+
+    size_t inboxSize() const { return inbox.size() - inboxBegin; }
+    size_t outboxSize() const { return outbox.size() - outboxBegin; }
+    bool hasRoom() const { return outboxSize() < OUTBOX_LIMIT; }
+    // a payload bigger than the inbox is taken into the session while it is still arriving
+    bool sessionReady() const {
+        if (finished) return false;
+        if (draining) return broken || outboxSize() <= OUTBOX_LIMIT / 2;
+        return peerClosed || broken || inboxSize() >= std::min(wanted, INBOX_LIMIT);
+    }
+
+    // drops what was consumed, a buffer that is empty again does not stay big
+    static void compact(std::vector<uint8_t>& buffer, size_t& begin) {
+        if (begin == buffer.size()) {
+            buffer.clear();
+            begin = 0;
+            if (buffer.capacity() > KEEP_CAPACITY) std::vector<uint8_t>().swap(buffer);
+        } else if (begin > buffer.size() / 2) {
+            buffer.erase(buffer.begin(), buffer.begin() + begin);
+            begin = 0;
+        }
+    }
+};
+
+ServerMode::ServerMode(int port, const ServerLimits& limits)
+    : port_(port), serverSocket_(-1), epollFd_(-1), wakeFd_(-1), limits_(limits), accepting_(false) {
+    limits_.maxConnections = std::max<size_t>(limits_.maxConnections, 1);
+    limits_.maxActiveSessions = std::max<size_t>(limits_.maxActiveSessions, 1);
+    sessionWorkers_ = std::make_unique<ThreadPool>(limits_.maxActiveSessions);
+}
+
+ServerMode::~ServerMode() {
+    // sessions in the middle of a step finish it, none waits for the event loop
+    sessionWorkers_.reset();
+    for (auto& entry : connections_) close(entry.first);
+    if (wakeFd_ >= 0) close(wakeFd_);
+    if (epollFd_ >= 0) close(epollFd_);
+    if (serverSocket_ >= 0) close(serverSocket_);
+}
 
 void ServerMode::startServer(){
-    // will start the server and listen for the incoming request 
+    // will start the server and listen for the incoming request
     setupSocket();
-    acceptConnections();
+    runEventLoop();
 }
 
 void ServerMode::setupSocket() {
-    serverSocket_ = socket(AF_INET, SOCK_STREAM, 0);
+    // every client is a descriptor, the soft limit (often 1024) is raised as far as allowed
+    rlimit files{};
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+        files.rlim_cur = std::min<rlim_t>(files.rlim_max, limits_.maxConnections + 64);
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+
+    serverSocket_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (serverSocket_ < 0) {
         perror("Socket creation failed");
         exit(EXIT_FAILURE);
@@ -46,163 +120,295 @@ void ServerMode::setupSocket() {
         exit(EXIT_FAILURE);
     }
 
-    if (listen(serverSocket_, MAX_CONNECTIONS) < 0) {
+    // clients over the connection limit wait here until one leaves
+    if (listen(serverSocket_, SOMAXCONN) < 0) {
         perror("Listen failed");
         exit(EXIT_FAILURE);
     }
 
-    std::cout << "[Server] Listening on port " << port_ << "...\n";
-}
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd_ < 0 || wakeFd_ < 0) {
+        perror("Event loop setup failed");
+        exit(EXIT_FAILURE);
+    }
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = wakeFd_;
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeFd_, &event);
+    event.events = 0;
+    event.data.fd = serverSocket_;
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, serverSocket_, &event);
+    watchListeningSocket(true);
 
-void ServerMode::acceptConnections() {
-    ThreadPool pool(MAX_CONNECTIONS);
+    std::cout << "[Server] Listening on port " << port_ << " (up to " << limits_.maxConnections << " clients, "
+              << limits_.maxActiveSessions << " active sessions)...\n";
+}
 
+// level triggered: a socket keeps being reported while it has bytes, or room for ours
+void ServerMode::runEventLoop() {
+    std::vector<epoll_event> events(1024);
     while (true) {
-        std::unique_lock<std::mutex> lock(mtx_);
-        cv_.wait(lock,[this](){
-            return activeClients_<3;
-        });
+        int ready = epoll_wait(epollFd_, events.data(), events.size(), -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait failed");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < ready; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == serverSocket_) {
+                acceptConnections();
+                continue;
+            }
+            if (fd == wakeFd_) {
+                handleWakeups();
+                continue;
+            }
+            auto found = connections_.find(fd);
+            if (found == connections_.end()) continue;
+            ConnectionPtr connection = found->second;
+
+            uint32_t happened = events[i].events;
+            if (happened & (EPOLLIN | EPOLLHUP | EPOLLERR)) receiveFrom(connection);
+            if (happened & (EPOLLHUP | EPOLLERR)) {
+                std::lock_guard<std::mutex> lock(connection->mutex);
+                connection->broken = true;
+            }
+            if (happened & EPOLLOUT) {
+                sendTo(connection);
+                scheduleSession(connection);
+            }
+            updateConnection(connection);
+        }
+    }
+}
+
+void ServerMode::watchListeningSocket(bool accept) {
+    if (accept == accepting_) return;
+    epoll_event event{};
+    event.events = accept ? static_cast<uint32_t>(EPOLLIN) : 0u;
+    event.data.fd = serverSocket_;
+    epoll_ctl(epollFd_, EPOLL_CTL_MOD, serverSocket_, &event);
+    accepting_ = accept;
+}
+
+void ServerMode::acceptConnections() {
+    while (connections_.size() < limits_.maxConnections) {
         sockaddr_in clientAddr{};
         socklen_t addrLen = sizeof(clientAddr);
-        int clientSocket = accept(serverSocket_, (sockaddr*)&clientAddr, &addrLen);
+        int clientSocket = accept4(serverSocket_, (sockaddr*)&clientAddr, &addrLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (clientSocket < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
             perror("Accept failed");
-            continue;
+            // out of descriptors: wait for a client to leave instead of spinning on the backlog
+            if ((errno == EMFILE || errno == ENFILE) && !connections_.empty()) watchListeningSocket(false);
+            return;
         }
 
-        activeClients_++;  // increment here under lock
-        lock.unlock();
-
         char clientIP[INET_ADDRSTRLEN];
         inet_ntop(AF_INET, &clientAddr.sin_addr, clientIP, INET_ADDRSTRLEN);
         std::cout << "[Server] Connection accepted from " << clientIP << "\n";
 
-        //  thread pool to handle client
-        pool.submit([this, clientSocket]() {
-            this->handleClient(clientSocket);
-
-            // this client is done now give someone other chance
+        // the session lives inside its connection, so it refers back to it by plain pointer
+        ConnectionPtr connection = std::make_shared<Connection>();
+        Connection* conn = connection.get();
+        conn->socket = clientSocket;
+        WireReader::Source source = [this, conn](uint8_t* out, size_t len) {
+            size_t taken;
+            bool resume;
             {
-                std::lock_guard<std::mutex> guard(mtx_);
-                activeClients_--;
+                std::lock_guard<std::mutex> lock(conn->mutex);
+                taken = std::min(len, conn->inboxSize());
+                std::memcpy(out, conn->inbox.data() + conn->inboxBegin, taken);
+                conn->inboxBegin += taken;
+                Connection::compact(conn->inbox, conn->inboxBegin);
+                resume = conn->readPaused && conn->inboxSize() < INBOX_LIMIT;
+                if (resume) conn->readPaused = false;
             }
-            cv_.notify_one();
-        });
+            if (resume) wake(conn->shared_from_this());
+            return taken;
+        };
+        // never waits: a session asks for room before it streams more out, and steps that only
+        // answer queue their few bytes whatever is still waiting to go out
+        WireWriter::Queue queue = [this, conn](const uint8_t* data, size_t len) {
+            bool wasEmpty;
+            {
+                std::lock_guard<std::mutex> lock(conn->mutex);
+                if (conn->broken) return false;
+                wasEmpty = conn->outboxSize() == 0;
+                conn->outbox.insert(conn->outbox.end(), data, data + len);
+            }
+            if (wasEmpty) wake(conn->shared_from_this());
+            return true;
+        };
+        // a broken connection has room, the next send fails and ends the session
+        ServerSession::SendRoom sendRoom = [conn]() {
+            std::lock_guard<std::mutex> lock(conn->mutex);
+            return conn->broken || conn->hasRoom();
+        };
+        conn->session = std::make_unique<ServerSession>(clientSocket, std::move(source), std::move(queue), std::move(sendRoom));
+
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = clientSocket;
+        if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, clientSocket, &event) < 0) {
+            perror("Watching client failed");
+            close(clientSocket);
+            continue;
+        }
+        conn->events = EPOLLIN;
+        connections_[clientSocket] = std::move(connection);
     }
+    watchListeningSocket(false);
 }
 
-// handleClient for communication with the client 
-
-// after evey logical step server need to send the status message to the client
-// whether successfull or not
-void ServerMode::handleClient(int clientSocket){
-    char cmd[5]; // For 4-char mode + '\n'
-    ssize_t bytesRead = recv(clientSocket, cmd, sizeof(cmd), MSG_WAITALL);
-    DataTransfer pipe;
-    if (bytesRead != 5|| cmd[4]!='\n' ) {
-        pipe.sendStatus(clientSocket,StatusMessage(false,"Failed to read 5-byte command"));
-        close(clientSocket);
-        return;
+void ServerMode::receiveFrom(const ConnectionPtr& connection) {
+    std::vector<uint8_t>& slab = receiveSlab_;
+    slab.resize(RECEIVE_SLAB);
+    {
+        std::lock_guard<std::mutex> lock(connection->mutex);
+        while (!connection->peerClosed && connection->inboxSize() < INBOX_LIMIT) {
+            ssize_t got = recv(connection->socket, slab.data(), slab.size(), 0);
+            if (got > 0) {
+                connection->inbox.insert(connection->inbox.end(), slab.data(), slab.data() + got);
+                continue;
+            }
+            if (got == 0) {
+                connection->peerClosed = true;
+            } else if (errno == EINTR) {
+                continue;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                connection->broken = true;
+            }
+            break;
+        }
     }
-    
+    scheduleSession(connection);
+}
 
-    std::string mode(cmd, 4); // First 4 chars are the command
-    pipe.sendStatus(clientSocket,StatusMessage(true,"Starting the "+mode+" request"));
-    if(mode=="PUSH"){
-        pushTransaction(clientSocket);
-    }else if(mode=="PULL"){
-        pullTransaction(clientSocket);
-    }else{
-        std::cerr << "Invalid mode\n";
+void ServerMode::sendTo(const ConnectionPtr& connection) {
+    {
+        std::lock_guard<std::mutex> lock(connection->mutex);
+        while (connection->outboxSize() > 0 && !connection->broken) {
+            ssize_t sent = send(connection->socket, connection->outbox.data() + connection->outboxBegin,
+                                connection->outboxSize(), MSG_NOSIGNAL);
+            if (sent > 0) {
+                connection->outboxBegin += sent;
+                continue;
+            }
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            connection->broken = true;
+        }
+        Connection::compact(connection->outbox, connection->outboxBegin);
     }
-    close(clientSocket);
 }
 
-bool ServerMode::pushTransaction(int clientSocket) {
-    std::string remotePath;
-
-    DataTransfer dataPipe;
-    // 1. Receive remote file path
-    if (dataPipe.receiveFilePath(clientSocket,remotePath)){ 
-        dataPipe.sendStatus(clientSocket ,StatusMessage(true,"Genrating the block hashes for remote file..."));
-    }else{
-        dataPipe.sendStatus(clientSocket ,StatusMessage(false,"Error while recieving remote path"));
-        return false;
+// the socket is watched for what the connection can take or give right now,
+// and closed once the session is over and its last bytes are out
+void ServerMode::updateConnection(const ConnectionPtr& connection) {
+    uint32_t events = 0;
+    bool done;
+    {
+        std::lock_guard<std::mutex> lock(connection->mutex);
+        done = connection->broken || (connection->finished && connection->outboxSize() == 0);
+        connection->readPaused = connection->inboxSize() >= INBOX_LIMIT;
+        if (!connection->peerClosed && !connection->readPaused) events |= EPOLLIN;
+        if (connection->outboxSize() > 0) events |= EPOLLOUT;
     }
-
-    
-    // 2. Get existing file block hashes
-    DestinationManager dest(remotePath);  // Block size = 8
-    Result<std::vector<BlockInfo>> blockHashesResult = dest.getFileBlockHashes();
-
-    if(!blockHashesResult.success){
-        dataPipe.sendStatus(clientSocket ,StatusMessage(false,"Error while genrating block hashes for remote file:: "+blockHashesResult.message));
-        return false;
-    }else{
-        dataPipe.sendStatus(clientSocket ,StatusMessage(true,"Block hashes for remote generated successfully, Sending it over the channel"));
+    if (done) {
+        closeConnection(connection);
+        return;
     }
-
-    // 3. Send the block hashes to the client
-    if (!dataPipe.serializeAndSendBlockHashes(clientSocket, blockHashesResult.data)) {
-        return false;
+    if (events != connection->events) {
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = connection->socket;
+        epoll_ctl(epollFd_, EPOLL_CTL_MOD, connection->socket, &event);
+        connection->events = events;
     }
+}
 
-    // 4. Receive delta from client
-    std::vector<DeltaInstruction> delta;
-    if (dataPipe.receiveDelta(clientSocket, delta)) {
-        dataPipe.sendStatus(clientSocket ,StatusMessage(true,"Recieved delta instructions successfully"));
-    }else{
-        dataPipe.sendStatus(clientSocket ,StatusMessage(false,"Error while recieving delta messages"));
-        return false;
+// a session still running finds the connection broken and stops at its next send
+void ServerMode::closeConnection(const ConnectionPtr& connection) {
+    epoll_ctl(epollFd_, EPOLL_CTL_DEL, connection->socket, nullptr);
+    close(connection->socket);
+    connection->closed = true;
+    {
+        std::lock_guard<std::mutex> lock(connection->mutex);
+        connection->broken = true;
     }
+    connections_.erase(connection->socket);
+    if (connections_.size() < limits_.maxConnections) watchListeningSocket(true);
+}
 
-    // 5. Apply delta to remote file
-    Result<void> applyDetaRes= dest.applyDelta(delta);
-    if(applyDetaRes.success){
-        dataPipe.sendStatus(clientSocket ,StatusMessage(true,"Push request performed successfully"));
-    }else{
-        dataPipe.sendStatus(clientSocket ,StatusMessage(false,"Error while applying delta:: " + applyDetaRes.message));
-        return false;
+void ServerMode::wake(const ConnectionPtr& connection) {
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex_);
+        woken_.push_back(connection);
     }
-
-    return true;
+    uint64_t one = 1;
+    ssize_t written = write(wakeFd_, &one, sizeof(one));
+    (void)written;   // only fails when the counter is already non zero, the loop wakes anyway
 }
 
-bool ServerMode::pullTransaction(int clientSocket){
-    std::string remotePath;
-
-    DataTransfer dataPipe;
-    // 1. Receive remote file path
-    if (dataPipe.receiveFilePath(clientSocket,remotePath)){ 
-        dataPipe.sendStatus(clientSocket ,StatusMessage(true,"Recieved the remote file path"));
-    }else{
-        dataPipe.sendStatus(clientSocket ,StatusMessage(false,"Error while recieving remote path"));
-        return false;
+// sessions queued bytes, finished or made room in their inbox. What goes out right away can let
+// a draining session go on
+void ServerMode::handleWakeups() {
+    uint64_t count;
+    ssize_t got = read(wakeFd_, &count, sizeof(count));
+    (void)got;
+    std::vector<ConnectionPtr> woken;
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex_);
+        woken.swap(woken_);
     }
-
-    // recieve the block hashes
-    std::vector<BlockInfo> blockHashes;
-    if(dataPipe.receiveBlockHashes(clientSocket,blockHashes)){
-        dataPipe.sendStatus(clientSocket ,StatusMessage(true,"Block hashes recieved successfully, Generating delta instructions..."));
-    }else{
-        dataPipe.sendStatus(clientSocket ,StatusMessage(false,"Error while recieving block hashes"));
-        return false;
+    for (const ConnectionPtr& connection : woken) {
+        if (connection->closed) continue;
+        sendTo(connection);
+        scheduleSession(connection);
+        updateConnection(connection);
     }
+}
 
-    // generate deltas
-    SourceManager source(remotePath,blockHashes);
-    Result<std::vector<DeltaInstruction>> deltaResult=source.getDelta();
-    if(deltaResult.success){
-        dataPipe.sendStatus(clientSocket ,StatusMessage(true,"Delta instructions generated successfully, Sending it over the channel"));
-    }else{
-        dataPipe.sendStatus(clientSocket ,StatusMessage(false,"Error while generating delta:: " + deltaResult.message));
-        return false;
-    }
-    // send this deltas
-    if(!dataPipe.serializeAndSendDeltaInstructions(clientSocket,deltaResult.data)){
-        return false;
+void ServerMode::scheduleSession(const ConnectionPtr& connection) {
+    {
+        std::lock_guard<std::mutex> lock(connection->mutex);
+        if (connection->scheduled || !connection->sessionReady()) return;
+        connection->scheduled = true;
     }
+    sessionWorkers_->submit([this, connection]() { runSession(connection); });
+}
 
-    return true;
-
-}
\ No newline at end of file
+// takes steps for as long as the session has the bytes it waits for (or room to send), then gives
+// the worker back. The event loop schedules it again when they come in (or go out)
+void ServerMode::runSession(const ConnectionPtr& connection) {
+    while (true) {
+        bool peerClosed;
+        {
+            std::lock_guard<std::mutex> lock(connection->mutex);
+            if (!connection->sessionReady()) {
+                connection->scheduled = false;
+                return;
+            }
+            peerClosed = connection->peerClosed || connection->broken;
+        }
+        bool alive = connection->session->advance(peerClosed);
+        {
+            std::lock_guard<std::mutex> lock(connection->mutex);
+            connection->wanted = connection->session->bytesWanted();
+            connection->draining = connection->session->waitingToSend();
+            if (!alive) {
+                connection->finished = true;
+                connection->scheduled = false;
+            }
+        }
+        if (!alive) {
+            connection->session.reset();
+            wake(connection);
+            return;
+        }
+    }
+}
@@ -1,23 +1,55 @@
 // Using it system will act as sevevr to provide the hashes of the destination files and then apply the result back
+// one event loop (epoll, non-blocking sockets) does all the network i/o of every client, the
+// protocol of each one is a ServerSession that session workers advance when its bytes are in
 
 #pragma once
-#include<atomic>
+#include "../common/thread_pool.hpp"
+#include<memory>
 #include<mutex>
-#include<condition_variable>
+#include<unordered_map>
+#include<vector>
+#include<cstdint>
+
+// admission limits of the server
+struct ServerLimits {
+    // clients connected at once, further ones wait in the listen backlog
+    size_t maxConnections = 4096;
+    // sessions taking a step at once: hashing, matching, applying or streaming their results
+    // out. A session waiting for its client holds none of them
+    size_t maxActiveSessions = 64;
+};
 
 class ServerMode{
 public:
-    ServerMode(const int p);
+    ServerMode(const int p, const ServerLimits& limits = ServerLimits{});
+    ~ServerMode();
     void startServer();
 private:
+    struct Connection;
+    using ConnectionPtr = std::shared_ptr<Connection>;
+
     int port_;
     int serverSocket_;
-    std::atomic<int> activeClients_;
-    std::mutex mtx_;
-    std::condition_variable cv_;
+    int epollFd_;
+    int wakeFd_;      // eventfd, session workers wake the event loop with it
+    ServerLimits limits_;
+    bool accepting_;  // listening socket is watched
+    std::unique_ptr<ThreadPool> sessionWorkers_;
+    std::unordered_map<int, ConnectionPtr> connections_;
+    std::vector<uint8_t> receiveSlab_;   // recv lands here, only what came is copied to an inbox
+    std::mutex wakeMutex_;
+    std::vector<ConnectionPtr> woken_;
+
     void setupSocket();
+    void runEventLoop();
     void acceptConnections();
-    void handleClient(int clientSocket);
-    bool pushTransaction(int clientSocket);
-    bool pullTransaction(int clientSocket);
-};
\ No newline at end of file
+    void watchListeningSocket(bool accept);
+    void receiveFrom(const ConnectionPtr& connection);
+    void sendTo(const ConnectionPtr& connection);
+    void updateConnection(const ConnectionPtr& connection);
+    void closeConnection(const ConnectionPtr& connection);
+    void handleWakeups();
+    void wake(const ConnectionPtr& connection);
+    void scheduleSession(const ConnectionPtr& connection);
+    void runSession(const ConnectionPtr& connection);
+};
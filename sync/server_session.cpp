@@ -0,0 +1,280 @@
+#include "server_session.hpp"
+#include "../destination/destination_manager.hpp"
+#include "../source/source_manager.hpp"
+#include <iostream>
+#include <algorithm>
+
+namespace {
+// block hashes queued at a time, the outbox goes past its limit by one slice at most
+constexpr size_t SIGNATURE_SLICE = 4096;
+}
+
+ServerSession::ServerSession(int clientSocket, WireReader::Source source, WireWriter::Queue queue, SendRoom sendRoom)
+    : clientSocket_(clientSocket), sendRoom_(std::move(sendRoom)) {
+    dataPipe_.useConnectionBuffers(std::move(source), std::move(queue));
+}
+
+ServerSession::~ServerSession() = default;
+
+bool ServerSession::advance(bool peerClosed){
+    waitingToSend_ = false;
+    while (stage_ != Stage::DONE) {
+        Step step = Step::END;
+        switch (stage_) {
+            case Stage::COMMAND:               step = receiveCommand(); break;
+            case Stage::REQUEST:               step = receiveRequest(); break;
+            case Stage::PUSH_SIGNATURE:        step = sendSignatureRest(); break;
+            case Stage::PUSH_DELTA:            step = receiveDeltaFrames(); break;
+            case Stage::PUSH_DIGEST:           step = receiveFileDigest(); break;
+            case Stage::PULL_SIGNATURE_HEADER: step = receiveSignatureHeader(); break;
+            case Stage::PULL_SIGNATURE_BLOCKS: step = receiveSignatureBlocks(); break;
+            case Stage::PULL_DELTA:            step = streamDelta(); break;
+            case Stage::DONE:                  break;
+        }
+        if (step == Step::END) stage_ = Stage::DONE;
+        // the client has not read what was queued for it yet, nothing is lost if it never does
+        if (step == Step::DRAIN) {
+            waitingToSend_ = true;
+            return true;
+        }
+        if (step == Step::WAIT) {
+            // the client went away in the middle of a message
+            if (peerClosed) stage_ = Stage::DONE;
+            return !peerClosed;
+        }
+    }
+    return false;
+}
+
+// a message that ran short is parsed again from its start once the missing bytes are in,
+// nothing of it is used before it is complete. A delta frame keeps the pieces it got instead and
+// only the one cut short is parsed again
+template<class Parse>
+ServerSession::Received ServerSession::receive(Parse parse){
+    dataPipe_.markReceive();
+    if (parse()) {
+        dataPipe_.unmarkReceive();
+        bytesWanted_ = 1;
+        return Received::OK;
+    }
+    if (!dataPipe_.starved()) return Received::FAILED;
+    dataPipe_.rewindReceive();
+    bytesWanted_ = std::max<size_t>(1, dataPipe_.missingBytes());
+    return Received::SHORT;
+}
+
+bool ServerSession::sendStatus(bool status, const std::string& message){
+    return dataPipe_.sendStatus(clientSocket_, StatusMessage(status, message));
+}
+
+// after evey logical step server need to send the status message to the client
+// whether successfull or not
+ServerSession::Step ServerSession::receiveCommand(){
+    std::string mode;
+    Received received = receive([&]() { return dataPipe_.receiveCommand(clientSocket_, mode); });
+    if (received == Received::SHORT) return Step::WAIT;
+    if (received == Received::FAILED) {
+        sendStatus(false, "Failed to read 5-byte command");
+        return Step::END;
+    }
+
+    sendStatus(true, "Starting the " + mode + " request");
+    if (mode != "PUSH" && mode != "PULL") {
+        std::cerr << "Invalid mode\n";
+        return Step::END;
+    }
+    push_ = mode == "PUSH";
+    stage_ = Stage::REQUEST;
+    return Step::NEXT;
+}
+
+// answers the client with the options of this transfer, features only stay on if this side supports them too
+ServerSession::Step ServerSession::receiveRequest(){
+    // 1. Receive remote file path and the options of this transfer
+    Received received = receive([&]() {
+        return dataPipe_.receiveFilePath(clientSocket_, remotePath_) && dataPipe_.receiveTransferOptions(clientSocket_, options_);
+    });
+    if (received == Received::SHORT) return Step::WAIT;
+    if (received == Received::FAILED) {
+        sendStatus(false, "Error while recieving remote path");
+        return Step::END;
+    }
+    sendStatus(true, push_ ? "Genrating the block hashes for remote file..." : "Recieved the remote file path");
+
+    options_.features &= SUPPORTED_TRANSFER_FEATURES;
+    if (!dataPipe_.sendTransferOptions(clientSocket_, options_) || !dataPipe_.useTransferOptions(options_)) return Step::END;
+
+    if (push_) return streamSignature();
+
+    // chunking is carried by the signature header itself, features matter here
+    source_ = std::make_unique<SourceManager>(remotePath_);
+    signatureSink_ = source_->signatureSink();
+    stage_ = Stage::PULL_SIGNATURE_HEADER;
+    return Step::NEXT;
+}
+
+// 2. Hash the existing file and 3. send its block hashes to the client while hashing goes on
+// the status goes first, once the file could be opened; a failure after that drops the connection.
+// Once the client falls behind the file is still hashed to the end, the blocks it is missing are
+// sent from the signature as it catches up
+ServerSession::Step ServerSession::streamSignature(){
+    dest_ = std::make_unique<DestinationManager>(remotePath_, options_);
+    SignatureSink sender = dataPipe_.signatureSender(clientSocket_);
+    bool started = false;
+    size_t handedOn = 0;
+    SignatureSink streaming{
+        [&](const SignatureHeader& header, size_t blockCount) {
+            started = true;
+            return sendStatus(true, "Block hashes for remote are being generated, streaming them over the channel") &&
+                   sender.header(header, blockCount);
+        },
+        // a slice at a time while the client keeps up, a batch can be big (a cached signature
+        // comes as one)
+        [&](const BlockInfo* blocks, size_t count) {
+            const size_t first = handedOn;
+            handedOn += count;
+            while (blocksSent_ >= first && blocksSent_ < handedOn && sendRoom_()) {
+                size_t slice = std::min(SIGNATURE_SLICE, handedOn - blocksSent_);
+                if (!sender.blocks(blocks + (blocksSent_ - first), slice)) return false;
+                blocksSent_ += slice;
+            }
+            return true;
+        }
+    };
+    Result<void> blockHashesResult = dest_->streamFileBlockHashes(streaming);
+    if (!blockHashesResult.success) {
+        if (!started) sendStatus(false, "Error while genrating block hashes for remote file:: " + blockHashesResult.message);
+        return Step::END;
+    }
+    stage_ = Stage::PUSH_SIGNATURE;
+    return Step::NEXT;
+}
+
+ServerSession::Step ServerSession::sendSignatureRest(){
+    const std::vector<BlockInfo>& blocks = dest_->hashedBlocks();
+    SignatureSink sender = dataPipe_.signatureSender(clientSocket_);
+    while (blocksSent_ < blocks.size()) {
+        if (!sendRoom_()) return Step::DRAIN;
+        size_t count = std::min(SIGNATURE_SLICE, blocks.size() - blocksSent_);
+        if (!sender.blocks(blocks.data() + blocksSent_, count)) return Step::END;
+        blocksSent_ += count;
+    }
+
+    applyResult_ = dest_->beginApply();
+    stage_ = Stage::PUSH_DELTA;
+    return Step::NEXT;
+}
+
+// 4. Receive delta from client, every frame is applied to the remote file as it arrives
+// after a failed frame the rest is still read, so the client gets the reason instead of a reset
+ServerSession::Step ServerSession::receiveDeltaFrames(){
+    bool ended = false;
+    while (!ended) {
+        Received received = receive([&]() {
+            return dataPipe_.receiveDeltaFrame(clientSocket_, [&](std::vector<DeltaInstruction>&& frame) {
+                if (applyResult_.success) applyResult_ = dest_->applyFrame(std::move(frame));
+                return true;
+            }, ended);
+        });
+        if (received == Received::SHORT) return Step::WAIT;
+        if (received == Received::FAILED) {
+            sendStatus(false, "Error while recieving delta messages");
+            return Step::END;
+        }
+    }
+    sendStatus(true, "Recieved delta instructions successfully");
+    if (options_.features & FILE_DIGEST) {
+        stage_ = Stage::PUSH_DIGEST;
+        return Step::NEXT;
+    }
+    return finishPush(nullptr);
+}
+
+// the digest of the client's file follows the delta, the new file has to match it
+ServerSession::Step ServerSession::receiveFileDigest(){
+    StrongHash digest;
+    Received received = receive([&]() { return dataPipe_.receiveFileDigest(clientSocket_, digest); });
+    if (received == Received::SHORT) return Step::WAIT;
+    if (received == Received::FAILED) {
+        sendStatus(false, "Error while recieving the file digest");
+        return Step::END;
+    }
+    return finishPush(&digest);
+}
+
+// 5. Finish applying delta to remote file, with a digest the client learns whether to sync again
+ServerSession::Step ServerSession::finishPush(const StrongHash* digest){
+    if (applyResult_.success) applyResult_ = dest_->finishApply(digest);
+    if (digest && !dataPipe_.sendDigestMatch(clientSocket_, !dest_->digestMismatch())) return Step::END;
+    if (applyResult_.success) {
+        sendStatus(true, "Push request performed successfully");
+    } else {
+        sendStatus(false, "Error while applying delta:: " + applyResult_.message);
+    }
+    return Step::END;
+}
+
+// recieve the block hashes, they are indexed batch by batch as they arrive
+ServerSession::Step ServerSession::receiveSignatureHeader(){
+    Received received = receive([&]() { return dataPipe_.receiveSignatureHeader(clientSocket_, signatureSink_); });
+    if (received == Received::SHORT) return Step::WAIT;
+    if (received == Received::FAILED) {
+        sendStatus(false, "Error while recieving block hashes");
+        return Step::END;
+    }
+    if (dataPipe_.signatureReceived()) return beginDelta();
+    stage_ = Stage::PULL_SIGNATURE_BLOCKS;
+    return Step::NEXT;
+}
+
+ServerSession::Step ServerSession::receiveSignatureBlocks(){
+    while (!dataPipe_.signatureReceived()) {
+        Received received = receive([&]() { return dataPipe_.receiveSignatureBlocks(clientSocket_, signatureSink_); });
+        if (received == Received::SHORT) return Step::WAIT;
+        if (received == Received::FAILED) {
+            sendStatus(false, "Error while recieving block hashes");
+            return Step::END;
+        }
+    }
+    return beginDelta();
+}
+
+// generate deltas and stream them, each chunk is sent as soon as it is ready
+ServerSession::Step ServerSession::beginDelta(){
+    source_->finishSignature();
+    sendStatus(true, "Block hashes recieved successfully, Generating delta instructions...");
+    sendStatus(true, "Generating delta instructions, streaming it over the channel");
+    Result<void> begun = source_->beginDelta();
+    if (!begun.success) return abortDelta(begun.message);
+    stage_ = Stage::PULL_DELTA;
+    return Step::NEXT;
+}
+
+// a batch at a time while the client keeps up, the chunks after it are matched in the meantime
+ServerSession::Step ServerSession::streamDelta(){
+    std::vector<DeltaInstruction> batch;
+    while (sendRoom_()) {
+        Result<bool> next = source_->nextDelta(batch);
+        if (!next.success) return abortDelta(next.message);
+        if (!next.data) {
+            if (!dataPipe_.endDeltaStream(clientSocket_) || !(options_.features & FILE_DIGEST)) return Step::END;
+
+            // the client checks its new file against the digest of this one
+            Result<StrongHash> digest = source_->fileDigest();
+            if (!digest.success) {
+                std::cerr << "Error while computing the file digest: " << digest.message << "\n";
+                return Step::END;
+            }
+            dataPipe_.sendFileDigest(clientSocket_, digest.data);
+            return Step::END;
+        }
+        if (!dataPipe_.sendDeltaFrame(clientSocket_, batch)) return abortDelta("Delta consumer stopped the generation");
+    }
+    return Step::DRAIN;
+}
+
+ServerSession::Step ServerSession::abortDelta(const std::string& message){
+    dataPipe_.abortDeltaStream(clientSocket_);
+    sendStatus(false, "Error while generating delta:: " + message);
+    return Step::END;
+}
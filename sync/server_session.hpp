@@ -0,0 +1,72 @@
+// one client of the server: its PUSH or PULL request as a state machine
+// the event loop of ServerMode owns the socket. Received bytes wait in the connection until a
+// step takes them, and whatever a step sends is queued for the loop to write, so advance() takes
+// every step the bytes received so far allow and returns as soon as it needs more, or as soon as
+// the client is too far behind with what was queued for it. No thread waits on a slow client;
+// hashing, matching and applying run inside the steps
+
+#pragma once
+#include "../common/data_transfer.hpp"
+#include "../common/result.hpp"
+#include "../common/transfer_options.hpp"
+#include<functional>
+#include<memory>
+#include<string>
+
+class DestinationManager;
+class SourceManager;
+
+class ServerSession{
+public:
+    // true while the connection takes more of what the session sends. Streaming steps stop
+    // when it says no and go on at the next advance()
+    using SendRoom = std::function<bool()>;
+    ServerSession(int clientSocket, WireReader::Source source, WireWriter::Queue queue, SendRoom sendRoom);
+    ~ServerSession();
+    // false once the session is over (done or failed) and the connection can be closed.
+    // peerClosed: nothing more will come in, a step still waiting for bytes ends the session
+    bool advance(bool peerClosed);
+    // received bytes the waiting step needs at least before advance() is worth calling
+    size_t bytesWanted() const { return bytesWanted_; }
+    // the session stopped streaming out for lack of room, advance() is worth calling once
+    // what was queued has gone out instead
+    bool waitingToSend() const { return waitingToSend_; }
+private:
+    enum class Stage { COMMAND, REQUEST, PUSH_SIGNATURE, PUSH_DELTA, PUSH_DIGEST, PULL_SIGNATURE_HEADER, PULL_SIGNATURE_BLOCKS,
+                       PULL_DELTA, DONE };
+    // a step moves on to the next stage, waits for more bytes, waits for room to send, or ends the session
+    enum class Step { NEXT, WAIT, DRAIN, END };
+    // a receive either got its whole message, ran out of bytes or failed
+    enum class Received { OK, SHORT, FAILED };
+
+    Step receiveCommand();
+    Step receiveRequest();
+    Step streamSignature();
+    Step sendSignatureRest();
+    Step receiveDeltaFrames();
+    Step receiveFileDigest();
+    Step finishPush(const StrongHash* digest);
+    Step receiveSignatureHeader();
+    Step receiveSignatureBlocks();
+    Step beginDelta();
+    Step streamDelta();
+    Step abortDelta(const std::string& message);
+    template<class Parse>
+    Received receive(Parse parse);
+    bool sendStatus(bool status, const std::string& message);
+
+    int clientSocket_;
+    DataTransfer dataPipe_;
+    SendRoom sendRoom_;
+    Stage stage_ = Stage::COMMAND;
+    size_t bytesWanted_ = 1;
+    bool waitingToSend_ = false;
+    bool push_ = false;
+    std::string remotePath_;
+    TransferOptions options_;
+    std::unique_ptr<DestinationManager> dest_;   // PUSH
+    size_t blocksSent_ = 0;                      // of its signature
+    Result<void> applyResult_ = Result<void>::Ok();
+    std::unique_ptr<SourceManager> source_;      // PULL
+    SignatureSink signatureSink_;
+};
@@ -5,9 +5,12 @@
 SyncEngine:: SyncEngine(const std::string& sourcePath, const std::string& destPath, size_t blockSize):sourcePath_(sourcePath),destPath_(destPath),blockSize_(blockSize){}
 
 void SyncEngine::syncFile(){
-    DestinationManager dest(destPath_);
+    TransferOptions options;
+    options.blockSize = static_cast<uint32_t>(blockSize_);
+    DestinationManager dest(destPath_, options);
     auto blocks = dest.getFileBlockHashes().data;
     SourceManager src(sourcePath_,blocks);
+    src.useLocalBasis(destPath_);
     auto deltaData=src.getDelta().data;
     dest.applyDelta(deltaData);
     std::cout<<"Sync Completed\n";
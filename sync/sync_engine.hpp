@@ -3,7 +3,7 @@
 
 class SyncEngine {
 public:
-    SyncEngine(const std::string& sourcePath, const std::string& destPath, size_t blockSize = 4096);
+    SyncEngine(const std::string& sourcePath, const std::string& destPath, size_t blockSize = 0);  // 0 picks it from the file size
     void syncFile(); // calls DestinationManager + SourceDeltaGenerator + apply
 private:
     std::string sourcePath_;
@@ -0,0 +1,20 @@
+#pragma once
+// minimal checks for the unit tests, so they need nothing beyond the compiler: a failed CHECK
+// prints where it failed and the test carries on, main returns Check::result() for ctest
+#include <cstdio>
+
+namespace Check {
+inline int failures = 0;
+inline int result() {
+    if (failures > 0) std::fprintf(stderr, "%d check(s) failed\n", failures);
+    return failures > 0 ? 1 : 0;
+}
+}
+
+#define CHECK(condition)                                                                  \
+    do {                                                                                  \
+        if (!(condition)) {                                                               \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            Check::failures++;                                                            \
+        }                                                                                 \
+    } while (0)
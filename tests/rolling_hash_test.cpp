@@ -0,0 +1,80 @@
+// RollingHash against HashUtils::computeWeakHash, the definition of the polynomial weak hash:
+// every window of hashWindows, every block of hashBlocks and hash() of one window must match it.
+// ctest runs this once with the AVX2 kernels and once with FILESYNC_NO_AVX2 set (scalar kernels)
+#include "check.hpp"
+#include "../common/rolling_hash.hpp"
+#include "../common/hash_utils.hpp"
+#include "../common/cpu_features.hpp"
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+// random bytes, and runs of 0x00 and 0xFF: the smallest and largest terms the reductions see
+std::vector<char> testData(size_t size) {
+    std::mt19937_64 random(7);
+    std::vector<char> data(size);
+    for (size_t i = 0; i < size; ++i) data[i] = static_cast<char>(random());
+    for (size_t i = size / 3; i < size / 3 + 5000 && i < size; ++i) data[i] = 0;
+    for (size_t i = size / 2; i < size / 2 + 5000 && i < size; ++i) data[i] = static_cast<char>(0xFF);
+    return data;
+}
+
+// positions far apart are sampled once comparing every one would be too slow
+void checkWindows(const std::vector<char>& data, size_t window, size_t count) {
+    RollingHash roller(window);
+    std::vector<uint32_t> hashes(count);
+    roller.hashWindows(data.data(), count, hashes.data());
+    const size_t step = count * window > 50000000 ? 97 : 1;
+    int mismatches = 0;
+    for (size_t i = 0; i < count; ++i) {
+        bool edge = i < 2000 || i + 2000 >= count;
+        if (!edge && i % step != 0) continue;
+        if (hashes[i] != HashUtils::computeWeakHash(data.data() + i, window)) mismatches++;
+    }
+    if (mismatches > 0) std::fprintf(stderr, "window %zu, %zu positions: %d mismatches\n", window, count, mismatches);
+    CHECK(mismatches == 0);
+}
+
+void testWindows(const std::vector<char>& data) {
+    const size_t WINDOWS[] = { 1, 7, 8, 9, 64, 512, 1000, 1232, 4096, 65536 };
+    const size_t COUNTS[] = { 1, 5, 8, 100, 1023, 1024, 1025, 5000, 70001, 1 << 20 };
+    for (size_t window : WINDOWS) {
+        for (size_t count : COUNTS) {
+            if (count - 1 + window > data.size()) continue;
+            checkWindows(data, window, count);
+        }
+    }
+}
+
+void testBlocks(const std::vector<char>& data) {
+    for (size_t window : { 8, 512, 1000, 4096 }) {
+        RollingHash roller(window);
+        for (size_t count = 0; count <= 20; ++count) {
+            std::vector<uint32_t> hashes(count);
+            roller.hashBlocks(data.data(), count, hashes.data());
+            for (size_t b = 0; b < count; ++b) {
+                CHECK(hashes[b] == HashUtils::computeWeakHash(data.data() + b * window, window));
+            }
+        }
+    }
+}
+
+void testSingleWindow(const std::vector<char>& data) {
+    for (size_t window : { 1, 7, 8, 15, 16, 17, 512, 1000, 1232, 65536 }) {
+        RollingHash roller(window);
+        for (size_t at : { size_t(0), size_t(3), data.size() / 3 - 10, data.size() / 2 - 100 }) {
+            CHECK(roller.hash(data.data() + at) == HashUtils::computeWeakHash(data.data() + at, window));
+        }
+    }
+}
+}
+
+int main() {
+    std::printf("kernels: %s\n", CpuFeatures::avx2() ? "avx2" : "scalar");
+    std::vector<char> data = testData((1 << 20) + 70000);
+    testWindows(data);
+    testBlocks(data);
+    testSingleWindow(data);
+    return Check::result();
+}
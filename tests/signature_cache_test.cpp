@@ -0,0 +1,113 @@
+// SignatureCache against racily clean files: an entry written in the same timestamp tick as the
+// file's last change must never hit, a rewrite of the same size in that tick keeps size and mtime.
+// Runs on a private cache directory under /tmp
+#include "check.hpp"
+#include "../common/signature_cache.hpp"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+
+namespace {
+const size_t BLOCK_SIZE = 4096;
+const size_t FILE_SIZE = 4 * BLOCK_SIZE;
+
+// the file holds FILE_SIZE copies of fill, its mtime is set to mtime
+void writeFile(const std::string& path, char fill, const struct timespec& mtime) {
+    std::vector<char> data(FILE_SIZE, fill);
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    CHECK(fd >= 0 && write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size()));
+    struct timespec times[2] = { mtime, mtime };
+    CHECK(futimens(fd, times) == 0);
+    close(fd);
+}
+
+// stand in hashes, the cache does not care what they are
+std::vector<BlockInfo> blocksOf(char fill) {
+    std::vector<BlockInfo> blocks;
+    for (size_t offset = 0; offset < FILE_SIZE; offset += BLOCK_SIZE) {
+        StrongHash strong;
+        strong.length = 20;
+        for (size_t i = 0; i < strong.length; ++i) strong.bytes[i] = static_cast<unsigned char>(fill + offset / BLOCK_SIZE + i);
+        blocks.emplace_back(offset, BLOCK_SIZE, static_cast<uint32_t>(fill) * 1000 + offset / BLOCK_SIZE, strong);
+    }
+    return blocks;
+}
+
+bool store(const std::string& path, char fill) {
+    FileIdentity identity;
+    CHECK(SignatureCache::identify(path, identity));
+    return SignatureCache::store(identity, BLOCK_SIZE, WeakHashAlgorithm::POLYNOMIAL, StrongHashAlgorithm::SHA1, blocksOf(fill));
+}
+
+// a hit has to hand back what was stored for fill
+bool load(const std::string& path, char fill) {
+    FileIdentity identity;
+    CHECK(SignatureCache::identify(path, identity));
+    std::vector<BlockInfo> blocks;
+    if (!SignatureCache::load(identity, BLOCK_SIZE, WeakHashAlgorithm::POLYNOMIAL, StrongHashAlgorithm::SHA1, blocks)) return false;
+    std::vector<BlockInfo> expected = blocksOf(fill);
+    CHECK(blocks.size() == expected.size());
+    for (size_t i = 0; i < blocks.size() && i < expected.size(); ++i) {
+        CHECK(blocks[i].weakHash == expected[i].weakHash && blocks[i].strongHash == expected[i].strongHash);
+    }
+    return true;
+}
+
+struct timespec secondsFromNow(time_t seconds, long nanoseconds) {
+    struct timespec now{};
+    clock_gettime(CLOCK_REALTIME, &now);
+    return { now.tv_sec + seconds, nanoseconds };
+}
+
+// a file changed a while ago is cached, an entry dated before the file's mtime is ignored
+void testOldFile(const std::string& path) {
+    writeFile(path, 'a', secondsFromNow(-10, 500));
+    CHECK(store(path, 'a'));
+    CHECK(load(path, 'a'));
+
+    FileIdentity identity;
+    CHECK(SignatureCache::identify(path, identity));
+    char name[64];
+    std::snprintf(name, sizeof(name), "/%llx-%llx.sig",
+                  static_cast<unsigned long long>(identity.device), static_cast<unsigned long long>(identity.inode));
+    std::string entry = std::getenv("FILESYNC_CACHE_DIR") + std::string(name);
+    struct timespec before = secondsFromNow(-20, 0);
+    struct timespec times[2] = { before, before };
+    CHECK(utimensat(AT_FDCWD, entry.c_str(), times, 0) == 0);
+    CHECK(!load(path, 'a'));
+}
+
+// the file is rewritten with the same size and keeps its mtime, as a second write within one
+// tick does: the first contents must not be served for the second
+void testRewriteInTick(const std::string& path, const struct timespec& tick) {
+    writeFile(path, 'b', tick);
+    CHECK(!store(path, 'b'));
+    CHECK(!load(path, 'b'));
+    writeFile(path, 'c', tick);
+    CHECK(!load(path, 'b'));
+    CHECK(!load(path, 'c'));
+}
+}
+
+int main() {
+    char dir[] = "/tmp/signature_cache_test.XXXXXX";
+    CHECK(mkdtemp(dir) != nullptr);
+    std::string cacheDir = std::string(dir) + "/cache";
+    setenv("FILESYNC_CACHE_DIR", cacheDir.c_str(), 1);
+    std::string path = std::string(dir) + "/file";
+
+    testOldFile(path);
+    // fine timestamps, the rewrite keeps the nanoseconds too. The tick lies ahead so the entry
+    // can not be newer than the file
+    testRewriteInTick(path, secondsFromNow(1, 250000000));
+    // whole second timestamps (a coarse filesystem): a second may have passed already
+    testRewriteInTick(path, secondsFromNow(-1, 0));
+
+    std::string clean = std::string("rm -rf ") + dir;
+    CHECK(std::system(clean.c_str()) == 0);
+    return Check::result();
+}
@@ -0,0 +1,134 @@
+// strong hashes against published values. BLAKE3: the official test vectors (test_vectors.json,
+// input byte i is i % 251, default hash mode), lengths around the chunk and tree edges. XXH3-128:
+// the empty input, and the reference implementation (xxHash 0.8, seed 0) over the same inputs,
+// lengths around its size classes. The batched BLAKE3 (eight blocks side by side in AVX2) must
+// give each block's digest; ctest also runs this with FILESYNC_NO_AVX2 set
+#include "check.hpp"
+#include "../common/blake3.hpp"
+#include "../common/xxh3.hpp"
+#include "../common/hash_utils.hpp"
+#include "../common/cpu_features.hpp"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+std::vector<char> input(size_t len) {
+    std::vector<char> data(len);
+    for (size_t i = 0; i < len; ++i) data[i] = static_cast<char>(i % 251);
+    return data;
+}
+
+std::string hex(const uint8_t* bytes, size_t len) {
+    std::string text;
+    char digits[3];
+    for (size_t i = 0; i < len; ++i) {
+        std::snprintf(digits, sizeof(digits), "%02x", bytes[i]);
+        text += digits;
+    }
+    return text;
+}
+
+struct Vector {
+    size_t length;
+    const char* digest;
+};
+
+void testBlake3() {
+    const Vector VECTORS[] = {
+        { 0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262" },
+        { 1, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213" },
+        { 1023, "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11" },
+        { 1024, "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7" },
+        { 1025, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444" },
+        { 2048, "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a" },
+        { 2049, "5f4d72f40d7a5f82b15ca2b2e44b1de3c2ef86c426c95c1af0b6879522563030" },
+        { 3072, "b98cb0ff3623be03326b373de6b9095218513e64f1ee2edd2525c7ad1e5cffd2" },
+        { 3073, "7124b49501012f81cc7f11ca069ec9226cecb8a2c850cfe644e327d22d3e1cd3" },
+        { 4096, "015094013f57a5277b59d8475c0501042c0b642e531b0a1c8f58d2163229e969" },
+        { 4097, "9b4052b38f1c5fc8b1f9ff7ac7b27cd242487b3d890d15c96a1c25b8aa0fb995" },
+        { 5120, "9cadc15fed8b5d854562b26a9536d9707cadeda9b143978f319ab34230535833" },
+        { 5121, "628bd2cb2004694adaab7bbd778a25df25c47b9d4155a55f8fbd79f2fe154cff" },
+        { 8192, "aae792484c8efe4f19e2ca7d371d8c467ffb10748d8a5a1ae579948f718a2a63" },
+        { 8193, "bab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b" },
+        { 16384, "f875d6646de28985646f34ee13be9a576fd515f76b5b0a26bb324735041ddde4" },
+        { 31744, "62b6960e1a44bcc1eb1a611a8d6235b6b4b78f32e7abc4fb4c6cdcce94895c47" },
+        { 102400, "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085" },
+    };
+    for (const Vector& vector : VECTORS) {
+        std::vector<char> data = input(vector.length);
+        uint8_t digest[Blake3::DIGEST_LENGTH];
+        Blake3::hash(data.data(), data.size(), digest);
+        if (hex(digest, sizeof(digest)) != vector.digest) std::fprintf(stderr, "blake3 of %zu bytes\n", vector.length);
+        CHECK(hex(digest, sizeof(digest)) == vector.digest);
+    }
+}
+
+void testXxh3() {
+    const Vector VECTORS[] = {
+        { 0, "99aa06d3014798d86001c324468d497f" },
+        { 1, "a6cd5e9392000f6ac44bdff4074eecdb" },
+        { 3, "e3b55f57945a17cf5f4299fc161c9cbb" },
+        { 4, "eb70bf5fc779e9e6a6111d53e80a3db5" },
+        { 8, "e1e4432a62217fe4cfd50c61c8bb98c1" },
+        { 9, "16c769d83e4aebce907931979dca3746" },
+        { 16, "72950631827607e2842812cc870dcae2" },
+        { 17, "685bc458b37d057fc06e233df7729217" },
+        { 128, "14792fc3af88dc6c05321a0b64d67b41" },
+        { 129, "dd5e74ac6b45f54ebc30b63382b09a3b" },
+        { 240, "65b5be86da5540e7c92b68e16f83bbb6" },
+        { 241, "1da1cb61bcb8a2a102e8cd95421c6d02" },
+        { 1024, "d0ac1f7b93bf57b9e5d78bafa45b2aa5" },
+        { 2048, "a5141efedfefc1af25339063db861586" },
+        { 100000, "54182c58bbb1337c42c23aeead96750d" },
+    };
+    for (const Vector& vector : VECTORS) {
+        std::vector<char> data = input(vector.length);
+        uint8_t digest[Xxh3::DIGEST_LENGTH];
+        Xxh3::hash128(data.data(), data.size(), digest);
+        if (hex(digest, sizeof(digest)) != vector.digest) std::fprintf(stderr, "xxh3 of %zu bytes\n", vector.length);
+        CHECK(hex(digest, sizeof(digest)) == vector.digest);
+    }
+}
+
+// eight at a time and the rest one by one, for block sizes around the chunk size
+void testBlake3Blocks() {
+    std::vector<char> data = input(40 * 4097);
+    for (size_t blockSize : { 64, 512, 1000, 1024, 1025, 4096, 4097 }) {
+        for (size_t count : { 1, 7, 8, 9, 17, 40 }) {
+            std::vector<uint8_t> digests(count * Blake3::DIGEST_LENGTH);
+            Blake3::hashBlocks(data.data(), blockSize, count, reinterpret_cast<uint8_t (*)[Blake3::DIGEST_LENGTH]>(digests.data()));
+            for (size_t i = 0; i < count; ++i) {
+                uint8_t single[Blake3::DIGEST_LENGTH];
+                Blake3::hash(data.data() + i * blockSize, blockSize, single);
+                CHECK(hex(&digests[i * Blake3::DIGEST_LENGTH], Blake3::DIGEST_LENGTH) == hex(single, Blake3::DIGEST_LENGTH));
+            }
+        }
+    }
+}
+
+// the dispatch of HashUtils, and batches of it against single blocks
+void testHashUtils() {
+    std::vector<char> data = input(10 * 512);
+    for (StrongHashAlgorithm algorithm : { StrongHashAlgorithm::SHA1, StrongHashAlgorithm::BLAKE3, StrongHashAlgorithm::XXH3_128 }) {
+        StrongHash batch[10];
+        HashUtils::computeStrongHashes(algorithm, data.data(), 512, 10, batch);
+        for (size_t i = 0; i < 10; ++i) {
+            StrongHash single = HashUtils::computeStrongHash(algorithm, data.data() + i * 512, 512);
+            CHECK(single.length == HashUtils::digestLength(algorithm));
+            CHECK(batch[i] == single);
+        }
+    }
+    StrongHash sha1 = HashUtils::computeStrongHash(StrongHashAlgorithm::SHA1, "abc", 3);
+    CHECK(hex(sha1.bytes, sha1.length) == "a9993e364706816aba3e25717850c26c9cd0d89d");
+}
+}
+
+int main() {
+    std::printf("kernels: %s\n", CpuFeatures::avx2() ? "avx2" : "scalar");
+    testBlake3();
+    testXxh3();
+    testBlake3Blocks();
+    testHashUtils();
+    return Check::result();
+}
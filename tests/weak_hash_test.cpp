@@ -0,0 +1,82 @@
+// the weak hash policies: hashWindows(i) is hash(data + i) for every position (the rolled value
+// is what the source looks up, the hash of a block is what the destination sent), and
+// WeakHash::compute / computeBlocks agree with the policies
+#include "check.hpp"
+#include "../common/weak_hash.hpp"
+#include "../common/hash_utils.hpp"
+#include <random>
+#include <vector>
+
+namespace {
+// random bytes with runs of 0x00 and 0xFF, so sums and rotations wrap
+std::vector<char> testData(size_t size) {
+    std::mt19937_64 random(11);
+    std::vector<char> data(size);
+    for (size_t i = 0; i < size; ++i) data[i] = static_cast<char>(random());
+    for (size_t i = size / 4; i < size / 4 + 3000; ++i) data[i] = 0;
+    for (size_t i = size / 2; i < size / 2 + 3000; ++i) data[i] = static_cast<char>(0xFF);
+    return data;
+}
+
+template <class Policy>
+void checkWindows(const std::vector<char>& data, size_t window) {
+    Policy policy(window);
+    const size_t count = data.size() - window + 1;
+    std::vector<uint32_t> hashes(count);
+    policy.hashWindows(data.data(), count, hashes.data());
+    int mismatches = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (hashes[i] != policy.hash(reinterpret_cast<const uint8_t*>(data.data() + i))) mismatches++;
+    }
+    CHECK(mismatches == 0);
+
+    // a short run starting anywhere is the same as the matching part of a long one
+    std::vector<uint32_t> part(5);
+    policy.hashWindows(data.data() + 1234, part.size(), part.data());
+    for (size_t i = 0; i < part.size(); ++i) CHECK(part[i] == hashes[1234 + i]);
+}
+
+template <class Policy>
+void checkPolicy(const std::vector<char>& data) {
+    for (size_t window : { 64, 65, 512, 1000, 4096 }) checkWindows<Policy>(data, window);
+}
+
+void testCompute(const std::vector<char>& data) {
+    const size_t BLOCK = 512, COUNT = 37;
+    for (uint8_t a = 0; a < WEAK_HASH_ALGORITHM_COUNT; ++a) {
+        WeakHashAlgorithm algorithm = static_cast<WeakHashAlgorithm>(a);
+        std::vector<uint32_t> blocks(COUNT);
+        WeakHash::computeBlocks(algorithm, data.data(), BLOCK, COUNT, blocks.data());
+        for (size_t b = 0; b < COUNT; ++b) {
+            CHECK(blocks[b] == WeakHash::compute(algorithm, data.data() + b * BLOCK, BLOCK));
+        }
+        WeakHashAlgorithm named;
+        CHECK(WeakHash::fromName(WeakHash::name(algorithm), named) && named == algorithm);
+    }
+    CHECK(WeakHash::compute(WeakHashAlgorithm::POLYNOMIAL, data.data(), 1000) == HashUtils::computeWeakHash(data.data(), 1000));
+    CHECK(WeakHash::compute(WeakHashAlgorithm::ADLER, data.data(), 1000) == AdlerHash(1000).hash(reinterpret_cast<const uint8_t*>(data.data())));
+    WeakHashAlgorithm unknown;
+    CHECK(!WeakHash::fromName("md5", unknown));
+}
+
+// gear hashes only the last SPAN bytes, windows that end alike collide whatever comes before
+void testGearSpan(const std::vector<char>& data) {
+    std::vector<char> changed(data.begin(), data.begin() + 1024);
+    changed[0] ^= 1;
+    GearHash gear(1024);
+    CHECK(gear.hash(reinterpret_cast<const uint8_t*>(changed.data())) == gear.hash(reinterpret_cast<const uint8_t*>(data.data())));
+    BuzHash buz(1024);
+    CHECK(buz.hash(reinterpret_cast<const uint8_t*>(changed.data())) != buz.hash(reinterpret_cast<const uint8_t*>(data.data())));
+}
+}
+
+int main() {
+    std::vector<char> data = testData(200000);
+    checkPolicy<PolynomialHash>(data);
+    checkPolicy<AdlerHash>(data);
+    checkPolicy<BuzHash>(data);
+    checkPolicy<GearHash>(data);
+    testCompute(data);
+    testGearSpan(data);
+    return Check::result();
+}
@@ -0,0 +1,258 @@
+// signature wire format: a fixed width header, then per block [u32 weak hash or chunk length]
+// [strong hash truncated to strongLength], offsets implicit. Encoded bytes are checked field by
+// field, decoded back, and malformed signatures must be refused
+#include "check.hpp"
+#include "../common/data_transfer.hpp"
+#include "../common/hash_utils.hpp"
+#include "../common/weak_hash.hpp"
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+namespace {
+const size_t HEADER_SIZE = 28;
+
+// what the sender puts on the wire, small signatures only (they have to fit the socket buffer)
+std::vector<uint8_t> encode(const Signature& signature, bool* sent = nullptr) {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    DataTransfer pipe;
+    bool ok = pipe.serializeAndSendBlockHashes(fds[0], signature);
+    if (sent) *sent = ok;
+    close(fds[0]);
+    std::vector<uint8_t> bytes;
+    uint8_t buffer[4096];
+    ssize_t got;
+    while ((got = read(fds[1], buffer, sizeof(buffer))) > 0) bytes.insert(bytes.end(), buffer, buffer + got);
+    close(fds[1]);
+    return bytes;
+}
+
+bool decode(const std::vector<uint8_t>& bytes, Signature& signature) {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    write(fds[0], bytes.data(), bytes.size());
+    close(fds[0]);
+    DataTransfer pipe;
+    bool ok = pipe.receiveBlockHashes(fds[1], signature);
+    close(fds[1]);
+    return ok;
+}
+
+StrongHash digestOf(const std::string& text) {
+    return HashUtils::computeStrongHash(StrongHashAlgorithm::SHA1, text.data(), text.size());
+}
+
+void testFixedBlocks() {
+    const uint32_t BLOCK = 512;
+    Signature signature;
+    signature.header.blockSize = BLOCK;
+    signature.header.fileSize = 10 * BLOCK + 100;   // the last block is short
+    signature.header.weakHashAlgorithm = WeakHashAlgorithm::BUZHASH;
+    signature.header.strongLength = 6;
+    for (size_t i = 0; i < 11; ++i) {
+        uint64_t offset = i * BLOCK;
+        signature.blocks.emplace_back(offset, std::min<uint64_t>(BLOCK, signature.header.fileSize - offset),
+                                      0x01020304u * static_cast<uint32_t>(i + 1), digestOf("block " + std::to_string(i)));
+    }
+
+    std::vector<uint8_t> bytes = encode(signature);
+    CHECK(bytes.size() == HEADER_SIZE + 11 * (4 + 6));
+    if (bytes.size() != HEADER_SIZE + 11 * (4 + 6)) return;
+    CHECK(bytes[0] == static_cast<uint8_t>(ChunkingMode::FIXED));
+    CHECK(Wire::loadU32(&bytes[1]) == BLOCK);
+    CHECK(Wire::loadU64(&bytes[13]) == signature.header.fileSize);
+    CHECK(bytes[21] == static_cast<uint8_t>(WeakHashAlgorithm::BUZHASH));
+    CHECK(bytes[22] == static_cast<uint8_t>(StrongHashAlgorithm::SHA1));
+    CHECK(bytes[23] == 6);
+    CHECK(Wire::loadU32(&bytes[24]) == 11);
+    for (size_t i = 0; i < 11; ++i) {
+        const uint8_t* record = &bytes[HEADER_SIZE + i * 10];
+        CHECK(Wire::loadU32(record) == signature.blocks[i].weakHash);
+        CHECK(std::memcmp(record + 4, signature.blocks[i].strongHash.bytes, 6) == 0);
+    }
+
+    Signature decoded;
+    CHECK(decode(bytes, decoded));
+    CHECK(decoded.header.blockSize == BLOCK);
+    CHECK(decoded.header.fileSize == signature.header.fileSize);
+    CHECK(decoded.header.weakHashAlgorithm == WeakHashAlgorithm::BUZHASH);
+    CHECK(decoded.header.strongLength == 6);
+    CHECK(decoded.blocks.size() == 11);
+    for (size_t i = 0; i < decoded.blocks.size() && i < 11; ++i) {
+        StrongHash truncated = signature.blocks[i].strongHash;
+        truncated.truncate(6);
+        CHECK(decoded.blocks[i].offset == i * BLOCK);
+        CHECK(decoded.blocks[i].length == (i < 10 ? BLOCK : 100));
+        CHECK(decoded.blocks[i].weakHash == signature.blocks[i].weakHash);
+        CHECK(decoded.blocks[i].strongHash == truncated);
+    }
+}
+
+void testContentDefinedChunks() {
+    const uint64_t LENGTHS[] = { 3000, 5000, 1234 };
+    Signature signature;
+    signature.header.chunking = ChunkingMode::CDC;
+    signature.header.blockSize = 4096;
+    signature.header.minChunkSize = 1024;
+    signature.header.maxChunkSize = 16384;
+    signature.header.strongLength = 8;
+    uint64_t offset = 0;
+    for (size_t i = 0; i < 3; ++i) {
+        signature.blocks.emplace_back(offset, LENGTHS[i], 0, digestOf("chunk " + std::to_string(i)));
+        offset += LENGTHS[i];
+    }
+    signature.header.fileSize = offset;
+
+    std::vector<uint8_t> bytes = encode(signature);
+    CHECK(bytes.size() == HEADER_SIZE + 3 * (4 + 8));
+    if (bytes.size() != HEADER_SIZE + 3 * (4 + 8)) return;
+    CHECK(bytes[0] == static_cast<uint8_t>(ChunkingMode::CDC));
+    CHECK(Wire::loadU32(&bytes[5]) == 1024);
+    CHECK(Wire::loadU32(&bytes[9]) == 16384);
+    for (size_t i = 0; i < 3; ++i) CHECK(Wire::loadU32(&bytes[HEADER_SIZE + i * 12]) == LENGTHS[i]);
+
+    Signature decoded;
+    CHECK(decode(bytes, decoded));
+    CHECK(decoded.blocks.size() == 3);
+    offset = 0;
+    for (size_t i = 0; i < decoded.blocks.size() && i < 3; ++i) {
+        CHECK(decoded.blocks[i].offset == offset);
+        CHECK(decoded.blocks[i].length == LENGTHS[i]);
+        CHECK(std::memcmp(decoded.blocks[i].strongHash.bytes, signature.blocks[i].strongHash.bytes, 8) == 0);
+        offset += LENGTHS[i];
+    }
+
+    // chunks have to cover the file exactly and none may be empty
+    std::vector<uint8_t> shortFile = bytes;
+    Wire::storeU64(&shortFile[13], offset + 1);
+    CHECK(!decode(shortFile, decoded));
+    std::vector<uint8_t> emptyChunk = bytes;
+    Wire::storeU32(&emptyChunk[HEADER_SIZE], 0);
+    CHECK(!decode(emptyChunk, decoded));
+}
+
+void testEmptyFile() {
+    Signature signature;
+    signature.header.blockSize = 512;
+    signature.header.strongLength = 4;
+    std::vector<uint8_t> bytes = encode(signature);
+    CHECK(bytes.size() == HEADER_SIZE);
+    Signature decoded;
+    CHECK(decode(bytes, decoded));
+    CHECK(decoded.blocks.empty());
+}
+
+void testMalformedHeaders() {
+    Signature signature;
+    signature.header.blockSize = 512;
+    signature.header.fileSize = 2048;
+    signature.header.strongLength = 4;
+    for (size_t i = 0; i < 4; ++i) signature.blocks.emplace_back(i * 512, 512, 7, digestOf(std::to_string(i)));
+    const std::vector<uint8_t> bytes = encode(signature);
+    Signature decoded;
+    CHECK(decode(bytes, decoded));
+
+    auto refused = [&](size_t at, uint8_t value) {
+        std::vector<uint8_t> changed = bytes;
+        changed[at] = value;
+        return !decode(changed, decoded);
+    };
+    CHECK(refused(0, 2));                    // unknown chunking mode
+    CHECK(refused(21, WEAK_HASH_ALGORITHM_COUNT));
+    CHECK(refused(22, 0));                   // unknown strong hash
+    CHECK(refused(23, 0));                   // no strong hash at all
+    CHECK(refused(23, 21));                  // longer than a SHA-1 digest
+    CHECK(refused(27, 5));                   // block count does not follow from the file size
+    std::vector<uint8_t> truncated(bytes.begin(), bytes.end() - 1);
+    CHECK(!decode(truncated, decoded));
+}
+
+// a record cannot carry more of the strong hash than the block has
+void testSenderChecksStrongLength() {
+    Signature signature;
+    signature.header.blockSize = 512;
+    signature.header.fileSize = 512;
+    signature.header.strongLength = 8;
+    StrongHash shortHash = digestOf("x");
+    shortHash.truncate(4);
+    signature.blocks.emplace_back(0, 512, 1, shortHash);
+    bool sent = true;
+    encode(signature, &sent);
+    CHECK(!sent);
+}
+
+// the options payload only grows: [12] asks for whole strong hashes
+void testTransferOptions() {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    TransferOptions options;
+    options.weakHash = WeakHashAlgorithm::GEAR;
+    options.fullStrongHash = true;
+    DataTransfer out, in;
+    CHECK(out.sendTransferOptions(fds[0], options));
+    TransferOptions received;
+    CHECK(in.receiveTransferOptions(fds[1], received));
+    CHECK(received.weakHash == WeakHashAlgorithm::GEAR);
+    CHECK(received.fullStrongHash);
+    CHECK(received.features == SUPPORTED_TRANSFER_FEATURES);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// [u8 length][digest], a length the digest cannot have is refused
+void testFileDigest() {
+    const std::string FILE = "some file content";
+    StrongHash digest = HashUtils::fileDigest(StrongHashAlgorithm::SHA1, FILE.data(), FILE.size(), 4);
+    StrongHash blocks[5];
+    for (size_t i = 0; i < 5; ++i) blocks[i] = digestOf(FILE.substr(i * 4, 4));
+    CHECK(digest == HashUtils::fileDigest(StrongHashAlgorithm::SHA1, FILE.size(), blocks, 5));
+
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    DataTransfer out, in;
+    CHECK(out.sendFileDigest(fds[0], digest));
+    StrongHash received;
+    CHECK(in.receiveFileDigest(fds[1], received));
+    CHECK(received == digest);
+    const uint8_t TOO_LONG = StrongHash::MAX_LENGTH + 1;
+    write(fds[0], &TOO_LONG, 1);
+    CHECK(!in.receiveFileDigest(fds[1], received));
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void testStrongHashLength() {
+    const uint8_t SHA1_LENGTH = HashUtils::digestLength(StrongHashAlgorithm::SHA1);
+    const int WEAK_BITS = WeakHash::matchBits(WeakHashAlgorithm::POLYNOMIAL);
+    CHECK(HashUtils::strongHashLength(StrongHashAlgorithm::SHA1, 0, 512, WEAK_BITS) == 4);
+    CHECK(HashUtils::strongHashLength(StrongHashAlgorithm::SHA1, 1ull << 20, 1024, WEAK_BITS) == 4);
+    // 24 bits of margin + 2 * 40 - 9 = 95 bits
+    CHECK(HashUtils::strongHashLength(StrongHashAlgorithm::SHA1, 1ull << 40, 512, 0) == 12);
+    // a gear hash match says nothing about the bytes before the last 64 of a block
+    CHECK(WeakHash::matchBits(WeakHashAlgorithm::GEAR) == 0);
+    CHECK(HashUtils::strongHashLength(StrongHashAlgorithm::SHA1, 1ull << 30, 1 << 15, WeakHash::matchBits(WeakHashAlgorithm::GEAR)) ==
+          HashUtils::strongHashLength(StrongHashAlgorithm::SHA1, 1ull << 30, 1 << 15, 0));
+    uint8_t previous = 0;
+    for (int bits = 10; bits <= 40; ++bits) {
+        uint8_t length = HashUtils::strongHashLength(StrongHashAlgorithm::SHA1, 1ull << bits, 512, WEAK_BITS);
+        CHECK(length >= previous && length >= 4 && length <= SHA1_LENGTH);
+        // without a weak hash to pass first, more of the strong hash is needed
+        CHECK(HashUtils::strongHashLength(StrongHashAlgorithm::SHA1, 1ull << bits, 512, 0) >= length);
+        previous = length;
+    }
+}
+}
+
+int main() {
+    testFixedBlocks();
+    testContentDefinedChunks();
+    testEmptyFile();
+    testMalformedHeaders();
+    testSenderChecksStrongLength();
+    testTransferOptions();
+    testFileDigest();
+    testStrongHashLength();
+    return Check::result();
+}